@@ -0,0 +1,781 @@
+//
+// Created by syang on 2018/05/15.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "host.h"
+#include "misc.h"
+#include "machine.h"
+#include "memory.h"
+#include "ucache.h"
+
+/* never a block address, so the last-line check fails until a line is hit */
+#define NO_TAGSET 1
+
+/* only the last-line hit is inlined into the entry points */
+#ifdef __GNUC__
+#define ALWAYS_INLINE __attribute__((always_inline))
+#define NOINLINE __attribute__((noinline))
+#else
+#define ALWAYS_INLINE
+#define NOINLINE
+#endif
+
+/**
+ * Cache Part
+ * Update time: Thu May 17 2018 09:59:35 GMT+0800
+ *
+ * Every set owns its ways up front, order[] keeps the way indices with
+ * order[0..n-1] the live queue (next victim first for FIFO and LRU) and
+ * order[n..] the free ways, so a miss never allocates and an eviction never
+ * frees.  PLRU additionally keeps assoc-1 tree bits per set in plru[1..].
+ */
+
+void ucache_init(cache_t *cache, struct mem_t *mem, int nsets, int bsize, int assoc,
+                repl_policy_t policy, int hit_lat, int miss_lat,
+                unsigned int (*blk_access_fn)(enum mem_cmd, md_addr_t, int, tick_t)) {
+  int i, j;
+  if(nsets <= 0 || (nsets & (nsets-1)) != 0)
+    fatal("cache size (in sets) `%d' must be a power of two", nsets);
+  if(bsize < (int)sizeof(word_t) || bsize > MD_PAGE_SIZE || (bsize & (bsize-1)) != 0)
+    fatal("cache block size `%d' must be a power of two between %d and %d",
+          bsize, (int)sizeof(word_t), MD_PAGE_SIZE);
+  if(assoc <= 0 || assoc > 256 || (assoc & (assoc-1)) != 0)
+    fatal("cache associativity `%d' must be a power of two up to 256", assoc);
+  if(hit_lat < 0 || miss_lat < hit_lat)
+    fatal("cache latencies must satisfy 0 <= hit `%d' <= miss `%d'", hit_lat, miss_lat);
+
+  cache->nsets = nsets;
+  cache->bsize = bsize;
+  cache->assoc = assoc;
+  cache->blk_mask = bsize-1;
+  cache->set_shift = log_base2(bsize);
+  cache->set_mask = nsets-1;
+  cache->tag_shift = cache->set_shift + log_base2(nsets);
+  cache->way_bits = log_base2(assoc);
+
+#ifdef UCACHE_FIXED
+  if(nsets != CACHE_SETS || bsize != LINE_WORDS*sizeof(word_t) || assoc != SET_NUM)
+    fatal("this sim-pipe is built for a fixed %d set, %d byte, %d-way cache",
+          CACHE_SETS, (int)(LINE_WORDS*sizeof(word_t)), SET_NUM);
+  memset(cache->sets, 0, sizeof(cache->sets));
+#else
+  {
+    unsigned int *tags = calloc(nsets*assoc, sizeof(unsigned int));
+    unsigned char *order = calloc(nsets*assoc, sizeof(unsigned char));
+    unsigned char *plru = calloc(nsets*assoc, sizeof(unsigned char));
+    cache_line_t *lines = calloc(nsets*assoc, sizeof(cache_line_t));
+    byte_t *data = calloc(nsets*assoc, bsize);
+    cache->sets = calloc(nsets, sizeof(cache_set_t));
+    if(!tags || !order || !plru || !lines || !data || !cache->sets)
+      fatal("out of virtual memory");
+    for(i = 0; i < nsets*assoc; i++) {
+      lines[i].data = (unsigned int *)(data + i*bsize);
+    }
+    for(i = 0; i < nsets; i++) {
+      cache->sets[i].tags = tags + i*assoc;
+      cache->sets[i].order = order + i*assoc;
+      cache->sets[i].plru = plru + i*assoc;
+      cache->sets[i].lines = lines + i*assoc;
+      cache->sets[i].n = 0;
+    }
+  }
+#endif
+  for(i = 0; i < nsets; i++) {
+    for(j = 0; j < assoc; j++) {
+      cache->sets[i].order[j] = j;
+    }
+  }
+  cache->mem = mem;
+  cache->policy = policy;
+  cache->hit_lat = hit_lat;
+  cache->miss_lat = miss_lat;
+  cache->blk_access_fn = blk_access_fn;
+  cache->write_through = 0;
+  cache->write_alloc = 1;
+  cache->wbuf_size = 0;
+  cache->wbuf_head = 0;
+  cache->wbuf_n = 0;
+  cache->wbuf = NULL;
+  cache->pf_kind = PF_NONE;
+  cache->pf_degree = 0;
+  cache->pf_table_size = 0;
+  cache->pf_table = NULL;
+  cache->pf_nstreams = 0;
+  cache->pf_streams = NULL;
+  cache->last_tagset = NO_TAGSET;
+  cache->last_line = NULL;
+  cache->enable = 1;
+  cache->access = 0;
+  cache->hit = 0;
+  cache->miss = 0;
+  cache->replace = 0;
+  cache->wb = 0;
+  cache->write_thru = 0;
+  cache->write_around = 0;
+  cache->wbuf_merge = 0;
+  cache->wbuf_full = 0;
+  cache->pf_issued = 0;
+  cache->pf_useful = 0;
+  cache->pf_late = 0;
+  cache->pf_useless = 0;
+}
+
+/* write-back or write-through, allocate on a store miss or not, and the
+   number of blocks the write buffer holds (0 for synchronous writes) */
+void ucache_write_policy(cache_t *cache, int write_through, int write_alloc, int wbuf_size) {
+  if(wbuf_size < 0)
+    fatal("write buffer size `%d' must be zero or more", wbuf_size);
+  cache->write_through = write_through;
+  cache->write_alloc = write_alloc;
+  cache->wbuf_size = wbuf_size;
+  cache->wbuf_head = 0;
+  cache->wbuf_n = 0;
+  if(wbuf_size) {
+    cache->wbuf = calloc(wbuf_size, sizeof(cache_wbuf_entry_t));
+    if(!cache->wbuf)
+      fatal("out of virtual memory");
+  }
+}
+
+/* KIND prefetches DEGREE blocks ahead (the depth of each stream buffer for
+   PF_STREAM), the stride prefetcher keeps TABLE_SIZE entries indexed by
+   PC, the stream prefetcher NSTREAMS buffers */
+void ucache_prefetch(cache_t *cache, pf_kind_t kind, int degree, int table_size, int nstreams) {
+  int i;
+  cache->pf_kind = kind;
+  if(kind == PF_NONE)
+    return;
+  if(degree < 1)
+    fatal("prefetch degree `%d' must be at least one", degree);
+  cache->pf_degree = degree;
+  if(kind == PF_STRIDE) {
+    if(table_size <= 0 || (table_size & (table_size-1)) != 0)
+      fatal("stride prefetch table size `%d' must be a power of two", table_size);
+    cache->pf_table_size = table_size;
+    cache->pf_table = calloc(table_size, sizeof(cache_pf_stride_t));
+    if(!cache->pf_table)
+      fatal("out of virtual memory");
+  }
+  if(kind == PF_STREAM) {
+    if(nstreams < 1)
+      fatal("number of stream buffers `%d' must be at least one", nstreams);
+    cache->pf_nstreams = nstreams;
+    cache->pf_streams = calloc(nstreams, sizeof(cache_pf_stream_t));
+    if(!cache->pf_streams)
+      fatal("out of virtual memory");
+    for(i = 0; i < nstreams; i++) {
+      cache->pf_streams[i].baddr = calloc(degree, sizeof(md_addr_t));
+      cache->pf_streams[i].ready = calloc(degree, sizeof(tick_t));
+      if(!cache->pf_streams[i].baddr || !cache->pf_streams[i].ready)
+        fatal("out of virtual memory");
+    }
+  }
+}
+
+pf_kind_t ucache_str2pf(char *s) {
+  if(!mystricmp(s, "none"))
+    return PF_NONE;
+  else if(!mystricmp(s, "nextline"))
+    return PF_NEXTLINE;
+  else if(!mystricmp(s, "stride"))
+    return PF_STRIDE;
+  else if(!mystricmp(s, "stream"))
+    return PF_STREAM;
+  fatal("bogus prefetcher `%s', use {none|nextline|stride|stream}", s);
+  return PF_NONE;
+}
+
+char *ucache_pf2str(pf_kind_t kind) {
+  switch(kind) {
+    case PF_NONE: return "none";
+    case PF_NEXTLINE: return "next-line";
+    case PF_STRIDE: return "stride";
+    case PF_STREAM: return "stream buffer";
+  }
+  return "<unknown>";
+}
+
+repl_policy_t ucache_str2policy(char *s) {
+  if(!mystricmp(s, "fifo"))
+    return REPL_FIFO;
+  else if(!mystricmp(s, "lru"))
+    return REPL_LRU;
+  else if(!mystricmp(s, "random"))
+    return REPL_RANDOM;
+  else if(!mystricmp(s, "plru"))
+    return REPL_PLRU;
+  fatal("bogus replacement policy `%s', use {fifo|lru|random|plru}", s);
+  return REPL_FIFO;
+}
+
+char *ucache_policy2str(repl_policy_t policy) {
+  switch(policy) {
+    case REPL_FIFO: return "FIFO";
+    case REPL_LRU: return "LRU";
+    case REPL_RANDOM: return "Random";
+    case REPL_PLRU: return "PLRU";
+  }
+  return "<unknown>";
+}
+
+void ucache_print_config(cache_t *cache, char *name, FILE *stream) {
+#ifdef UCACHE_FIXED
+  char *build = ", fixed geometry build";
+#else
+  char *build = "";
+#endif
+  fprintf(stream, "%s: %d sets, %d byte blocks, %d-way, `%s' replacement%s\n",
+          name, UCACHE_NSETS(cache), (int)UCACHE_BSIZE(cache), UCACHE_ASSOC(cache),
+          ucache_policy2str(cache->policy), build);
+  if(cache->blk_access_fn)
+    fprintf(stream, "%s: %d cycle hit, misses go to the next level\n",
+            name, cache->hit_lat);
+  else
+    fprintf(stream, "%s: %d cycle hit, %d cycle miss\n",
+            name, cache->hit_lat, cache->miss_lat);
+  fprintf(stream, "%s: %s, %s, ", name,
+          cache->write_through ? "write-through" : "write-back",
+          cache->write_alloc ? "write-allocate" : "no-write-allocate");
+  if(cache->wbuf_size)
+    fprintf(stream, "%d block write buffer\n", cache->wbuf_size);
+  else
+    fprintf(stream, "no write buffer\n");
+  if(cache->pf_kind == PF_STREAM)
+    fprintf(stream, "%s: %d stream buffers of %d blocks\n",
+            name, cache->pf_nstreams, cache->pf_degree);
+  else if(cache->pf_kind == PF_STRIDE)
+    fprintf(stream, "%s: stride prefetch, %d entry table, degree %d\n",
+            name, cache->pf_table_size, cache->pf_degree);
+  else if(cache->pf_kind != PF_NONE)
+    fprintf(stream, "%s: %s prefetch, degree %d\n",
+            name, ucache_pf2str(cache->pf_kind), cache->pf_degree);
+}
+
+void en_cache_set(cache_t *cache, cache_set_t *set, int way) {
+    int i;
+    /* move the free way to the tail of the live queue */
+    for (i = set->n; i < UCACHE_ASSOC(cache); i++) {
+        if (set->order[i] == way) {
+            set->order[i] = set->order[set->n];
+            set->order[set->n] = way;
+            break;
+        }
+    }
+    set->n += 1;
+}
+
+int de_cache_set(cache_t *cache, cache_set_t *set, int way) {
+    int i;
+    for (i = 0; i < set->n && set->order[i] != way; i++);
+    if (i == set->n) {
+        return -1;
+    }
+    for (; i < set->n - 1; i++) {
+        set->order[i] = set->order[i+1];
+    }
+    set->n -= 1;
+    /* park the way at the head of the free list */
+    set->order[set->n] = way;
+    set->tags[way] = 0;
+    set->lines[way].valid = 0;
+    return way;
+}
+
+void touch_cache_set(cache_t *cache, cache_set_t *set, int way) {
+    int i, node, dir;
+    switch (cache->policy) {
+    case REPL_LRU:
+        /* move the way to the MRU end of the queue */
+        for (i = 0; i < set->n && set->order[i] != way; i++);
+        for (; i < set->n - 1; i++) {
+            set->order[i] = set->order[i+1];
+        }
+        set->order[set->n - 1] = way;
+        break;
+    case REPL_PLRU:
+        /* point every node on the path away from the way */
+        for (node = 1, i = UCACHE_WAY_BITS(cache) - 1; i >= 0; i--) {
+            dir = (way >> i) & 1;
+            set->plru[node] = !dir;
+            node = 2*node + dir;
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+/* pick the way to replace in a full set */
+int ucache_victim(cache_t *cache, cache_set_t *set) {
+    int i, node, way;
+    switch (cache->policy) {
+    case REPL_RANDOM:
+        return myrand() & (UCACHE_ASSOC(cache) - 1);
+    case REPL_PLRU:
+        for (node = 1, way = 0, i = 0; i < UCACHE_WAY_BITS(cache); i++) {
+            way = (way << 1) | set->plru[node];
+            node = 2*node + set->plru[node];
+        }
+        return way;
+    default:
+        return set->order[0];
+    }
+}
+
+/* copy LINE back into memory */
+static void copy_line_out(cache_t *cache, cache_line_t *line, md_addr_t addr) {
+  int i, words = UCACHE_BSIZE(cache) / sizeof(word_t);
+  word_t *dst;
+  MEM_TICKLE(cache->mem, addr);
+  dst = (word_t *)(MEM_PAGE(cache->mem, addr) + MEM_OFFSET(addr));
+  for(i = 0; i < words; i++) {
+    dst[i] = MD_SWAPW(line->data[i]);
+  }
+  line->dirty = 0;
+}
+
+/* latency of the next level for block BADDR; without one a miss costs a
+   flat miss_lat, of which hit_lat is the lookup */
+static unsigned int next_level(cache_t *cache, enum mem_cmd cmd, md_addr_t baddr, tick_t now) {
+  if(cache->blk_access_fn) {
+    return cache->blk_access_fn(cmd, baddr, UCACHE_BSIZE(cache), now);
+  }
+  return cache->miss_lat - cache->hit_lat;
+}
+
+/* queue block BADDR for the next level, the blocks drain one after the
+   other in the background, so only a full buffer costs cycles */
+static unsigned int wbuf_put(cache_t *cache, md_addr_t baddr, tick_t now) {
+  cache_wbuf_entry_t *e;
+  unsigned int stall = 0;
+  tick_t start;
+  int i;
+
+  /* retire the blocks the next level has taken */
+  while(cache->wbuf_n && cache->wbuf[cache->wbuf_head].ready <= now) {
+    cache->wbuf_head = (cache->wbuf_head + 1) % cache->wbuf_size;
+    cache->wbuf_n--;
+  }
+  /* coalesce with a queued block, the head is already draining */
+  for(i = 1; i < cache->wbuf_n; i++) {
+    if(cache->wbuf[(cache->wbuf_head + i) % cache->wbuf_size].baddr == baddr) {
+      cache->wbuf_merge++;
+      return 0;
+    }
+  }
+  if(cache->wbuf_n == cache->wbuf_size) {
+    stall = cache->wbuf[cache->wbuf_head].ready - now;
+    cache->wbuf_full += stall;
+    now += stall;
+    cache->wbuf_head = (cache->wbuf_head + 1) % cache->wbuf_size;
+    cache->wbuf_n--;
+  }
+  start = now;
+  if(cache->wbuf_n) {
+    e = &cache->wbuf[(cache->wbuf_head + cache->wbuf_n - 1) % cache->wbuf_size];
+    start = MAX(start, e->ready);
+  }
+  e = &cache->wbuf[(cache->wbuf_head + cache->wbuf_n) % cache->wbuf_size];
+  e->baddr = baddr;
+  e->ready = start + next_level(cache, Write, baddr, start);
+  cache->wbuf_n++;
+  return stall;
+}
+
+/* latency the cache sees for writing block BADDR to the next level */
+static unsigned int next_level_write(cache_t *cache, md_addr_t baddr, tick_t now) {
+  if(cache->wbuf_size) {
+    return wbuf_put(cache, baddr, now);
+  }
+  return next_level(cache, Write, baddr, now);
+}
+
+/* store WORD at ADDR past the cache, for write-through and write-around */
+static unsigned int write_word_through(cache_t *cache, md_addr_t addr, word_t *word, tick_t now) {
+  MEM_WRITE_WORD(cache->mem, addr, *word);
+  return next_level_write(cache, UCACHE_TAGSET(cache, addr), now);
+}
+
+void ucache_word_read(cache_line_t *line, word_t *dst, int offset) {
+    memcpy(dst, (byte_t *)line->data + offset, sizeof(word_t));
+}
+
+void ucache_word_write(cache_line_t *line, word_t *src, int offset) {
+    memcpy((byte_t *)line->data + offset, src, sizeof(word_t));
+    line->dirty = 1;
+}
+
+/* lowest set bit of a four bit match mask */
+static const signed char first_way[16] = {
+  -1, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0
+};
+
+/* find the way holding KEY, the ways are compared four at a time without
+   branches so the compiler can do each group with one vector compare */
+static inline int find_way(const unsigned int *tags, unsigned int key, int assoc) {
+  int base, match;
+  for(base = 0; base + 4 <= assoc; base += 4) {
+    match = (tags[base] == key)
+          | (tags[base+1] == key) << 1
+          | (tags[base+2] == key) << 2
+          | (tags[base+3] == key) << 3;
+    if(match) {
+      return base + first_way[match];
+    }
+  }
+  for(; base < assoc; base++) {
+    if(tags[base] == key) {
+      return base;
+    }
+  }
+  return -1;
+}
+
+/**
+ * Prefetch Part
+ *
+ * Next-line and stride prefetches fill the cache itself and mark the line
+ * prefetched with the cycle its fill completes; the first demand access
+ * counts it useful, and late if it has to wait for the rest of the fill.
+ * Stream buffers hold the blocks following a miss outside the cache and
+ * move a block in when a miss finds it at the head of a buffer.
+ */
+
+/* prefetch block BADDR into the cache unless it is there already */
+static void pf_issue(cache_t *cache, md_addr_t baddr, tick_t now) {
+  unsigned int index = UCACHE_INDEX(cache, baddr);
+  cache_set_t *set = &cache->sets[index];
+  cache_line_t *line;
+  unsigned int lat = 0;
+  if(find_way(set->tags, UCACHE_TAG(cache, baddr) | TAG_VALID, UCACHE_ASSOC(cache)) >= 0) {
+    return;
+  }
+  line = add_into_cache_set(cache, set, index, baddr, now, &lat);
+  lat += next_level(cache, Read, baddr, now + lat);
+  /* the fill is now the most recent way of its set, a fast hit on the last
+     line there would skip the replacement update it needs */
+  if(cache->last_tagset != NO_TAGSET && UCACHE_INDEX(cache, cache->last_tagset) == index) {
+    cache->last_tagset = NO_TAGSET;
+    cache->last_line = NULL;
+  }
+  line->prefetched = 1;
+  line->ready = now + lat;
+  cache->pf_issued++;
+}
+
+/* append the next block of stream SB */
+static void pf_stream_fetch(cache_t *cache, cache_pf_stream_t *sb, tick_t now) {
+  int tail = (sb->head + sb->n) % cache->pf_degree;
+  sb->baddr[tail] = sb->next;
+  sb->ready[tail] = now + next_level(cache, Read, sb->next, now);
+  sb->next += UCACHE_BSIZE(cache);
+  sb->n++;
+  cache->pf_issued++;
+}
+
+/* a miss on TAGSET, if a stream buffer has it at its head, returns TRUE
+   and adds the cycles the block is still away to LAT */
+static int pf_stream_hit(cache_t *cache, md_addr_t tagset, tick_t now, unsigned int *lat) {
+  cache_pf_stream_t *sb;
+  int i;
+  for(i = 0; i < cache->pf_nstreams; i++) {
+    sb = &cache->pf_streams[i];
+    if(sb->valid && sb->n && sb->baddr[sb->head] == tagset) {
+      cache->pf_useful++;
+      if(sb->ready[sb->head] > now) {
+        cache->pf_late++;
+        *lat += sb->ready[sb->head] - now;
+      }
+      sb->head = (sb->head + 1) % cache->pf_degree;
+      sb->n--;
+      sb->last_use = now;
+      pf_stream_fetch(cache, sb, now);
+      return TRUE;
+    }
+  }
+  return FALSE;
+}
+
+/* restart the least recently used stream buffer after a miss on TAGSET */
+static void pf_stream_alloc(cache_t *cache, md_addr_t tagset, tick_t now) {
+  cache_pf_stream_t *sb = &cache->pf_streams[0];
+  int i;
+  for(i = 1; i < cache->pf_nstreams && sb->valid; i++) {
+    if(!cache->pf_streams[i].valid || cache->pf_streams[i].last_use < sb->last_use) {
+      sb = &cache->pf_streams[i];
+    }
+  }
+  /* blocks still in the old stream are dropped unused */
+  cache->pf_useless += sb->n;
+  sb->valid = TRUE;
+  sb->next = tagset + UCACHE_BSIZE(cache);
+  sb->last_use = now;
+  sb->head = 0;
+  sb->n = 0;
+  for(i = 0; i < cache->pf_degree; i++) {
+    pf_stream_fetch(cache, sb, now);
+  }
+}
+
+/* train the prefetcher on a demand access to ADDR by the instruction at
+   PC (0 for fetches), MISS if it missed, PF_HIT if it was the first use
+   of a prefetched line */
+static void pf_train(cache_t *cache, md_addr_t pc, md_addr_t addr, md_addr_t tagset,
+                     int miss, int pf_hit, tick_t now) {
+  cache_pf_stride_t *e;
+  int i, stride;
+  switch(cache->pf_kind) {
+  case PF_NEXTLINE:
+    if(miss || pf_hit) {
+      for(i = 1; i <= cache->pf_degree; i++) {
+        pf_issue(cache, tagset + i*UCACHE_BSIZE(cache), now);
+      }
+    }
+    break;
+  case PF_STRIDE:
+    if(!pc) {
+      break;
+    }
+    e = &cache->pf_table[(pc >> 3) & (cache->pf_table_size - 1)];
+    if(e->pc != pc) {
+      e->pc = pc;
+      e->last_addr = addr;
+      e->stride = 0;
+      e->conf = 0;
+      break;
+    }
+    stride = (int)(addr - e->last_addr);
+    if(stride == e->stride) {
+      if(e->conf < 3) {
+        e->conf++;
+      }
+    } else {
+      e->stride = stride;
+      e->conf = 0;
+    }
+    e->last_addr = addr;
+    if(e->conf >= 2 && stride != 0) {
+      for(i = 1; i <= cache->pf_degree; i++) {
+        pf_issue(cache, UCACHE_TAGSET(cache, addr + i*stride), now);
+      }
+    }
+    break;
+  case PF_STREAM:
+    if(miss) {
+      pf_stream_alloc(cache, tagset, now);
+    }
+    break;
+  default:
+    break;
+  }
+}
+
+/* an access to any line but the last one, kept out of line so that the
+   last-line hit stays a few instructions */
+static NOINLINE int cache_lookup(cache_t *cache, md_addr_t addr, word_t *word, ucache_word_func func,
+                                 md_addr_t pc, tick_t now) {
+  unsigned int offset = UCACHE_OFFSET(cache, addr);
+  md_addr_t tagset = UCACHE_TAGSET(cache, addr);
+  unsigned int tag, index;
+  cache_set_t *set;
+  cache_line_t *line;
+  unsigned int lat = 0;
+  int is_write = (func == ucache_word_write);
+  int pf_hit = FALSE;
+  int way;
+
+  tag = UCACHE_TAG(cache, addr);
+  index = UCACHE_INDEX(cache, addr);
+  set = &cache->sets[index];
+  way = find_way(set->tags, tag | TAG_VALID, UCACHE_ASSOC(cache));
+  if(way >= 0) {
+    line = &set->lines[way];
+    line->ref_count++;
+    cache->hit++;
+    if(cache->policy == REPL_LRU || cache->policy == REPL_PLRU) {
+      touch_cache_set(cache, set, way);
+    }
+    if(line->prefetched) {
+      /* first use of a prefetched line, wait for the rest of its fill */
+      line->prefetched = 0;
+      pf_hit = TRUE;
+      cache->pf_useful++;
+      if(line->ready > now) {
+        cache->pf_late++;
+        lat = line->ready - now;
+      }
+    }
+    cache->last_tagset = tagset;
+    cache->last_line = line;
+    func(line, word, offset);
+    if(is_write && cache->write_through) {
+      line->dirty = 0;
+      cache->write_thru++;
+      lat += write_word_through(cache, addr, word, now + lat);
+    }
+    if(cache->pf_kind != PF_NONE) {
+      pf_train(cache, pc, addr, tagset, FALSE, pf_hit, now);
+    }
+    return cache->hit_lat + lat;
+  }
+
+  // miss here
+  if(is_write && !cache->write_alloc) {
+    cache->miss++;
+    cache->write_around++;
+    return cache->hit_lat + write_word_through(cache, addr, word, now);
+  }
+  if(cache->pf_kind == PF_STREAM && pf_stream_hit(cache, tagset, now, &lat)) {
+    /* served by a stream buffer */
+    cache->hit++;
+    pf_hit = TRUE;
+    line = add_into_cache_set(cache, set, index, tagset, now, &lat);
+  } else {
+    cache->miss++;
+    line = add_into_cache_set(cache, set, index, tagset, now, &lat);
+    lat += next_level(cache, Read, tagset, now + lat);
+  }
+  cache->last_tagset = tagset;
+  cache->last_line = line;
+  func(line, word, offset);
+  if(is_write && cache->write_through) {
+    line->dirty = 0;
+    cache->write_thru++;
+    lat += write_word_through(cache, addr, word, now + lat);
+  }
+  if(cache->pf_kind != PF_NONE) {
+    pf_train(cache, pc, addr, tagset, !pf_hit, pf_hit, now);
+  }
+  return cache->hit_lat + lat;
+}
+
+/* shared by ucache_access() and the typed entry points below, inlining it
+   lets the compiler resolve FUNC at the ucache_read()/ucache_write() sites */
+static inline ALWAYS_INLINE int do_cache_access(cache_t *cache, md_addr_t addr, word_t *word,
+                                                ucache_word_func func, md_addr_t pc, tick_t now) {
+  unsigned int offset = UCACHE_OFFSET(cache, addr);
+  md_addr_t tagset = UCACHE_TAGSET(cache, addr);
+  cache_line_t *line;
+  unsigned int lat = 0;
+  int is_write = (func == ucache_word_write);
+
+  cache->access++;
+
+  /* the line last accessed is the most recently used one of its set, so
+     a repeat hit needs no replacement update */
+  if(tagset == cache->last_tagset) {
+    line = cache->last_line;
+    line->ref_count++;
+    cache->hit++;
+    func(line, word, offset);
+    if(is_write && cache->write_through) {
+      line->dirty = 0;
+      cache->write_thru++;
+      lat = write_word_through(cache, addr, word, now);
+    }
+    if(cache->pf_kind == PF_STRIDE) {
+      pf_train(cache, pc, addr, tagset, FALSE, FALSE, now);
+    }
+    return cache->hit_lat + lat;
+  }
+
+  return cache_lookup(cache, addr, word, func, pc, now);
+}
+
+int ucache_access(cache_t *cache, md_addr_t addr, word_t *word, ucache_word_func func,
+                  md_addr_t pc, tick_t now) {
+  return do_cache_access(cache, addr, word, func, pc, now);
+}
+
+int ucache_read(cache_t *cache, md_addr_t addr, word_t *word, md_addr_t pc, tick_t now) {
+  return do_cache_access(cache, addr, word, ucache_word_read, pc, now);
+}
+
+int ucache_write(cache_t *cache, md_addr_t addr, word_t *word, md_addr_t pc, tick_t now) {
+  return do_cache_access(cache, addr, word, ucache_word_write, pc, now);
+}
+
+void ucache_flush(cache_t* cache, tick_t now) {
+  cache_set_t *set;
+  cache_line_t *line;
+  md_addr_t addr;
+  int i, j;
+  for(i = 0; i < UCACHE_NSETS(cache); i++) {
+    set = &cache->sets[i];
+    for(j = 0; j < set->n; j++) {
+      line = &set->lines[set->order[j]];
+      /* written straight to the next level, not through the buffer */
+      if(line->dirty) {
+        addr = UCACHE_MK_ADDR(cache, line->tag, i);
+        copy_line_out(cache, line, addr);
+        next_level(cache, Write, addr, now);
+      }
+    }
+  }
+}
+
+/* a line never straddles a page, so lines move to and from memory with
+   a single page translation */
+void fill_cache_line(cache_t *cache, cache_line_t *line, md_addr_t addr) {
+  byte_t *page = MEM_PAGE(cache->mem, addr);
+  int i, words = UCACHE_BSIZE(cache) / sizeof(word_t);
+  word_t *src;
+  if(page) {
+    src = (word_t *)(page + MEM_OFFSET(addr));
+    for(i = 0; i < words; i++) {
+      line->data[i] = MD_SWAPW(src[i]);
+    }
+  } else {
+    /* page not yet allocated, reads as zero */
+    memset(line->data, 0, UCACHE_BSIZE(cache));
+  }
+  line->ref_count = 0;
+  line->tag = UCACHE_TAG(cache, addr);
+  line->dirty = 0;
+  line->valid = 1;
+  line->prefetched = 0;
+  line->ready = 0;
+}
+
+/* returns the latency the cache sees for the next level taking the line */
+unsigned int ucache_write_back(cache_t *cache, cache_line_t *line, int index, tick_t now) {
+  md_addr_t addr = UCACHE_MK_ADDR(cache, line->tag, index);
+  copy_line_out(cache, line, addr);
+  return next_level_write(cache, addr, now);
+}
+
+/* LAT accumulates the next-level latency of the write-back, the caller
+   adds the fill */
+cache_line_t *add_into_cache_set(cache_t *cache, cache_set_t *set, int index, md_addr_t addr,
+                                 tick_t now, unsigned int *lat) {
+  cache_line_t *line;
+  int way;
+  if(set->n >= UCACHE_ASSOC(cache)) {
+    way = ucache_victim(cache, set);
+    line = &set->lines[way];
+    if(line->dirty) {
+      cache->wb++;
+      *lat += ucache_write_back(cache, line, index, now);
+    }
+    cache->replace++;
+    if(line->prefetched) {
+      cache->pf_useless++;
+    }
+    if(line == cache->last_line) {
+      cache->last_tagset = NO_TAGSET;
+      cache->last_line = NULL;
+    }
+    de_cache_set(cache, set, way);
+  }
+  way = set->order[set->n];
+  en_cache_set(cache, set, way);
+  line = &set->lines[way];
+  fill_cache_line(cache, line, addr);
+  set->tags[way] = line->tag | TAG_VALID;
+  touch_cache_set(cache, set, way);
+  return line;
+}
@@ -0,0 +1,477 @@
+/*
+ * cache-bench.c - micro-benchmark for the cache module tag layout
+ *
+ * Replays one synthetic reference stream (a random walk over a working set
+ * of blocks, with a write every fourth access) through a copy of the old
+ * cache_access() lookup, which chained the blocks of a set on a doubly
+ * linked way list (and on per-set hash tables above 4 ways) and relinked
+ * them on every LRU update, and through the current cache_access(), which
+ * probes packed per-set tags and restamps a per-set stamp vector, checks that
+ * both count the same hits, misses, replacements and writebacks, and
+ * reports the best host time per access for each over a number of
+ * repetitions.
+ *
+ * The packed tags pay off from 4 to 32 ways; a direct-mapped cache does a
+ * little more work per access than the bare reference, and above 32 ways
+ * a miss scans all the stamps for its victim where the way list has it at
+ * its tail.
+ *
+ * usage: cache-bench [-n accesses] [-s sets] [-b block_bytes] [-a assoc]
+ *                    [-w working_set_blocks] [-p l|f|r] [-r repetitions]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "host.h"
+#include "misc.h"
+#include "machine.h"
+#include "cache.h"
+
+/*
+ * reference version: the cache blocks and sets as they were, with the
+ * replacement order kept on a way list
+ */
+
+struct ref_blk_t
+{
+  struct ref_blk_t *way_next;	/* next block in the ordered way chain */
+  struct ref_blk_t *way_prev;	/* previous block in the order way chain */
+  struct ref_blk_t *hash_next;	/* next block in the hash bucket chain */
+  md_addr_t tag;		/* data block tag value */
+  unsigned int status;		/* block status, see CACHE_BLK_* defs */
+  tick_t ready;			/* time when block will be accessible */
+  byte_t *user_data;		/* pointer to user defined data */
+  byte_t data[1];		/* data block, unused here */
+};
+
+struct ref_set_t
+{
+  struct ref_blk_t **hash;	/* hash table, NULL for low-assoc caches */
+  struct ref_blk_t *way_head;	/* head of way list */
+  struct ref_blk_t *way_tail;	/* tail of way list */
+  struct ref_blk_t *blks;	/* cache blocks, allocated sequentially */
+};
+
+struct ref_cache_t
+{
+  int nsets, assoc, hsize;
+  enum cache_policy policy;
+  unsigned int hit_latency;
+  unsigned int (*blk_access_fn)(enum mem_cmd cmd, md_addr_t baddr, int bsize,
+				struct cache_blk_t *blk, tick_t now);
+  int set_shift, tag_shift;
+  md_addr_t set_mask, tagset_mask;
+  tick_t bus_free;
+  counter_t hits, misses, replacements, writebacks;
+  md_addr_t last_tagset;
+  struct ref_blk_t *last_blk;
+  struct ref_set_t *sets;
+};
+
+#define REF_HASH(cp, key)						\
+  (((key >> 24) ^ (key >> 16) ^ (key >> 8) ^ key) & ((cp)->hsize-1))
+
+#define BOUND_POS(N)		((int)(MIN(MAX(0, (N)), 2147483647)))
+
+enum list_loc_t { Head, Tail };
+
+/* unlink BLK from the hash table bucket chain in SET */
+static void
+ref_unlink_htab_ent(struct ref_cache_t *cp, struct ref_set_t *set,
+		    struct ref_blk_t *blk)
+{
+  struct ref_blk_t *prev, *ent;
+  int index = REF_HASH(cp, blk->tag);
+
+  for (prev=NULL,ent=set->hash[index]; ent; prev=ent,ent=ent->hash_next)
+    {
+      if (ent == blk)
+	break;
+    }
+  if (!prev)
+    set->hash[index] = ent->hash_next;
+  else
+    prev->hash_next = ent->hash_next;
+  ent->hash_next = NULL;
+}
+
+/* insert BLK onto the head of the hash table bucket chain in SET */
+static void
+ref_link_htab_ent(struct ref_cache_t *cp, struct ref_set_t *set,
+		  struct ref_blk_t *blk)
+{
+  int index = REF_HASH(cp, blk->tag);
+
+  blk->hash_next = set->hash[index];
+  set->hash[index] = blk;
+}
+
+/* insert BLK into the order way chain in SET at location WHERE */
+static void
+ref_update_way_list(struct ref_set_t *set, struct ref_blk_t *blk,
+		    enum list_loc_t where)
+{
+  if (!blk->way_prev && !blk->way_next)
+    return;
+  else if (!blk->way_prev)
+    {
+      if (where == Head)
+	return;
+      set->way_head = blk->way_next;
+      blk->way_next->way_prev = NULL;
+    }
+  else if (!blk->way_next)
+    {
+      if (where == Tail)
+	return;
+      set->way_tail = blk->way_prev;
+      blk->way_prev->way_next = NULL;
+    }
+  else
+    {
+      blk->way_prev->way_next = blk->way_next;
+      blk->way_next->way_prev = blk->way_prev;
+    }
+
+  if (where == Head)
+    {
+      blk->way_next = set->way_head;
+      blk->way_prev = NULL;
+      set->way_head->way_prev = blk;
+      set->way_head = blk;
+    }
+  else
+    {
+      blk->way_prev = set->way_tail;
+      blk->way_next = NULL;
+      set->way_tail->way_next = blk;
+      set->way_tail = blk;
+    }
+}
+
+/* create a reference cache with the geometry of cache_create() */
+static struct ref_cache_t *
+ref_create(int nsets, int bsize, int assoc, enum cache_policy policy,
+	   unsigned int (*blk_access_fn)(enum mem_cmd cmd,
+					 md_addr_t baddr, int bsize,
+					 struct cache_blk_t *blk,
+					 tick_t now),
+	   unsigned int hit_latency)
+{
+  struct ref_cache_t *cp;
+  struct ref_blk_t *blk;
+  int i, j;
+
+  cp = (struct ref_cache_t *)calloc(1, sizeof(struct ref_cache_t));
+  cp->sets = (struct ref_set_t *)calloc(nsets, sizeof(struct ref_set_t));
+  if (!cp || !cp->sets)
+    fatal("out of virtual memory");
+  cp->nsets = nsets;
+  cp->assoc = assoc;
+  cp->hsize = assoc > 4 ? (assoc >> 2) : 0;
+  cp->policy = policy;
+  cp->hit_latency = hit_latency;
+  cp->blk_access_fn = blk_access_fn;
+  cp->set_shift = log_base2(bsize);
+  cp->set_mask = nsets-1;
+  cp->tag_shift = cp->set_shift + log_base2(nsets);
+  cp->tagset_mask = ~(md_addr_t)(bsize-1);
+
+  for (i=0; i<nsets; i++)
+    {
+      cp->sets[i].blks = (struct ref_blk_t *)calloc(assoc,
+						    sizeof(struct ref_blk_t));
+      if (!cp->sets[i].blks)
+	fatal("out of virtual memory");
+      if (cp->hsize)
+	{
+	  cp->sets[i].hash =
+	    (struct ref_blk_t **)calloc(cp->hsize, sizeof(struct ref_blk_t *));
+	  if (!cp->sets[i].hash)
+	    fatal("out of virtual memory");
+	}
+      for (j=0; j<assoc; j++)
+	{
+	  blk = &cp->sets[i].blks[j];
+	  if (cp->hsize)
+	    ref_link_htab_ent(cp, &cp->sets[i], blk);
+	  blk->way_next = cp->sets[i].way_head;
+	  blk->way_prev = NULL;
+	  if (cp->sets[i].way_head)
+	    cp->sets[i].way_head->way_prev = blk;
+	  cp->sets[i].way_head = blk;
+	  if (!cp->sets[i].way_tail)
+	    cp->sets[i].way_tail = blk;
+	}
+    }
+  return cp;
+}
+
+/* access the reference cache, as cache_access() did for a cache without
+   block data, kept out of line and unspecialized like cache_access() is,
+   and external like it, the compiler would otherwise fold the constant
+   arguments of its one caller into it */
+unsigned int __attribute__((noinline, noclone))
+ref_access(struct ref_cache_t *cp, enum mem_cmd cmd, md_addr_t addr,
+	   int nbytes, tick_t now, byte_t **udata, md_addr_t *repl_addr)
+{
+  md_addr_t tag = addr >> cp->tag_shift;
+  md_addr_t set = (addr >> cp->set_shift) & cp->set_mask;
+  struct ref_blk_t *blk, *repl;
+  int lat = 0;
+
+  if (repl_addr)
+    *repl_addr = 0;
+
+  if ((nbytes & (nbytes-1)) != 0 || (addr & (nbytes-1)) != 0)
+    fatal("cache: access error: bad size or alignment, addr 0x%08x", addr);
+  if ((addr + nbytes) > ((addr & cp->tagset_mask) + ~cp->tagset_mask + 1))
+    fatal("cache: access error: access spans block, addr 0x%08x", addr);
+
+  if ((addr & cp->tagset_mask) == cp->last_tagset)
+    {
+      blk = cp->last_blk;
+      goto cache_fast_hit;
+    }
+
+  if (cp->hsize)
+    {
+      int hindex = REF_HASH(cp, tag);
+
+      for (blk=cp->sets[set].hash[hindex]; blk; blk=blk->hash_next)
+	{
+	  if (blk->tag == tag && (blk->status & CACHE_BLK_VALID))
+	    goto cache_hit;
+	}
+    }
+  else
+    {
+      for (blk=cp->sets[set].way_head; blk; blk=blk->way_next)
+	{
+	  if (blk->tag == tag && (blk->status & CACHE_BLK_VALID))
+	    goto cache_hit;
+	}
+    }
+
+  cp->misses++;
+
+  switch (cp->policy) {
+  case LRU:
+  case FIFO:
+    repl = cp->sets[set].way_tail;
+    ref_update_way_list(&cp->sets[set], repl, Head);
+    break;
+  case Random:
+    repl = &cp->sets[set].blks[myrand() & (cp->assoc - 1)];
+    break;
+  default:
+    panic("bogus replacement policy");
+  }
+
+  if (cp->hsize)
+    ref_unlink_htab_ent(cp, &cp->sets[set], repl);
+
+  cp->last_tagset = 0;
+  cp->last_blk = NULL;
+
+  if (repl->status & CACHE_BLK_VALID)
+    {
+      cp->replacements++;
+      if (repl_addr)
+	*repl_addr = (repl->tag << cp->tag_shift) | (set << cp->set_shift);
+      lat += BOUND_POS(repl->ready - now);
+      lat += BOUND_POS(cp->bus_free - (now + lat));
+      cp->bus_free = MAX(cp->bus_free, (now + lat)) + 1;
+      if (repl->status & CACHE_BLK_DIRTY)
+	{
+	  cp->writebacks++;
+	  lat += cp->blk_access_fn(Write, (repl->tag << cp->tag_shift)
+				   | (set << cp->set_shift),
+				   ~cp->tagset_mask + 1,
+				   (struct cache_blk_t *)repl, now+lat);
+	}
+    }
+
+  repl->tag = tag;
+  repl->status = CACHE_BLK_VALID;
+  lat += cp->blk_access_fn(Read, addr & cp->tagset_mask,
+			   ~cp->tagset_mask + 1,
+			   (struct cache_blk_t *)repl, now+lat);
+  if (cmd == Write)
+    repl->status |= CACHE_BLK_DIRTY;
+  if (udata)
+    *udata = repl->user_data;
+  repl->ready = now+lat;
+
+  if (cp->hsize)
+    ref_link_htab_ent(cp, &cp->sets[set], repl);
+
+  return lat;
+
+ cache_hit:
+  cp->hits++;
+  if (cmd == Write)
+    blk->status |= CACHE_BLK_DIRTY;
+  if (blk->way_prev && cp->policy == LRU)
+    ref_update_way_list(&cp->sets[set], blk, Head);
+  cp->last_tagset = addr & cp->tagset_mask;
+  cp->last_blk = blk;
+  if (udata)
+    *udata = blk->user_data;
+  return (int) MAX(cp->hit_latency, (blk->ready - now));
+
+ cache_fast_hit:
+  cp->hits++;
+  if (cmd == Write)
+    blk->status |= CACHE_BLK_DIRTY;
+  cp->last_tagset = addr & cp->tagset_mask;
+  cp->last_blk = blk;
+  if (udata)
+    *udata = blk->user_data;
+  return (int) MAX(cp->hit_latency, (blk->ready - now));
+}
+
+/* next level latency, the same for both versions */
+#define MISS_LATENCY	6
+
+static unsigned int
+bench_access_fn(enum mem_cmd cmd, md_addr_t baddr, int bsize,
+		struct cache_blk_t *blk, tick_t now)
+{
+  return MISS_LATENCY;
+}
+
+/* wall clock in usecs */
+static double
+now_usec(void)
+{
+  struct timeval tv;
+
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec * 1e6 + tv.tv_usec;
+}
+
+/* the reference stream, block numbers from a 32-bit LCG over the working
+   set, so consecutive accesses rarely hit the same block, the stream stays
+   clear of block 0, which the reference version takes for the last block
+   to hit before anything has */
+#define DATA_BASE	0x10000000
+#define NEXT_ADDR(SEED, WSET, BSIZE)					\
+  ((SEED) = (SEED) * 1664525 + 1013904223,				\
+   DATA_BASE + (md_addr_t)((((SEED) >> 8) % (WSET)) * (BSIZE)))
+
+/* run N accesses through the reference cache, returns elapsed usecs */
+static double __attribute__((noinline))
+run_ref(struct ref_cache_t *cp, int n, int wset, int bsize, tick_t *sum)
+{
+  double start;
+  unsigned int seed = 1;
+  tick_t now = 0;
+  int i;
+
+  mysrand(1);
+  start = now_usec();
+  for (i = 0; i < n; i++)
+    now += ref_access(cp, (i & 3) == 0 ? Write : Read,
+		      NEXT_ADDR(seed, wset, bsize), 4, now, NULL, NULL);
+  *sum = now;
+  return now_usec() - start;
+}
+
+/* run N accesses through the current cache, returns elapsed usecs */
+static double __attribute__((noinline))
+run_current(struct cache_t *cp, int n, int wset, int bsize, tick_t *sum)
+{
+  double start;
+  unsigned int seed = 1;
+  tick_t now = 0;
+  int i;
+
+  mysrand(1);
+  start = now_usec();
+  for (i = 0; i < n; i++)
+    now += cache_access(cp, (i & 3) == 0 ? Write : Read,
+			NEXT_ADDR(seed, wset, bsize), NULL, 4, now,
+			NULL, NULL);
+  *sum = now;
+  return now_usec() - start;
+}
+
+int
+main(int argc, char **argv)
+{
+  int i, n = 20000000, nsets = 64, bsize = 32, assoc = 8, wset = -1;
+  int reps = 5;
+  char policy = 'l';
+  struct ref_cache_t *rcp;
+  struct cache_t *ccp;
+  tick_t rsum, csum;
+  double t, t_ref = 0.0, t_cur = 0.0;
+
+  for (i = 1; i < argc - 1; i++)
+    {
+      if (!strcmp(argv[i], "-n"))
+	n = atoi(argv[++i]);
+      else if (!strcmp(argv[i], "-s"))
+	nsets = atoi(argv[++i]);
+      else if (!strcmp(argv[i], "-b"))
+	bsize = atoi(argv[++i]);
+      else if (!strcmp(argv[i], "-a"))
+	assoc = atoi(argv[++i]);
+      else if (!strcmp(argv[i], "-w"))
+	wset = atoi(argv[++i]);
+      else if (!strcmp(argv[i], "-p"))
+	policy = argv[++i][0];
+      else if (!strcmp(argv[i], "-r"))
+	reps = atoi(argv[++i]);
+    }
+  /* by default the working set is a quarter larger than the cache */
+  if (wset < 0)
+    wset = nsets * assoc + nsets * assoc / 4;
+  if (n <= 0 || wset <= 0 || reps <= 0 || !strchr("lfr", policy))
+    fatal("usage: cache-bench [-n accesses] [-s sets] [-b block_bytes] "
+	  "[-a assoc] [-w working_set_blocks] [-p l|f|r] [-r repetitions]");
+
+  /* cache_create() checks the geometry for both */
+  ccp = cache_create("current", nsets, bsize, /* balloc */FALSE,
+		     /* usize */0, assoc, cache_char2policy(policy),
+		     bench_access_fn, /* hit lat */1);
+  rcp = ref_create(nsets, bsize, assoc, ccp->policy, bench_access_fn, 1);
+
+  /* alternate the two versions so host noise hits both alike, each run
+     starts from the state the last one left, the same for both */
+  for (i = 0; i < reps; i++)
+    {
+      t = run_ref(rcp, n, wset, bsize, &rsum);
+      if (i == 0 || t < t_ref)
+	t_ref = t;
+
+      t = run_current(ccp, n, wset, bsize, &csum);
+      if (i == 0 || t < t_cur)
+	t_cur = t;
+    }
+
+  fprintf(stdout,
+	  "cache-bench: %d accesses, %d sets, %d byte blocks, %d-way, "
+	  "`%c' policy, %d block working set, best of %d\n",
+	  n, nsets, bsize, assoc, policy, wset, reps);
+  fprintf(stdout, "%-8s %12s %12s %10s %10s\n",
+	  "version", "hits", "misses", "ns/ref", "Mref/s");
+  fprintf(stdout, "%-8s %12.0f %12.0f %10.2f %10.1f\n", "linked",
+	  (double)rcp->hits, (double)rcp->misses,
+	  t_ref * 1000.0 / n, n / t_ref);
+  fprintf(stdout, "%-8s %12.0f %12.0f %10.2f %10.1f\n", "packed",
+	  (double)ccp->hits, (double)ccp->misses,
+	  t_cur * 1000.0 / n, n / t_cur);
+  fprintf(stdout, "speedup: %.2fx\n", t_ref / t_cur);
+
+  if (rcp->hits != ccp->hits || rcp->misses != ccp->misses
+      || rcp->replacements != ccp->replacements
+      || rcp->writebacks != ccp->writebacks || rsum != csum)
+    fatal("linked and packed layouts disagree");
+
+  return 0;
+}
@@ -51,12 +51,14 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <assert.h>
 
 #include "host.h"
 #include "misc.h"
 #include "machine.h"
 #include "cache.h"
+#include "prefetch.h"
 
 /* cache access macros */
 #define CACHE_TAG(cp, addr)	((addr) >> (cp)->tag_shift)
@@ -64,6 +66,19 @@
 #define CACHE_BLK(cp, addr)	((addr) & (cp)->blk_mask)
 #define CACHE_TAGSET(cp, addr)	((addr) & (cp)->tagset_mask)
 
+/* keep a function out of line, for the rarely taken paths of an access,
+   or always inline it, for the lookups on every access */
+#ifdef __GNUC__
+#define NOINLINE		__attribute__ ((noinline))
+#define ALWAYS_INLINE		__attribute__ ((always_inline))
+#else /* !__GNUC__ */
+#define NOINLINE
+#define ALWAYS_INLINE
+#endif /* !__GNUC__ */
+
+/* never a block address, so the fast hit check fails until a block hits */
+#define NO_TAGSET		1
+
 /* extract/reconstruct a block address */
 #define CACHE_BADDR(cp, addr)	((addr) & ~(cp)->blk_mask)
 #define CACHE_MK_BADDR(cp, tag, set)					\
@@ -76,6 +91,14 @@
 			       ((cp)->balloc				\
 				? (cp)->bsize*sizeof(byte_t) : 0))))
 
+/* locate the packed tags and stamps of set SET, and block WAY of the set */
+#define CACHE_TAGS(cp, set)						\
+  ((md_addr_t *)((cp)->tags + ((set) << (cp)->slot_shift)))
+#define CACHE_STAMPS(cp, set)						\
+  ((word_t *)(CACHE_TAGS(cp, set) + (cp)->assoc))
+#define CACHE_SET_BLK(cp, set, way)					\
+  CACHE_BINDEX(cp, (cp)->data, (set)*(cp)->assoc + (way))
+
 /* cache data block accessor, type parameterized */
 #define __CACHE_ACCESS(type, data, bofs)				\
   (*((type *)(((char *)data) + (bofs))))
@@ -87,12 +110,6 @@
 #define CACHE_HALF(data, bofs)	  __CACHE_ACCESS(unsigned short, data, bofs)
 #define CACHE_BYTE(data, bofs)	  __CACHE_ACCESS(unsigned char, data, bofs)
 
-/* cache block hashing macros, this macro is used to index into a cache
-   set hash table (to find the correct block on N in an N-way cache), the
-   cache set index function is CACHE_SET, defined above */
-#define CACHE_HASH(cp, key)						\
-  (((key >> 24) ^ (key >> 16) ^ (key >> 8) ^ key) & ((cp)->hsize-1))
-
 /* copy data out of a cache block to buffer indicated by argument pointer p */
 #define CACHE_BCOPY(cmd, blk, bofs, p, nbytes)	\
   if (cmd == Read)							\
@@ -139,121 +156,883 @@
 /* bound sqword_t/dfloat_t to positive int */
 #define BOUND_POS(N)		((int)(MIN(MAX(0, (N)), 2147483647)))
 
-/* unlink BLK from the hash table bucket chain in SET */
+/* return the way among the first N of a set with packed tags TAGS that
+   holds KEY, or -1 if none does, a valid tag is in one way of a set at
+   most, so the way is the sum of the positions that match, the compares
+   take no branches, so the compiler can do a group of them with a few
+   vector compares */
+static inline int
+match_ways(md_addr_t *tags,			/* tags to search */
+	   md_addr_t key,			/* tag or'ed with valid bit */
+	   int n)				/* number of ways to search */
+{
+  int i, match = 0, way = 0;
+
+  for (i=0; i < n; i++)
+    {
+      match |= tags[i] == key;
+      way += (tags[i] == key) * i;
+    }
+  return match ? way : -1;
+}
+
+/* ways of a larger set compared as one group, a hit costs one branch per
+   group up to its own */
+#define FIND_GROUP		32
+
+/* return the way of a set with packed tags TAGS holding TAG, or -1 if no
+   valid way holds it, sets up to 16 ways are compared as a single group
+   of constant size, larger ones FIND_GROUP ways at a time */
+static inline ALWAYS_INLINE int
+find_way(struct cache_t *cp,			/* cache to search */
+	 md_addr_t *tags,			/* tags of the set to search */
+	 md_addr_t tag)				/* tag to look for */
+{
+  md_addr_t key = tag | CACHE_TAG_VALID;
+  int base, way;
+
+  /* a direct-mapped set has a single tag to compare */
+  if (cp->assoc == 1)
+    return tags[0] == key ? 0 : -1;
+
+  switch (cp->assoc) {
+  case 2:
+    return match_ways(tags, key, 2);
+  case 4:
+    return match_ways(tags, key, 4);
+  case 8:
+    return match_ways(tags, key, 8);
+  case 16:
+    return match_ways(tags, key, 16);
+  default:
+    break;
+  }
+
+  /* the associativity is a power of two, a multiple of the group */
+  for (base=0; base < cp->assoc; base += FIND_GROUP)
+    {
+      way = match_ways(tags + base, key, FIND_GROUP);
+      if (way >= 0)
+	return base + way;
+    }
+  return -1;
+}
+
+/* replacement stamps stay below this bit, it marks the ways already
+   renumbered while a set is restamped */
+#define STAMP_MARK		0x80000000
+
+/* renumber the STAMPS of a set 1 to ASSOC, keeping their order */
 static void
-unlink_htab_ent(struct cache_t *cp,		/* cache to update */
-		struct cache_set_t *set,	/* set containing bkt chain */
-		struct cache_blk_t *blk)	/* block to unlink */
+restamp_set(struct cache_t *cp,			/* cache to update */
+	    word_t *stamps)			/* stamps of the set */
+{
+  int i, n, way;
+
+  for (n=1; n <= cp->assoc; n++)
+    {
+      /* find the oldest way not renumbered yet */
+      for (way=-1,i=0; i < cp->assoc; i++)
+	{
+	  if (!(stamps[i] & STAMP_MARK)
+	      && (way < 0 || stamps[i] < stamps[way]))
+	    way = i;
+	}
+      stamps[way] = n | STAMP_MARK;
+    }
+  for (i=0; i < cp->assoc; i++)
+    stamps[i] &= ~STAMP_MARK;
+}
+
+/* renumber the stamps of every set in CP, called when the stamps run out,
+   only the order within a set matters, so all sets start over from 1 */
+static void
+restamp_cache(struct cache_t *cp)		/* cache to update */
+{
+  int i;
+
+  for (i=0; i < cp->nsets; i++)
+    restamp_set(cp, CACHE_STAMPS(cp, i));
+  cp->stamp = cp->assoc;
+}
+
+/* return a stamp newer than any way of the cache holds */
+static inline word_t
+next_stamp(struct cache_t *cp)			/* cache to stamp */
+{
+  if (cp->stamp == STAMP_MARK - 1)
+    restamp_cache(cp);
+  return ++cp->stamp;
+}
+
+/* make WAY the most recently used (or filled) way of a set with STAMPS */
+static inline void
+touch_way(struct cache_t *cp,			/* cache to update */
+	  word_t *stamps,			/* stamps of the set */
+	  int way)				/* way to move to the front */
+{
+  /* a direct-mapped set has no order to keep */
+  if (cp->assoc > 1)
+    stamps[way] = next_stamp(cp);
+}
+
+/* return the oldest way of a set with STAMPS, the next one to be replaced */
+static inline int
+oldest_way(struct cache_t *cp,			/* cache to search */
+	   word_t *stamps)			/* stamps of the set */
+{
+  int i, older, way = 0;
+  word_t oldest = stamps[0];
+
+#ifdef HOST_HAS_QWORD
+  /* in larger sets, a chain of compares, each waiting on the one before,
+     takes longer than the loads, so keep four oldest ways apart, each as
+     its stamp and way in one qword, the lowest of them is the oldest */
+  if (cp->assoc >= 16)
+    {
+      qword_t k, k0, k1, k2, k3;
+
+      k0 = (qword_t)stamps[0] << 32;
+      k1 = (qword_t)stamps[1] << 32 | 1;
+      k2 = (qword_t)stamps[2] << 32 | 2;
+      k3 = (qword_t)stamps[3] << 32 | 3;
+      for (i=4; i < cp->assoc; i += 4)
+	{
+	  k = (qword_t)stamps[i] << 32 | i;
+	  k0 = k < k0 ? k : k0;
+	  k = (qword_t)stamps[i+1] << 32 | (i+1);
+	  k1 = k < k1 ? k : k1;
+	  k = (qword_t)stamps[i+2] << 32 | (i+2);
+	  k2 = k < k2 ? k : k2;
+	  k = (qword_t)stamps[i+3] << 32 | (i+3);
+	  k3 = k < k3 ? k : k3;
+	}
+      k0 = MIN(MIN(k0, k1), MIN(k2, k3));
+      return (int)(k0 & 0xffffffff);
+    }
+#endif /* HOST_HAS_QWORD */
+
+  /* the stamps are in no particular order, so keep branches out of the scan
+     and let the compiler use conditional moves */
+  for (i=1; i < cp->assoc; i++)
+    {
+      older = stamps[i] < oldest;
+      oldest = older ? stamps[i] : oldest;
+      way = older ? i : way;
+    }
+  return way;
+}
+
+/* non-zero if the stamps of CP are ages, unique within a set, Random
+   replacement leaves them as they started */
+#define CACHE_AGED(cp)							\
+  ((cp)->policy == LRU || (cp)->policy == FIFO || (cp)->policy == Random)
+
+/* tree-PLRU keeps the ASSOC-1 nodes of a binary tree over the ways as a bit
+   vector in the stamps, node N (the root is 1, its children 2N and 2N+1)
+   is bit N, a clear bit sends the victim search left, a set bit right */
+#define PLRU_BIT(stamps, n)	(((stamps)[(n) >> 5] >> ((n) & 31)) & 1)
+
+/* return the way the tree bits in a set's STAMPS point at */
+static inline int
+plru_victim(struct cache_t *cp,			/* cache to search */
+	    word_t *stamps)			/* stamps of the set */
+{
+  int n = 1;
+
+  while (n < cp->assoc)
+    n = 2*n + PLRU_BIT(stamps, n);
+  return n - cp->assoc;
+}
+
+/* point the tree bits in a set's STAMPS away from WAY after a use or fill,
+   or towards it if !AWAY */
+static inline void
+plru_point(struct cache_t *cp,			/* cache to update */
+	   word_t *stamps,			/* stamps of the set */
+	   int way,				/* way to point at or away */
+	   int away)				/* point away from WAY? */
+{
+  int n, node;
+
+  for (n=way + cp->assoc; n > 1; n >>= 1)
+    {
+      /* N is the left child of its parent if even */
+      node = n >> 1;
+      if (away ^ (n & 1))
+	stamps[node >> 5] |= (word_t)1 << (node & 31);
+      else
+	stamps[node >> 5] &= ~((word_t)1 << (node & 31));
+    }
+}
+
+/* RRIP keeps a re-reference prediction value (RRPV) per way in the stamps,
+   0 is a hit, RRPV_MAX a block predicted to be re-referenced last */
+#define RRPV_MAX		3
+#define RRPV_LONG		(RRPV_MAX - 1)	/* SRRIP fills */
+#define BIP_EPSILON		32		/* 1 in 32 BRRIP fills is long */
+#define PSEL_MAX		1023		/* 10-bit DRRIP policy selector */
+
+/* DRRIP sets aside DUEL_LEADERS leader sets for each policy, but never more
+   than a quarter of the sets each, so that at least half of them follow,
+   which takes at least 4 sets */
+#define DUEL_LEADERS		32
+#define DUEL_MIN_SETS		4
+
+/* return the first way of a set with STAMPS predicted to be re-referenced
+   last, ageing all of its ways until one is at RRPV_MAX */
+static int
+rrip_victim(struct cache_t *cp,			/* cache to update */
+	    word_t *stamps)			/* stamps of the set */
 {
-  struct cache_blk_t *prev, *ent;
-  int index = CACHE_HASH(cp, blk->tag);
+  int i, way = 0;
+  word_t age;
 
-  /* locate the block in the hash table bucket chain */
-  for (prev=NULL,ent=set->hash[index];
-       ent;
-       prev=ent,ent=ent->hash_next)
+  for (i=1; i < cp->assoc; i++)
+    way = stamps[i] > stamps[way] ? i : way;
+  age = RRPV_MAX - stamps[way];
+  if (age)
     {
-      if (ent == blk)
-	break;
+      for (i=0; i < cp->assoc; i++)
+	stamps[i] += age;
     }
-  assert(ent);
+  return way;
+}
+
+/* return the RRPV of a block filled into set SET after a miss, DRRIP leader
+   sets vote with their misses here */
+static word_t
+rrip_insert(struct cache_t *cp,			/* cache to update */
+	    md_addr_t set)			/* set that missed */
+{
+  int bimodal;
 
-  /* unlink the block from the hash table bucket chain */
-  if (!prev)
+  if (cp->policy == DRRIP)
     {
-      /* head of hash bucket list */
-      set->hash[index] = ent->hash_next;
+      if ((set & cp->duel_mask) == 0)
+	{
+	  /* an SRRIP leader set missed */
+	  cp->psel = MIN(cp->psel + 1, PSEL_MAX);
+	  bimodal = FALSE;
+	}
+      else if ((set & cp->duel_mask) == cp->duel_mask)
+	{
+	  /* a BRRIP leader set missed */
+	  cp->psel = MAX(cp->psel - 1, 0);
+	  bimodal = TRUE;
+	}
+      else
+	bimodal = cp->psel > PSEL_MAX/2;
     }
   else
+    bimodal = (cp->policy == BRRIP);
+
+  if (bimodal && (++cp->bip_count % BIP_EPSILON) != 0)
+    return RRPV_MAX;
+  return RRPV_LONG;
+}
+
+/* OPT keeps the position in the recorded stream of the next use of each
+   way in the stamps, invalid ways and blocks never used again are furthest
+   away */
+#define OPT_NEVER		0xffffffff
+
+/* return the way of a set with STAMPS that is used furthest in the future */
+static inline int
+furthest_way(struct cache_t *cp,		/* cache to search */
+	     word_t *stamps)			/* stamps of the set */
+{
+  int i, later, way = 0;
+  word_t furthest = stamps[0];
+
+  for (i=1; i < cp->assoc; i++)
     {
-      /* middle or end of hash bucket list */
-      prev->hash_next = ent->hash_next;
+      later = stamps[i] > furthest;
+      furthest = later ? stamps[i] : furthest;
+      way = later ? i : way;
     }
-  ent->hash_next = NULL;
+  return way;
 }
 
-/* insert BLK onto the head of the hash table bucket chain in SET */
+/* make WAY the next way of a set with STAMPS to be replaced */
 static void
-link_htab_ent(struct cache_t *cp,		/* cache to update */
-	      struct cache_set_t *set,		/* set containing bkt chain */
-	      struct cache_blk_t *blk)		/* block to insert */
+demote_way(struct cache_t *cp,			/* cache to update */
+	   word_t *stamps,			/* stamps of the set */
+	   int way)				/* way to move to the back */
 {
-  int index = CACHE_HASH(cp, blk->tag);
+  int oldest;
 
-  /* insert block onto the head of the bucket chain */
-  blk->hash_next = set->hash[index];
-  set->hash[index] = blk;
+  switch (cp->policy) {
+  case LRU:
+  case FIFO:
+  case Random:
+    oldest = oldest_way(cp, stamps);
+    if (oldest == way)
+      {
+	/* already there */
+	return;
+      }
+    if (stamps[oldest] == 0)
+      {
+	/* no room below the oldest way */
+	restamp_set(cp, stamps);
+      }
+    stamps[way] = stamps[oldest] - 1;
+    break;
+  case PLRU:
+    plru_point(cp, stamps, way, /* away */FALSE);
+    break;
+  case SRRIP:
+  case BRRIP:
+  case DRRIP:
+    stamps[way] = RRPV_MAX;
+    break;
+  case OPT:
+    stamps[way] = OPT_NEVER;
+    break;
+  default:
+    panic("bogus replacement policy");
+  }
 }
 
-/* where to insert a block onto the ordered way chain */
-enum list_loc_t { Head, Tail };
+/* return the stamp way WAY of a set of CP starts out with */
+static word_t
+initial_stamp(struct cache_t *cp,		/* cache to initialize */
+	      int way)				/* way to initialize */
+{
+  switch (cp->policy) {
+  case PLRU:
+    /* all tree bits clear */
+    return 0;
+  case SRRIP:
+  case BRRIP:
+  case DRRIP:
+    return RRPV_MAX;
+  case OPT:
+    return OPT_NEVER;
+  default:
+    /* the order is arbitrary at this point, the last way is the most
+       recently used */
+    return way + 1;
+  }
+}
 
-/* insert BLK into the order way chain in SET at location WHERE */
-static void
-update_way_list(struct cache_set_t *set,	/* set contained way chain */
-		struct cache_blk_t *blk,	/* block to insert */
-		enum list_loc_t where)		/* insert location */
+/* return the MSHR of cache CP still filling block BADDR at NOW, or NULL */
+static struct cache_mshr_t *
+mshr_lookup(struct cache_t *cp,			/* cache to search */
+	    md_addr_t baddr,			/* block address to look for */
+	    tick_t now)				/* time of access */
+{
+  int i;
+
+  for (i=0; i < cp->nmshrs; i++)
+    {
+      if (cp->mshrs[i].baddr == baddr && cp->mshrs[i].ready > now)
+	return &cp->mshrs[i];
+    }
+  return NULL;
+}
+
+/* return the MSHR of cache CP that is free first */
+static struct cache_mshr_t *
+mshr_first_free(struct cache_t *cp)		/* cache to search */
+{
+  int i;
+  struct cache_mshr_t *mshr = &cp->mshrs[0];
+
+  for (i=1; i < cp->nmshrs; i++)
+    {
+      if (cp->mshrs[i].ready < mshr->ready)
+	mshr = &cp->mshrs[i];
+    }
+  return mshr;
+}
+
+/* record or replay a reference to block BADDR of cache CP */
+static NOINLINE void
+trace_ref(struct cache_t *cp,			/* cache accessed */
+	  md_addr_t baddr)			/* block address accessed */
 {
-  /* unlink entry from the way list */
-  if (!blk->way_prev && !blk->way_next)
+  /* a run of references to one block is one reference in the stream, only
+     the first can miss, whatever the replacement policy */
+  if (baddr == cp->trace_last)
+    return;
+  cp->trace_last = baddr;
+
+  if (cp->trace_fd)
     {
-      /* only one entry in list (direct-mapped), no action */
-      assert(set->way_head == blk && set->way_tail == blk);
-      /* Head/Tail order already */
+      if (fwrite(&baddr, sizeof(md_addr_t), 1, cp->trace_fd) != 1)
+	fatal("cache `%s': cannot write reference stream", cp->name);
       return;
     }
-  /* else, more than one element in the list */
-  else if (!blk->way_prev)
+
+  if (cp->trace_pos >= cp->trace_len
+      || cp->trace_addrs[cp->trace_pos] != baddr)
+    fatal("cache `%s': reference %u differs from the recorded stream",
+	  cp->name, cp->trace_pos);
+  cp->next_use = cp->trace_next[cp->trace_pos++];
+}
+
+/* return the way of set SET with STAMPS of cache CP to fill next, and move
+   it to where a fill goes in the replacement order */
+static inline ALWAYS_INLINE int
+fill_way(struct cache_t *cp,			/* cache to update */
+	 md_addr_t set,				/* set to fill */
+	 word_t *stamps)			/* stamps of the set */
+{
+  int way;
+
+  switch (cp->policy) {
+  case LRU:
+  case FIFO:
+    way = oldest_way(cp, stamps);
+    touch_way(cp, stamps, way);
+    break;
+  case Random:
+    way = myrand() & (cp->assoc - 1);
+    break;
+  case PLRU:
+    way = plru_victim(cp, stamps);
+    plru_point(cp, stamps, way, /* away */TRUE);
+    break;
+  case SRRIP:
+  case BRRIP:
+  case DRRIP:
+    way = rrip_victim(cp, stamps);
+    stamps[way] = rrip_insert(cp, set);
+    break;
+  case OPT:
+    if (!cp->traced)
+      fatal("cache `%s': OPT replacement needs a recorded reference stream",
+	    cp->name);
+    way = furthest_way(cp, stamps);
+    stamps[way] = cp->next_use;
+    break;
+  default:
+    panic("bogus replacement policy");
+  }
+  return way;
+}
+
+/* return the prefetch buffer entry of cache CP holding block BADDR, or
+   NULL */
+static struct cache_pbuf_t *
+pbuf_lookup(struct cache_t *cp,			/* cache to search */
+	    md_addr_t baddr)			/* block address to look for */
+{
+  int i;
+
+  for (i=0; i < cp->pf_nbuf; i++)
+    {
+      if (cp->pf_buf[i].valid && cp->pf_buf[i].baddr == baddr)
+	return &cp->pf_buf[i];
+    }
+  return NULL;
+}
+
+/* hash slot of block BADDR in the blocks prefetches evicted from CP */
+#define PF_EVICTED(cp, baddr)						\
+  (&(cp)->pf_evicted[((baddr) >> (cp)->set_shift)			\
+		     & ((cp)->nsets * (cp)->assoc - 1)])
+
+/* extra cycles a victim cache hit takes over a cache hit, to swap its
+   block back in */
+#define CACHE_VC_LAT		1
+
+/* return the victim cache entry of cache CP holding block BADDR, or NULL */
+static struct cache_vc_t *
+vc_lookup(struct cache_t *cp,			/* cache to search */
+	  md_addr_t baddr)			/* block address to look for */
+{
+  int i;
+
+  for (i=0; i < cp->nvc; i++)
     {
-      assert(set->way_head == blk && set->way_tail != blk);
-      if (where == Head)
+      if (cp->vc[i].valid && cp->vc[i].baddr == baddr)
+	return &cp->vc[i];
+    }
+  return NULL;
+}
+
+/* remove block BADDR from cache CP, its victim cache and its prefetch
+   buffer, returns the status of the copy removed, 0 if there was none */
+static unsigned int				/* status of block removed */
+invalidate_blk(struct cache_t *cp,		/* cache to invalidate in */
+	       md_addr_t baddr)			/* block address to remove */
+{
+  md_addr_t set = CACHE_SET(cp, baddr);
+  struct cache_blk_t *blk;
+  struct cache_vc_t *vent;
+  struct cache_pbuf_t *pent;
+  unsigned int status = 0;
+  int way;
+
+  way = find_way(cp, CACHE_TAGS(cp, set), CACHE_TAG(cp, baddr));
+  if (way >= 0)
+    {
+      blk = CACHE_SET_BLK(cp, set, way);
+      status = blk->status;
+      blk->status = 0;
+      CACHE_TAGS(cp, set)[way] = 0;
+      if (blk == cp->last_blk)
 	{
-	  /* already there */
-	  return;
+	  cp->last_tagset = NO_TAGSET;
+	  cp->last_blk = NULL;
 	}
-      /* else, move to tail */
-      set->way_head = blk->way_next;
-      blk->way_next->way_prev = NULL;
+
+      /* make this the next way to replace */
+      demote_way(cp, CACHE_STAMPS(cp, set), way);
+    }
+  else if (cp->nvc && (vent = vc_lookup(cp, baddr)) != NULL)
+    {
+      status = vent->status;
+      vent->valid = FALSE;
+    }
+  if (cp->pf_nbuf && (pent = pbuf_lookup(cp, baddr)) != NULL)
+    pent->valid = FALSE;
+
+  if (status & CACHE_BLK_VALID)
+    cp->invalidations++;
+  return status;
+}
+
+static inline int evict_blk(struct cache_t *cp, struct cache_blk_t *blk,
+			    md_addr_t baddr, tick_t now);
+
+/* put block BADDR, dirty if DIRTY, replaced at NOW from a level above into
+   exclusive cache CP, returns the latency of making room for it */
+static int					/* latency of insertion */
+excl_insert(struct cache_t *cp,			/* cache to insert into */
+	    md_addr_t baddr,			/* block address to insert */
+	    int dirty,				/* is the block dirty? */
+	    tick_t now)				/* time of insertion */
+{
+  md_addr_t set = CACHE_SET(cp, baddr);
+  md_addr_t *tags = CACHE_TAGS(cp, set);
+  struct cache_blk_t *repl;
+  struct cache_vc_t *vent;
+  int way, lat = 0;
+
+  /* another level above may have replaced its copy already */
+  way = find_way(cp, tags, CACHE_TAG(cp, baddr));
+  if (way >= 0)
+    {
+      if (dirty)
+	CACHE_SET_BLK(cp, set, way)->status |= CACHE_BLK_DIRTY;
+      return 0;
+    }
+  if (cp->nvc && (vent = vc_lookup(cp, baddr)) != NULL)
+    {
+      if (dirty)
+	vent->status |= CACHE_BLK_DIRTY;
+      return 0;
+    }
+
+  way = fill_way(cp, set, CACHE_STAMPS(cp, set));
+  repl = CACHE_SET_BLK(cp, set, way);
+  if (repl == cp->last_blk)
+    {
+      cp->last_tagset = NO_TAGSET;
+      cp->last_blk = NULL;
+    }
+  if (repl->status & CACHE_BLK_VALID)
+    {
+      cp->replacements++;
+      tags[way] = 0;
+      lat += evict_blk(cp, repl, CACHE_MK_BADDR(cp, repl->tag, set), now);
     }
-  else if (!blk->way_next)
+
+  repl->tag = CACHE_TAG(cp, baddr);
+  repl->status = CACHE_BLK_VALID | (dirty ? CACHE_BLK_DIRTY : 0);
+  repl->ready = now;
+  tags[way] = repl->tag | CACHE_TAG_VALID;
+  return lat;
+}
+
+/* block BADDR with STATUS leaves cache CP, and its level, at NOW, BLK is
+   its block if it leaves from the cache itself, returns the latency of
+   writing it back */
+static inline ALWAYS_INLINE int		/* latency of writeback */
+leave_level(struct cache_t *cp,			/* cache it leaves */
+	    struct cache_blk_t *blk,		/* its block, or NULL */
+	    md_addr_t baddr,			/* block address leaving */
+	    unsigned int status,		/* its status */
+	    tick_t now)				/* time it leaves */
+{
+  struct cache_t *up;
+  md_addr_t a;
+  int i, lat = 0;
+
+  /* an inclusive level takes the block out of the levels above it too, all
+     of their blocks in it, a dirty copy up there has the latest data */
+  if (cp->features & CACHE_FEAT_INCL)
     {
-      /* end of list (and not front of list) */
-      assert(set->way_head != blk && set->way_tail == blk);
-      if (where == Tail)
+      for (i=0; i < cp->nuppers; i++)
 	{
-	  /* already there */
-	  return;
+	  up = cp->uppers[i];
+	  for (a=CACHE_BADDR(up, baddr); a < baddr + cp->bsize; a += up->bsize)
+	    status |= invalidate_blk(up, a) & CACHE_BLK_DIRTY;
 	}
-      set->way_tail = blk->way_prev;
-      blk->way_prev->way_next = NULL;
     }
-  else
+
+  if (status & CACHE_BLK_DIRTY)
+    cp->writebacks++;
+
+  if (cp->features & CACHE_FEAT_LOWER_EXCL)
     {
-      /* middle of list (and not front or end of list) */
-      assert(set->way_head != blk && set->way_tail != blk);
-      blk->way_prev->way_next = blk->way_next;
-      blk->way_next->way_prev = blk->way_prev;
+      /* an exclusive level below takes every block that leaves this one */
+      lat += excl_insert(cp->lower, baddr, status & CACHE_BLK_DIRTY, now);
     }
+  else if (status & CACHE_BLK_DIRTY)
+    {
+      /* write back the cache block */
+      lat += cp->blk_access_fn(Write, baddr, cp->bsize, blk, now);
+    }
+  return lat;
+}
+
+/* block BLK, block address BADDR, of cache CP is replaced at NOW, it goes
+   into the victim cache, if CP has one, or else leaves the level, returns
+   the latency of any writeback */
+static inline ALWAYS_INLINE int		/* latency of eviction */
+evict_blk(struct cache_t *cp,			/* cache to evict from */
+	  struct cache_blk_t *blk,		/* block replaced */
+	  md_addr_t baddr,			/* its block address */
+	  tick_t now)				/* time of replacement */
+{
+  struct cache_vc_t *vent;
+  int i, lat = 0;
+
+  if (!cp->nvc)
+    return leave_level(cp, blk, baddr, blk->status, now);
 
-  /* link BLK back into the list */
-  if (where == Head)
+  /* the victim cache replaces a free entry, or its least recent one */
+  for (vent=NULL,i=0; i < cp->nvc; i++)
+    {
+      if (!cp->vc[i].valid)
+	{
+	  vent = &cp->vc[i];
+	  break;
+	}
+      if (!vent || cp->vc[i].stamp < vent->stamp)
+	vent = &cp->vc[i];
+    }
+  if (vent->valid)
+    lat += leave_level(cp, NULL, vent->baddr, vent->status, now);
+
+  vent->valid = TRUE;
+  vent->baddr = baddr;
+  vent->status = blk->status & ~CACHE_BLK_PREFETCHED;
+  vent->ready = blk->ready;
+  vent->stamp = ++cp->vc_stamp;
+  return lat;
+}
+
+/* prefetch block BADDR of cache CP at NOW, unless it is already in the
+   cache or on its way, a prefetch needs a free MSHR if the cache has any */
+static void
+pf_issue(struct cache_t *cp,			/* cache to prefetch into */
+	 md_addr_t baddr,			/* block address to prefetch */
+	 tick_t now)				/* time of prefetch */
+{
+  md_addr_t set = CACHE_SET(cp, baddr);
+  md_addr_t *tags = CACHE_TAGS(cp, set);
+  struct cache_blk_t *repl;
+  struct cache_mshr_t *mshr = NULL;
+  struct cache_pbuf_t *pent;
+  int way, lat = 0;
+
+  if (find_way(cp, tags, CACHE_TAG(cp, baddr)) >= 0
+      || (cp->pf_nbuf && pbuf_lookup(cp, baddr))
+      || (cp->nvc && vc_lookup(cp, baddr))
+      || (cp->nmshrs && mshr_lookup(cp, baddr, now)))
+    return;
+
+  /* prefetches do not wait for an MSHR */
+  if (cp->nmshrs)
     {
-      /* link to the head of the way list */
-      blk->way_next = set->way_head;
-      blk->way_prev = NULL;
-      set->way_head->way_prev = blk;
-      set->way_head = blk;
+      mshr = mshr_first_free(cp);
+      if (mshr->ready > now)
+	return;
     }
-  else if (where == Tail)
+
+  cp->pf_issued++;
+  cp->pf_accuracy = (double)cp->pf_useful / cp->pf_issued;
+
+  /* stall until the bus to next level of memory is available */
+  lat += BOUND_POS(cp->bus_free - now);
+
+  /* track bus resource usage */
+  cp->bus_free = MAX(cp->bus_free, (now + lat)) + 1;
+
+  if (cp->pf_nbuf)
     {
-      /* link to the tail of the way list */
-      blk->way_prev = set->way_tail;
-      blk->way_next = NULL;
-      set->way_tail->way_next = blk;
-      set->way_tail = blk;
+      /* into the prefetch buffer, over its oldest entry */
+      pent = &cp->pf_buf[cp->pf_next];
+      cp->pf_next = (cp->pf_next + 1) % cp->pf_nbuf;
+      cp->pf_reading = TRUE;
+      lat += cp->blk_access_fn(Read, baddr, cp->bsize, NULL, now+lat);
+      cp->pf_reading = FALSE;
+
+      /* the buffer keeps no dirty blocks, one an exclusive level below
+	 hands up is written back */
+      if ((cp->features & CACHE_FEAT_LOWER_EXCL) && cp->lower->moved_dirty)
+	{
+	  cp->lower->moved_dirty = FALSE;
+	  cp->lower->writebacks++;
+	  cp->lower->blk_access_fn(Write, baddr, cp->bsize, NULL, now+lat);
+	}
+      pent->valid = TRUE;
+      pent->baddr = baddr;
+      pent->ready = now+lat;
     }
   else
-    panic("bogus WHERE designator");
+    {
+      /* straight into the cache, over the way a miss would replace */
+      way = fill_way(cp, set, CACHE_STAMPS(cp, set));
+      repl = CACHE_SET_BLK(cp, set, way);
+
+      /* the fill moved ahead of the last block to hit if it shares its set,
+	 a fast hit there would skip the replacement update it now needs */
+      if (CACHE_SET(cp, cp->last_tagset) == set)
+	{
+	  cp->last_tagset = NO_TAGSET;
+	  cp->last_blk = NULL;
+	}
+
+      if (repl->status & CACHE_BLK_VALID)
+	{
+	  cp->replacements++;
+
+	  /* a miss on a block the program used is pollution */
+	  if (!(repl->status & CACHE_BLK_PREFETCHED))
+	    *PF_EVICTED(cp, CACHE_MK_BADDR(cp, repl->tag, set)) =
+	      CACHE_MK_BADDR(cp, repl->tag, set) | 1;
+
+	  /* don't replace the block until outstanding misses are satisfied */
+	  lat += BOUND_POS(repl->ready - (now+lat));
+
+	  tags[way] = 0;
+	  lat += evict_blk(cp, repl, CACHE_MK_BADDR(cp, repl->tag, set),
+			   now+lat);
+	}
+
+      repl->tag = CACHE_TAG(cp, baddr);
+      repl->status = CACHE_BLK_VALID|CACHE_BLK_PREFETCHED;
+      tags[way] = repl->tag | CACHE_TAG_VALID;
+      cp->pf_reading = TRUE;
+      lat += cp->blk_access_fn(Read, baddr, cp->bsize, repl, now+lat);
+      cp->pf_reading = FALSE;
+      repl->ready = now+lat;
+
+      /* a block an exclusive level below hands up keeps its dirty bit */
+      if ((cp->features & CACHE_FEAT_LOWER_EXCL) && cp->lower->moved_dirty)
+	{
+	  cp->lower->moved_dirty = FALSE;
+	  repl->status |= CACHE_BLK_DIRTY;
+	}
+    }
+
+  if (mshr)
+    {
+      mshr->baddr = baddr;
+      mshr->ready = now+lat;
+    }
+}
+
+/* train the prefetcher of cache CP with a demand access to ADDR at NOW, MISS
+   if it missed and PF_HIT if it was the first use of a prefetched block, and
+   issue the prefetches it predicts */
+static void
+pf_train(struct cache_t *cp,			/* cache accessed */
+	 md_addr_t addr,			/* address accessed */
+	 int miss,				/* did the access miss? */
+	 int pf_hit,				/* first use of a prefetch? */
+	 tick_t now)				/* time of access */
+{
+  md_addr_t targets[PREFETCH_MAX_DEGREE];
+  int i, n;
+
+  n = prefetch_train(cp->pf, cp->pc, addr, miss, pf_hit, targets);
+  for (i=0; i < n; i++)
+    pf_issue(cp, targets[i], now);
+}
+
+/* update the replacement state of way WAY of a set with STAMPS of cache CP
+   after a hit, for the policies other than LRU, FIFO and Random keep none */
+static void
+hit_way(struct cache_t *cp,			/* cache hit */
+	word_t *stamps,				/* stamps of the set */
+	int way)				/* way hit */
+{
+  switch (cp->policy) {
+  case PLRU:
+    plru_point(cp, stamps, way, /* away */TRUE);
+    break;
+  case SRRIP:
+  case BRRIP:
+  case DRRIP:
+    /* predict a near re-reference */
+    stamps[way] = 0;
+    break;
+  case OPT:
+    stamps[way] = cp->next_use;
+    break;
+  default:
+    break;
+  }
+}
+
+/* the work the features of cache CP add to a CMD hit to ADDR at NOW on
+   block BLK, way WAY of a set with TAGS and STAMPS, or a fast hit if WAY
+   is -1, kept out of cache_access() so a cache without features takes a
+   single test for all of them */
+static NOINLINE void
+hit_features(struct cache_t *cp,		/* cache hit */
+	     enum mem_cmd cmd,			/* access type */
+	     md_addr_t addr,			/* address of access */
+	     struct cache_blk_t *blk,		/* block hit */
+	     md_addr_t *tags,			/* tags of its set */
+	     word_t *stamps,			/* stamps of its set */
+	     int way,				/* way hit, or -1 if fast */
+	     tick_t now)			/* time of access */
+{
+  int pf_hit = FALSE;
+
+  /* a hit on a block still being filled is a secondary miss */
+  if ((cp->features & CACHE_FEAT_MSHRS) && blk->ready > now)
+    cp->mshr_merges++;
+
+  /* the first use of a prefetched block makes the prefetch useful */
+  if (blk->status & CACHE_BLK_PREFETCHED)
+    {
+      blk->status &= ~CACHE_BLK_PREFETCHED;
+      pf_hit = TRUE;
+      cp->pf_useful++;
+      cp->pf_accuracy = (double)cp->pf_useful / cp->pf_issued;
+      if (blk->ready > now)
+	cp->pf_late++;
+    }
+
+  /* an exclusive cache keeps no last block to hit, it may hand it up at
+     its next access, and a read hands the block up without keeping a
+     copy */
+  if (cp->features & CACHE_FEAT_EXCL)
+    {
+      cp->last_tagset = NO_TAGSET;
+      cp->last_blk = NULL;
+      if (cmd == Read)
+	{
+	  cp->moved_dirty = (blk->status & CACHE_BLK_DIRTY) != 0;
+	  blk->status = 0;
+	  tags[way] = 0;
+	  demote_way(cp, stamps, way);
+	}
+    }
+
+  /* train the prefetcher, its fills may replace BLK */
+  if ((cp->features & CACHE_FEAT_PREFETCH) && cp->demand)
+    pf_train(cp, addr, /* !miss */FALSE, pf_hit, now);
 }
 
 /* create and initialize a general cache structure */
@@ -292,12 +1071,14 @@ cache_create(char *name,		/* name of the cache */
     fatal("cache associativity `%d' must be non-zero and positive", assoc);
   if ((assoc & (assoc-1)) != 0)
     fatal("cache associativity `%d' must be a power of two", assoc);
+  if (policy == DRRIP && nsets < DUEL_MIN_SETS)
+    fatal("cache `%s': DRRIP needs at least %d sets to duel in, use SRRIP "
+	  "or BRRIP", name, DUEL_MIN_SETS);
   if (!blk_access_fn)
     fatal("must specify miss/replacement functions");
 
   /* allocate the cache structure */
-  cp = (struct cache_t *)
-    calloc(1, sizeof(struct cache_t) + (nsets-1)*sizeof(struct cache_set_t));
+  cp = (struct cache_t *)calloc(1, sizeof(struct cache_t));
   if (!cp)
     fatal("out of virtual memory");
 
@@ -315,7 +1096,6 @@ cache_create(char *name,		/* name of the cache */
   cp->blk_access_fn = blk_access_fn;
 
   /* compute derived parameters */
-  cp->hsize = CACHE_HIGHLY_ASSOC(cp) ? (assoc >> 2) : 0;
   cp->blk_mask = bsize-1;
   cp->set_shift = log_base2(bsize);
   cp->set_mask = nsets-1;
@@ -323,9 +1103,32 @@ cache_create(char *name,		/* name of the cache */
   cp->tag_mask = (1 << (32 - cp->tag_shift))-1;
   cp->tagset_mask = ~cp->blk_mask;
   cp->bus_free = 0;
+  cp->stamp = assoc;
+  cp->duel_mask = MAX(nsets/DUEL_LEADERS, DUEL_MIN_SETS) - 1;
+  cp->psel = PSEL_MAX/2;
+  cp->bip_count = 0;
+  cp->traced = FALSE;
+  cp->nmshrs = 0;
+  cp->mshrs = NULL;
+  cp->mshr_merges = 0;
+  cp->mshr_full = 0;
+  cp->pf = NULL;
+  cp->pc = 0;
+  cp->demand = TRUE;
+  cp->pf_reading = FALSE;
+  cp->pf_nbuf = 0;
+  cp->pf_buf = NULL;
+  cp->pf_evicted = NULL;
+  cp->nvc = 0;
+  cp->vc = NULL;
+  cp->vc_stamp = 0;
+  cp->vc_hits = 0;
+  cp->inclusion = NonInclusive;
+  cp->nuppers = 0;
+  cp->lower = NULL;
+  cp->moved_dirty = FALSE;
 
   /* print derived parameters during debug */
-  debug("%s: cp->hsize     = %d", cp->name, cp->hsize);
   debug("%s: cp->blk_mask  = 0x%08x", cp->name, cp->blk_mask);
   debug("%s: cp->set_shift = %d", cp->name, cp->set_shift);
   debug("%s: cp->set_mask  = 0x%08x", cp->name, cp->set_mask);
@@ -340,9 +1143,12 @@ cache_create(char *name,		/* name of the cache */
   cp->invalidations = 0;
 
   /* blow away the last block accessed */
-  cp->last_tagset = 0;
+  cp->last_tagset = NO_TAGSET;
   cp->last_blk = NULL;
 
+  /* no features until attached */
+  cp->features = 0;
+
   /* allocate data blocks */
   cp->data = (byte_t *)calloc(nsets * assoc,
 			      sizeof(struct cache_blk_t) +
@@ -350,27 +1156,23 @@ cache_create(char *name,		/* name of the cache */
   if (!cp->data)
     fatal("out of virtual memory");
 
-  /* slice up the data blocks */
+  /* allocate the packed tags and stamps, each set gets its tags followed by
+     its stamps in a power-of-two sized slot, so the slots of small sets
+     never straddle a host cache line */
+  for (cp->slot_shift=log_base2(sizeof(md_addr_t));
+       (1 << cp->slot_shift) < assoc * (sizeof(md_addr_t) + sizeof(word_t));
+       cp->slot_shift++)
+    /* nada */;
+  cp->tag_data = (byte_t *)calloc(1, (nsets << cp->slot_shift) + 64);
+  if (!cp->tag_data)
+    fatal("out of virtual memory");
+  cp->tags = (byte_t *)(((unsigned long)cp->tag_data + 63) & ~63UL);
+
+  /* initialize the data blocks, and the tags and stamps, NOTE: all the blocks
+     in a set *must* be allocated contiguously, otherwise, CACHE_SET_BLK()
+     will fail to map a way to its block */
   for (bindex=0,i=0; i<nsets; i++)
     {
-      cp->sets[i].way_head = NULL;
-      cp->sets[i].way_tail = NULL;
-      /* get a hash table, if needed */
-      if (cp->hsize)
-	{
-	  cp->sets[i].hash =
-	    (struct cache_blk_t **)calloc(cp->hsize,
-					  sizeof(struct cache_blk_t *));
-	  if (!cp->sets[i].hash)
-	    fatal("out of virtual memory");
-	}
-      /* NOTE: all the blocks in a set *must* be allocated contiguously,
-	 otherwise, block accesses through SET->BLKS will fail (used
-	 during random replacement selection) */
-      cp->sets[i].blks = CACHE_BINDEX(cp, cp->data, bindex);
-      
-      /* link the data blocks into ordered way chain and hash table bucket
-         chains, if hash table exists */
       for (j=0; j<assoc; j++)
 	{
 	  /* locate next cache block */
@@ -384,18 +1186,9 @@ cache_create(char *name,		/* name of the cache */
 	  blk->user_data = (usize != 0
 			    ? (byte_t *)calloc(usize, sizeof(byte_t)) : NULL);
 
-	  /* insert cache block into set hash table */
-	  if (cp->hsize)
-	    link_htab_ent(cp, &cp->sets[i], blk);
-
-	  /* insert into head of way list, order is arbitrary at this point */
-	  blk->way_next = cp->sets[i].way_head;
-	  blk->way_prev = NULL;
-	  if (cp->sets[i].way_head)
-	    cp->sets[i].way_head->way_prev = blk;
-	  cp->sets[i].way_head = blk;
-	  if (!cp->sets[i].way_tail)
-	    cp->sets[i].way_tail = blk;
+	  /* invalidate its tag */
+	  CACHE_TAGS(cp, i)[j] = 0;
+	  CACHE_STAMPS(cp, i)[j] = initial_stamp(cp, j);
 	}
     }
   return cp;
@@ -409,10 +1202,277 @@ cache_char2policy(char c)		/* replacement policy as a char */
   case 'l': return LRU;
   case 'r': return Random;
   case 'f': return FIFO;
+  case 'p': return PLRU;
+  case 's': return SRRIP;
+  case 'b': return BRRIP;
+  case 'd': return DRRIP;
+  case 'o': return OPT;
   default: fatal("bogus replacement policy, `%c'", c);
   }
 }
 
+/* a reference of a recorded stream, sorted by block then position */
+struct trace_ent_t {
+  md_addr_t baddr;		/* block address referenced */
+  word_t pos;			/* position in the stream */
+};
+
+/* sort references by block, then position */
+static int
+trace_ent_cmp(const void *a, const void *b)
+{
+  const struct trace_ent_t *x = a, *y = b;
+
+  if (x->baddr != y->baddr)
+    return x->baddr < y->baddr ? -1 : 1;
+  return x->pos < y->pos ? -1 : (x->pos > y->pos);
+}
+
+/* record the reference stream of cache CP to file <PREFIX>.<name>, or if CP
+   uses OPT replacement, read back the stream recorded there, a run with an
+   OPT cache must make the same references to it as the recording run did,
+   it stops with an error when the streams diverge */
+void
+cache_trace(struct cache_t *cp,		/* cache instance */
+	    char *prefix)		/* stream file name prefix */
+{
+  char fname[1024];
+  FILE *fd;
+  long size;
+  word_t i, len;
+  struct trace_ent_t *ents;
+
+  /* unified caches are reached by more than one name */
+  if (cp->traced)
+    return;
+  cp->traced = TRUE;
+  cp->features |= CACHE_FEAT_TRACE;
+  cp->trace_last = 1; /* no block address */
+
+  if (strlen(prefix) + strlen(cp->name) + 2 > sizeof(fname))
+    fatal("reference stream file name `%s.%s' is too long", prefix, cp->name);
+  strcpy(fname, prefix);
+  strcat(fname, ".");
+  strcat(fname, cp->name);
+
+  if (cp->policy != OPT)
+    {
+      cp->trace_fd = fopen(fname, "wb");
+      if (!cp->trace_fd)
+	fatal("cannot create reference stream file `%s'", fname);
+      return;
+    }
+
+  /* read back the whole stream */
+  fd = fopen(fname, "rb");
+  if (!fd)
+    fatal("cannot open reference stream file `%s', record it with a run "
+	  "that does not use OPT replacement for `%s'", fname, cp->name);
+  if (fseek(fd, 0, SEEK_END) != 0 || (size = ftell(fd)) < 0)
+    fatal("cannot size reference stream file `%s'", fname);
+  rewind(fd);
+  if (size % sizeof(md_addr_t) != 0
+      || size / sizeof(md_addr_t) >= OPT_NEVER)
+    fatal("reference stream file `%s' is corrupt", fname);
+  len = size / sizeof(md_addr_t);
+
+  cp->trace_len = len;
+  cp->trace_pos = 0;
+  cp->trace_addrs = (md_addr_t *)calloc(len + 1, sizeof(md_addr_t));
+  cp->trace_next = (word_t *)calloc(len + 1, sizeof(word_t));
+  ents = (struct trace_ent_t *)calloc(len + 1, sizeof(struct trace_ent_t));
+  if (!cp->trace_addrs || !cp->trace_next || !ents)
+    fatal("out of virtual memory");
+  if (fread(cp->trace_addrs, sizeof(md_addr_t), len, fd) != len)
+    fatal("cannot read reference stream file `%s'", fname);
+  fclose(fd);
+
+  /* the next use of a reference is the one after it in block order */
+  for (i=0; i < len; i++)
+    {
+      ents[i].baddr = cp->trace_addrs[i];
+      ents[i].pos = i;
+    }
+  qsort(ents, len, sizeof(struct trace_ent_t), trace_ent_cmp);
+  for (i=0; i < len; i++)
+    {
+      cp->trace_next[ents[i].pos] =
+	(i + 1 < len && ents[i+1].baddr == ents[i].baddr
+	 ? ents[i+1].pos : OPT_NEVER);
+    }
+  free(ents);
+}
+
+/* give cache CP NMSHRS miss status holding registers, a primary miss holds
+   one until its fill completes, a miss to a block still being filled is a
+   secondary miss and merges onto the MSHR filling it, and a primary miss
+   that finds all of them busy waits for the first to free up */
+void
+cache_mshrs(struct cache_t *cp,		/* cache instance */
+	    int nmshrs)			/* number of MSHRs, 0 for unlimited */
+{
+  if (nmshrs < 0)
+    fatal("cache `%s': number of MSHRs `%d' must be positive",
+	  cp->name, nmshrs);
+
+  if (cp->mshrs)
+    free(cp->mshrs);
+  cp->mshrs = NULL;
+  cp->nmshrs = nmshrs;
+  cp->features &= ~CACHE_FEAT_MSHRS;
+  if (nmshrs)
+    {
+      cp->features |= CACHE_FEAT_MSHRS;
+      cp->mshrs = (struct cache_mshr_t *)
+	calloc(nmshrs, sizeof(struct cache_mshr_t));
+      if (!cp->mshrs)
+	fatal("out of virtual memory");
+    }
+}
+
+/* non-zero if an access to ADDR at NOW would be a primary miss in cache CP
+   and find all of its MSHRs busy, lets a pipeline hold the access back
+   rather than have cache_access() charge the wait */
+int					/* non-zero if the access would stall */
+cache_mshr_busy(struct cache_t *cp,	/* cache instance */
+		md_addr_t addr,		/* address of access */
+		tick_t now)		/* time of access */
+{
+  md_addr_t set = CACHE_SET(cp, addr);
+
+  if (!cp->nmshrs
+      || find_way(cp, CACHE_TAGS(cp, set), CACHE_TAG(cp, addr)) >= 0
+      || mshr_lookup(cp, CACHE_BADDR(cp, addr), now)
+      || (cp->pf_nbuf && pbuf_lookup(cp, CACHE_BADDR(cp, addr)))
+      || (cp->nvc && vc_lookup(cp, CACHE_BADDR(cp, addr))))
+    return FALSE;
+  return mshr_first_free(cp)->ready > now;
+}
+
+/* attach prefetcher PF to cache CP, the blocks it predicts go into a
+   prefetch buffer with NBUF entries, or if NBUF is zero, straight into the
+   cache */
+void
+cache_prefetcher(struct cache_t *cp,	/* cache instance */
+		 struct prefetch_t *pf,	/* prefetcher to attach */
+		 int nbuf)		/* prefetch buffer entries, or 0 */
+{
+  if (nbuf < 0)
+    fatal("cache `%s': prefetch buffer entries `%d' must be positive",
+	  cp->name, nbuf);
+  if (pf->bsize != cp->bsize)
+    fatal("cache `%s': prefetcher block size differs from the cache's",
+	  cp->name);
+  if (cp->policy == OPT)
+    fatal("cache `%s': OPT replacement cannot replay prefetches", cp->name);
+  if (nbuf && cp->balloc)
+    fatal("cache `%s': prefetch buffers hold no data, the cache must not",
+	  cp->name);
+
+  cp->pf = pf;
+  cp->features |= CACHE_FEAT_PREFETCH;
+  cp->pf_nbuf = nbuf;
+  cp->pf_next = 0;
+  cp->pf_issued = 0;
+  cp->pf_useful = 0;
+  cp->pf_accuracy = 0.0;
+  cp->pf_late = 0;
+  cp->pf_pollution = 0;
+  if (nbuf)
+    {
+      cp->pf_buf = (struct cache_pbuf_t *)
+	calloc(nbuf, sizeof(struct cache_pbuf_t));
+      if (!cp->pf_buf)
+	fatal("out of virtual memory");
+    }
+  else
+    {
+      cp->pf_evicted = (md_addr_t *)
+	calloc(cp->nsets * cp->assoc, sizeof(md_addr_t));
+      if (!cp->pf_evicted)
+	fatal("out of virtual memory");
+    }
+}
+
+/* give cache CP a fully-associative victim cache with NVC entries */
+void
+cache_victims(struct cache_t *cp,	/* cache instance */
+	      int nvc)			/* victim cache entries */
+{
+  if (nvc < 0)
+    fatal("cache `%s': victim cache entries `%d' must be positive",
+	  cp->name, nvc);
+  if (nvc && cp->balloc)
+    fatal("cache `%s': victim caches hold no data, the cache must not",
+	  cp->name);
+
+  if (cp->vc)
+    free(cp->vc);
+  cp->vc = NULL;
+  cp->nvc = nvc;
+  cp->features &= ~CACHE_FEAT_VICTIMS;
+  if (nvc)
+    {
+      cp->features |= CACHE_FEAT_VICTIMS;
+      cp->vc = (struct cache_vc_t *)calloc(nvc, sizeof(struct cache_vc_t));
+      if (!cp->vc)
+	fatal("out of virtual memory");
+    }
+}
+
+/* parse inclusion policy */
+enum cache_inclusion			/* inclusion policy enum */
+cache_char2inclusion(char c)		/* inclusion policy as a char */
+{
+  switch (c) {
+  case 'n': return NonInclusive;
+  case 'i': return Inclusive;
+  case 'e': return Exclusive;
+  default: fatal("bogus inclusion policy, `%c'", c);
+  }
+}
+
+/* make cache CP the level below cache UPPER, with inclusion policy
+   INCLUSION, UPPER's misses must go to CP */
+void
+cache_inclusion(struct cache_t *cp,	/* cache instance */
+		enum cache_inclusion inclusion,/* inclusion policy */
+		struct cache_t *upper)	/* level above it */
+{
+  int i;
+
+  if (inclusion == Exclusive && cp->policy == OPT)
+    fatal("cache `%s': OPT replacement cannot replay exclusive fills",
+	  cp->name);
+  if (inclusion == Exclusive && cp->balloc)
+    fatal("cache `%s': an exclusive cache must not hold data", cp->name);
+  if (inclusion == Exclusive && upper->bsize != cp->bsize)
+    fatal("cache `%s': an exclusive cache must have the block size of the "
+	  "level above it", cp->name);
+  if (upper == cp)
+    fatal("cache `%s' cannot be below itself", cp->name);
+
+  cp->inclusion = inclusion;
+  cp->features &= ~(CACHE_FEAT_INCL|CACHE_FEAT_EXCL);
+  if (inclusion == Inclusive)
+    cp->features |= CACHE_FEAT_INCL;
+  else if (inclusion == Exclusive)
+    cp->features |= CACHE_FEAT_EXCL;
+  upper->lower = cp;
+  upper->features &= ~CACHE_FEAT_LOWER_EXCL;
+  if (inclusion == Exclusive)
+    upper->features |= CACHE_FEAT_LOWER_EXCL;
+  for (i=0; i < cp->nuppers; i++)
+    {
+      if (cp->uppers[i] == upper)
+	return;
+    }
+  if (cp->nuppers == CACHE_MAX_UPPERS)
+    fatal("cache `%s': more than %d levels above it",
+	  cp->name, CACHE_MAX_UPPERS);
+  cp->uppers[cp->nuppers++] = upper;
+}
+
 /* print cache configuration */
 void
 cache_config(struct cache_t *cp,	/* cache instance */
@@ -427,7 +1487,30 @@ cache_config(struct cache_t *cp,	/* cache instance */
 	  cp->policy == LRU ? "LRU"
 	  : cp->policy == Random ? "Random"
 	  : cp->policy == FIFO ? "FIFO"
+	  : cp->policy == PLRU ? "PLRU"
+	  : cp->policy == SRRIP ? "SRRIP"
+	  : cp->policy == BRRIP ? "BRRIP"
+	  : cp->policy == DRRIP ? "DRRIP"
+	  : cp->policy == OPT ? "OPT"
 	  : (abort(), ""));
+  if (cp->nmshrs)
+    fprintf(stream, "cache: %s: %d MSHRs\n", cp->name, cp->nmshrs);
+  if (cp->pf && cp->pf_nbuf)
+    fprintf(stream,
+	    "cache: %s: %s prefetcher, %d entries, degree %d, "
+	    "%d entry prefetch buffer\n",
+	    cp->name, prefetch_kind_name(cp->pf->kind), cp->pf->entries,
+	    cp->pf->degree, cp->pf_nbuf);
+  else if (cp->pf)
+    fprintf(stream,
+	    "cache: %s: %s prefetcher, %d entries, degree %d, direct fill\n",
+	    cp->name, prefetch_kind_name(cp->pf->kind), cp->pf->entries,
+	    cp->pf->degree);
+  if (cp->nvc)
+    fprintf(stream, "cache: %s: %d entry victim cache\n", cp->name, cp->nvc);
+  if (cp->inclusion != NonInclusive)
+    fprintf(stream, "cache: %s: %s of the levels above\n", cp->name,
+	    cp->inclusion == Inclusive ? "inclusive" : "exclusive");
 }
 
 /* register cache stats */
@@ -471,6 +1554,45 @@ cache_reg_stats(struct cache_t *cp,	/* cache instance */
   sprintf(buf, "%s.inv_rate", name);
   sprintf(buf1, "%s.invalidations / %s.accesses", name, name);
   stat_reg_formula(sdb, buf, "invalidation rate (i.e., invs/ref)", buf1, NULL);
+  if (cp->nmshrs)
+    {
+      sprintf(buf, "%s.mshr_merges", name);
+      stat_reg_counter(sdb, buf, "secondary misses merged onto an MSHR",
+		       &cp->mshr_merges, 0, NULL);
+      sprintf(buf, "%s.mshr_full", name);
+      stat_reg_counter(sdb, buf, "primary misses that waited for an MSHR",
+		       &cp->mshr_full, 0, NULL);
+    }
+  if (cp->pf)
+    {
+      sprintf(buf, "%s.pf_issued", name);
+      stat_reg_counter(sdb, buf, "prefetches sent to the next level",
+		       &cp->pf_issued, 0, NULL);
+      sprintf(buf, "%s.pf_useful", name);
+      stat_reg_counter(sdb, buf, "prefetched blocks the program used",
+		       &cp->pf_useful, 0, NULL);
+      sprintf(buf, "%s.pf_late", name);
+      stat_reg_counter(sdb, buf, "prefetched blocks used before they came",
+		       &cp->pf_late, 0, NULL);
+      sprintf(buf, "%s.pf_pollution", name);
+      stat_reg_counter(sdb, buf, "misses on blocks prefetches evicted",
+		       &cp->pf_pollution, 0, NULL);
+      sprintf(buf, "%s.pf_accuracy", name);
+      stat_reg_double(sdb, buf, "prefetch accuracy (i.e., useful/issued)",
+		      &cp->pf_accuracy, 0.0, "%12.4f");
+      sprintf(buf, "%s.pf_coverage", name);
+      sprintf(buf1, "%s.pf_useful / (%s.pf_useful + %s.misses)",
+	      name, name, name);
+      stat_reg_formula(sdb, buf,
+		       "prefetch coverage (i.e., useful/(useful+misses))",
+		       buf1, NULL);
+    }
+  if (cp->nvc)
+    {
+      sprintf(buf, "%s.vc_hits", name);
+      stat_reg_counter(sdb, buf, "misses that found their block in the "
+		       "victim cache", &cp->vc_hits, 0, NULL);
+    }
 }
 
 /* print cache stats */
@@ -491,106 +1613,85 @@ cache_stats(struct cache_t *cp,		/* cache instance */
 	  (double)cp->invalidations/sum);
 }
 
-/* access a cache, perform a CMD operation on cache CP at address ADDR,
-   places NBYTES of data at *P, returns latency of operation if initiated
-   at NOW, places pointer to block user data in *UDATA, *P is untouched if
-   cache blocks are not allocated (!CP->BALLOC), UDATA should be NULL if no
-   user data is attached to blocks */
-unsigned int				/* latency of access in cycles */
-cache_access(struct cache_t *cp,	/* cache to access */
-	     enum mem_cmd cmd,		/* access type, Read or Write */
-	     md_addr_t addr,		/* address of access */
-	     void *vp,			/* ptr to buffer for input/output */
-	     int nbytes,		/* number of bytes to access */
-	     tick_t now,		/* time of access */
-	     byte_t **udata,		/* for return of user data ptr */
-	     md_addr_t *repl_addr)	/* for address of replaced block */
+/* handle a CMD miss to ADDR in cache CP at NOW, the arguments are those of
+   cache_access(), kept out of it so the hit paths stay short */
+static NOINLINE unsigned int		/* latency of access in cycles */
+cache_miss(struct cache_t *cp,		/* cache to access */
+	   enum mem_cmd cmd,		/* access type, Read or Write */
+	   md_addr_t addr,		/* address of access */
+	   byte_t *p,			/* ptr to buffer for input/output */
+	   int nbytes,			/* number of bytes to access */
+	   tick_t now,			/* time of access */
+	   byte_t **udata,		/* for return of user data ptr */
+	   md_addr_t *repl_addr)	/* for address of replaced block */
 {
-  byte_t *p = vp;
   md_addr_t tag = CACHE_TAG(cp, addr);
   md_addr_t set = CACHE_SET(cp, addr);
   md_addr_t bofs = CACHE_BLK(cp, addr);
-  struct cache_blk_t *blk, *repl;
-  int lat = 0;
-
-  /* default replacement address */
-  if (repl_addr)
-    *repl_addr = 0;
-
-  /* check alignments */
-  if ((nbytes & (nbytes-1)) != 0 || (addr & (nbytes-1)) != 0)
-    fatal("cache: access error: bad size or alignment, addr 0x%08x", addr);
-
-  /* access must fit in cache block */
-  /* FIXME:
-     ((addr + (nbytes - 1)) > ((addr & ~cp->blk_mask) + (cp->bsize - 1))) */
-  if ((addr + nbytes) > ((addr & ~cp->blk_mask) + cp->bsize))
-    fatal("cache: access error: access spans block, addr 0x%08x", addr);
-
-  /* permissions are checked on cache misses */
-
-  /* check for a fast hit: access to same block */
-  if (CACHE_TAGSET(cp, addr) == cp->last_tagset)
+  md_addr_t *tags = CACHE_TAGS(cp, set);
+  word_t *stamps = CACHE_STAMPS(cp, set);
+  struct cache_blk_t *repl;
+  struct cache_mshr_t *mshr = NULL;
+  struct cache_pbuf_t *pent = NULL;
+  struct cache_vc_t *vent = NULL;
+  unsigned int vc_status = 0;
+  tick_t vc_ready = 0;
+  int way, merged = FALSE, dirty = FALSE, lat = 0;
+
+  /* a block in the prefetch buffer moves into the cache, the access is a
+     hit on a prefetched block */
+  if (cp->features & (CACHE_FEAT_PREFETCH|CACHE_FEAT_VICTIMS))
     {
-      /* hit in the same block */
-      blk = cp->last_blk;
-      goto cache_fast_hit;
+      if (cp->pf_nbuf)
+	pent = pbuf_lookup(cp, CACHE_BADDR(cp, addr));
+      if (!pent && cp->nvc)
+	vent = vc_lookup(cp, CACHE_BADDR(cp, addr));
     }
-    
-  if (cp->hsize)
+  if (pent)
+    cp->hits++;
+  else if (vent)
     {
-      /* higly-associativity cache, access through the per-set hash tables */
-      int hindex = CACHE_HASH(cp, tag);
-
-      for (blk=cp->sets[set].hash[hindex];
-	   blk;
-	   blk=blk->hash_next)
-	{
-	  if (blk->tag == tag && (blk->status & CACHE_BLK_VALID))
-	    goto cache_hit;
-	}
+      /* swap the block back in from the victim cache, its entry takes the
+	 replaced block */
+      cp->hits++;
+      cp->vc_hits++;
+      vc_status = vent->status;
+      vc_ready = vent->ready;
+      vent->valid = FALSE;
     }
   else
     {
-      /* low-associativity cache, linear search the way list */
-      for (blk=cp->sets[set].way_head;
-	   blk;
-	   blk=blk->way_next)
+      /* **MISS** */
+      cp->misses++;
+
+      /* a block a prefetch evicted? */
+      if (cp->pf_evicted)
 	{
-	  if (blk->tag == tag && (blk->status & CACHE_BLK_VALID))
-	    goto cache_hit;
+	  md_addr_t *evicted = PF_EVICTED(cp, CACHE_BADDR(cp, addr));
+
+	  if (*evicted == (CACHE_BADDR(cp, addr) | 1))
+	    {
+	      cp->pf_pollution++;
+	      *evicted = 0;
+	    }
 	}
     }
 
-  /* cache block not found */
-
-  /* **MISS** */
-  cp->misses++;
-
-  /* select the appropriate block to replace, and re-link this entry to
-     the appropriate place in the way list */
-  switch (cp->policy) {
-  case LRU:
-  case FIFO:
-    repl = cp->sets[set].way_tail;
-    update_way_list(&cp->sets[set], repl, Head);
-    break;
-  case Random:
+  /* an exclusive cache hands the blocks the levels above read up to them,
+     without keeping a copy */
+  if ((cp->features & CACHE_FEAT_EXCL) && cmd == Read)
     {
-      int bindex = myrand() & (cp->assoc - 1);
-      repl = CACHE_BINDEX(cp, cp->sets[set].blks, bindex);
+      repl = NULL;
+      goto cache_read_block;
     }
-    break;
-  default:
-    panic("bogus replacement policy");
-  }
 
-  /* remove this block from the hash bucket chain, if hash exists */
-  if (cp->hsize)
-    unlink_htab_ent(cp, &cp->sets[set], repl);
+  /* select the appropriate way to replace, and move it to the appropriate
+     place in the replacement order */
+  way = fill_way(cp, set, stamps);
+  repl = CACHE_SET_BLK(cp, set, way);
 
   /* blow away the last block to hit */
-  cp->last_tagset = 0;
+  cp->last_tagset = NO_TAGSET;
   cp->last_blk = NULL;
 
   /* write back replaced block data */
@@ -610,23 +1711,88 @@ cache_access(struct cache_t *cp,	/* cache to access */
       /* track bus resource usage */
       cp->bus_free = MAX(cp->bus_free, (now + lat)) + 1;
 
-      if (repl->status & CACHE_BLK_DIRTY)
-	{
-	  /* write back the cache block */
-	  cp->writebacks++;
-	  lat += cp->blk_access_fn(Write,
-				   CACHE_MK_BADDR(cp, repl->tag, set),
-				   cp->bsize, repl, now+lat);
-	}
+      /* write back replaced block data, or keep it in the victim cache */
+      tags[way] = 0;
+      lat += evict_blk(cp, repl, CACHE_MK_BADDR(cp, repl->tag, set),
+		       now+lat);
     }
 
   /* update block tags */
   repl->tag = tag;
   repl->status = CACHE_BLK_VALID;	/* dirty bit set on update */
+  tags[way] = tag | CACHE_TAG_VALID;
+
+ cache_read_block:
+
+  /* the fill needs an MSHR, merge onto the one already filling the block
+     (which was replaced before its fill completed), or wait for one */
+  if ((cp->features & CACHE_FEAT_MSHRS) && !pent && !vent)
+    {
+      mshr = mshr_lookup(cp, CACHE_BADDR(cp, addr), now+lat);
+      if (mshr)
+	{
+	  merged = TRUE;
+	  cp->mshr_merges++;
+
+	  /* the replacement may have put the block into an exclusive level
+	     below, it comes back out with its dirty bit */
+	  if ((cp->features & CACHE_FEAT_LOWER_EXCL)
+	      && (invalidate_blk(cp->lower, CACHE_BADDR(cp, addr))
+		  & CACHE_BLK_DIRTY))
+	    dirty = TRUE;
+	}
+      else
+	{
+	  mshr = mshr_first_free(cp);
+	  if (mshr->ready > now+lat)
+	    {
+	      cp->mshr_full++;
+	      lat += mshr->ready - (now+lat);
+	    }
+	}
+    }
 
   /* read data block */
-  lat += cp->blk_access_fn(Read, CACHE_BADDR(cp, addr), cp->bsize,
-			   repl, now+lat);
+  if (pent)
+    {
+      /* the prefetch was useful, late if it is still on its way */
+      cp->pf_useful++;
+      cp->pf_accuracy = (double)cp->pf_useful / cp->pf_issued;
+      if (pent->ready > now+lat)
+	cp->pf_late++;
+      lat += BOUND_POS(pent->ready - (now+lat));
+      pent->valid = FALSE;
+    }
+  else if (vent)
+    {
+      /* the victim cache is a little slower than the cache */
+      lat += BOUND_POS(vc_ready - (now+lat));
+      lat = MAX(lat, cp->hit_latency + CACHE_VC_LAT);
+      dirty = (vc_status & CACHE_BLK_DIRTY) != 0;
+    }
+  else if (merged)
+    lat += BOUND_POS(mshr->ready - (now+lat));
+  else
+    {
+      lat += cp->blk_access_fn(Read, CACHE_BADDR(cp, addr), cp->bsize,
+			       repl, now+lat);
+
+      /* a block an exclusive level below hands up keeps its dirty bit */
+      if ((cp->features & CACHE_FEAT_LOWER_EXCL) && cp->lower->moved_dirty)
+	{
+	  cp->lower->moved_dirty = FALSE;
+	  dirty = TRUE;
+	}
+    }
+
+  if (!repl)
+    {
+      /* handed up, dirty if it was dirty here */
+      cp->moved_dirty = dirty;
+      if (udata)
+	*udata = NULL;
+      goto cache_miss_done;
+    }
 
   /* copy data out of cache block */
   if (cp->balloc)
@@ -635,7 +1801,7 @@ cache_access(struct cache_t *cp,	/* cache to access */
     }
 
   /* update dirty status */
-  if (cmd == Write)
+  if (cmd == Write || dirty)
     repl->status |= CACHE_BLK_DIRTY;
 
   /* get user block data, if requested and it exists */
@@ -645,13 +1811,85 @@ cache_access(struct cache_t *cp,	/* cache to access */
   /* update block status */
   repl->ready = now+lat;
 
-  /* link this entry back into the hash table */
-  if (cp->hsize)
-    link_htab_ent(cp, &cp->sets[set], repl);
+ cache_miss_done:
+  if (mshr && !merged)
+    {
+      mshr->baddr = CACHE_BADDR(cp, addr);
+      mshr->ready = now+lat;
+    }
+
+  /* train the prefetcher */
+  if ((cp->features & CACHE_FEAT_PREFETCH) && cp->demand)
+    pf_train(cp, addr, /* miss */!pent, /* pf_hit */pent != NULL, now);
 
   /* return latency of the operation */
   return lat;
+}
+
+/* access a cache, perform a CMD operation on cache CP at address ADDR,
+   places NBYTES of data at *P, returns latency of operation if initiated
+   at NOW, places pointer to block user data in *UDATA, *P is untouched if
+   cache blocks are not allocated (!CP->BALLOC), UDATA should be NULL if no
+   user data is attached to blocks */
+unsigned int				/* latency of access in cycles */
+cache_access(struct cache_t *cp,	/* cache to access */
+	     enum mem_cmd cmd,		/* access type, Read or Write */
+	     md_addr_t addr,		/* address of access */
+	     void *vp,			/* ptr to buffer for input/output */
+	     int nbytes,		/* number of bytes to access */
+	     tick_t now,		/* time of access */
+	     byte_t **udata,		/* for return of user data ptr */
+	     md_addr_t *repl_addr)	/* for address of replaced block */
+{
+  byte_t *p = vp;
+  md_addr_t tag = CACHE_TAG(cp, addr);
+  md_addr_t set = CACHE_SET(cp, addr);
+  md_addr_t bofs = CACHE_BLK(cp, addr);
+  md_addr_t *tags;
+  word_t *stamps;
+  struct cache_blk_t *blk;
+  int way, lat;
 
+  /* default replacement address */
+  if (repl_addr)
+    *repl_addr = 0;
+
+  /* check alignments */
+  if ((nbytes & (nbytes-1)) != 0 || (addr & (nbytes-1)) != 0)
+    fatal("cache: access error: bad size or alignment, addr 0x%08x", addr);
+
+  /* access must fit in cache block */
+  /* FIXME:
+     ((addr + (nbytes - 1)) > ((addr & ~cp->blk_mask) + (cp->bsize - 1))) */
+  if ((addr + nbytes) > ((addr & ~cp->blk_mask) + cp->bsize))
+    fatal("cache: access error: access spans block, addr 0x%08x", addr);
+
+  /* permissions are checked on cache misses */
+
+  /* record or replay the reference stream */
+  if (cp->features & CACHE_FEAT_TRACE)
+    trace_ref(cp, CACHE_BADDR(cp, addr));
+
+  /* check for a fast hit: access to same block */
+  if (CACHE_TAGSET(cp, addr) == cp->last_tagset)
+    {
+      /* hit in the same block */
+      blk = cp->last_blk;
+      goto cache_fast_hit;
+    }
+
+  /* search the packed tags of the set */
+  tags = CACHE_TAGS(cp, set);
+  stamps = CACHE_STAMPS(cp, set);
+  way = find_way(cp, tags, tag);
+  if (way >= 0)
+    {
+      blk = CACHE_SET_BLK(cp, set, way);
+      goto cache_hit;
+    }
+
+  /* cache block not found */
+  return cache_miss(cp, cmd, addr, p, nbytes, now, udata, repl_addr);
 
  cache_hit: /* slow hit handler */
   
@@ -668,14 +1906,14 @@ cache_access(struct cache_t *cp,	/* cache to access */
   if (cmd == Write)
     blk->status |= CACHE_BLK_DIRTY;
 
-  /* if LRU replacement and this is not the first element of list, reorder */
-  if (blk->way_prev && cp->policy == LRU)
+  /* update the replacement state of the way, FIFO and Random keep none */
+  if (cp->policy == LRU)
     {
-      /* move this block to head of the way (MRU) list */
-      update_way_list(&cp->sets[set], blk, Head);
+      /* make this the most recently used way */
+      touch_way(cp, stamps, way);
     }
-
-  /* tag is unchanged, so hash links (if they exist) are still valid */
+  else
+    hit_way(cp, stamps, way);
 
   /* record the last block to hit */
   cp->last_tagset = CACHE_TAGSET(cp, addr);
@@ -685,8 +1923,15 @@ cache_access(struct cache_t *cp,	/* cache to access */
   if (udata)
     *udata = blk->user_data;
 
+  /* first cycle data is available to access */
+  lat = (int) MAX(cp->hit_latency, (blk->ready - now));
+
+  /* MSHRs, prefetches and exclusion */
+  if (cp->features)
+    hit_features(cp, cmd, addr, blk, tags, stamps, way, now);
+
   /* return first cycle data is available to access */
-  return (int) MAX(cp->hit_latency, (blk->ready - now));
+  return lat;
 
  cache_fast_hit: /* fast hit handler */
   
@@ -703,20 +1948,21 @@ cache_access(struct cache_t *cp,	/* cache to access */
   if (cmd == Write)
     blk->status |= CACHE_BLK_DIRTY;
 
-  /* this block hit last, no change in the way list */
-
-  /* tag is unchanged, so hash links (if they exist) are still valid */
+  /* this block hit last, no change in the replacement order */
 
   /* get user block data, if requested and it exists */
   if (udata)
     *udata = blk->user_data;
 
-  /* record the last block to hit */
-  cp->last_tagset = CACHE_TAGSET(cp, addr);
-  cp->last_blk = blk;
+  /* first cycle data is available to access */
+  lat = (int) MAX(cp->hit_latency, (blk->ready - now));
+
+  /* MSHRs and prefetches, an exclusive cache never records a last block */
+  if (cp->features)
+    hit_features(cp, cmd, addr, blk, NULL, NULL, -1, now);
 
   /* return first cycle data is available to access */
-  return (int) MAX(cp->hit_latency, (blk->ready - now));
+  return lat;
 }
 
 /* return non-zero if block containing address ADDR is contained in cache
@@ -728,37 +1974,10 @@ cache_probe(struct cache_t *cp,		/* cache instance to probe */
 {
   md_addr_t tag = CACHE_TAG(cp, addr);
   md_addr_t set = CACHE_SET(cp, addr);
-  struct cache_blk_t *blk;
 
   /* permissions are checked on cache misses */
 
-  if (cp->hsize)
-  {
-    /* higly-associativity cache, access through the per-set hash tables */
-    int hindex = CACHE_HASH(cp, tag);
-    
-    for (blk=cp->sets[set].hash[hindex];
-	 blk;
-	 blk=blk->hash_next)
-    {	
-      if (blk->tag == tag && (blk->status & CACHE_BLK_VALID))
-	  return TRUE;
-    }
-  }
-  else
-  {
-    /* low-associativity cache, linear search the way list */
-    for (blk=cp->sets[set].way_head;
-	 blk;
-	 blk=blk->way_next)
-    {
-      if (blk->tag == tag && (blk->status & CACHE_BLK_VALID))
-	  return TRUE;
-    }
-  }
-  
-  /* cache block not found */
-  return FALSE;
+  return find_way(cp, CACHE_TAGS(cp, set), tag) >= 0;
 }
 
 /* flush the entire cache, returns latency of the operation */
@@ -766,35 +1985,71 @@ unsigned int				/* latency of the flush operation */
 cache_flush(struct cache_t *cp,		/* cache instance to flush */
 	    tick_t now)			/* time of cache flush */
 {
-  int i, lat = cp->hit_latency; /* min latency to probe cache */
+  int i, n, j, way, lat = cp->hit_latency; /* min latency to probe cache */
+  word_t newer;
+  md_addr_t *tags;
+  word_t *stamps;
   struct cache_blk_t *blk;
 
   /* blow away the last block to hit */
-  cp->last_tagset = 0;
+  cp->last_tagset = NO_TAGSET;
   cp->last_blk = NULL;
 
-  /* no way list updates required because all blocks are being invalidated */
+  /* no order updates required because all blocks are being invalidated, the
+     ways are visited most recently used first if the stamps are ages, the
+     order the writebacks reach the next level in, or else in way order */
   for (i=0; i<cp->nsets; i++)
     {
-      for (blk=cp->sets[i].way_head; blk; blk=blk->way_next)
+      tags = CACHE_TAGS(cp, i);
+      stamps = CACHE_STAMPS(cp, i);
+      for (newer=STAMP_MARK,n=0; n<cp->assoc; n++)
 	{
-	  if (blk->status & CACHE_BLK_VALID)
+	  if (CACHE_AGED(cp))
 	    {
+	      /* find the newest way older than the last one visited */
+	      for (way=-1,j=0; j<cp->assoc; j++)
+		{
+		  if (stamps[j] < newer
+		      && (way < 0 || stamps[j] > stamps[way]))
+		    way = j;
+		}
+	      newer = stamps[way];
+	    }
+	  else
+	    {
+	      /* all ways end up invalid, let them go first */
+	      way = n;
+	      demote_way(cp, stamps, way);
+	    }
+
+	  if (tags[way] & CACHE_TAG_VALID)
+	    {
+	      blk = CACHE_SET_BLK(cp, i, way);
 	      cp->invalidations++;
 	      blk->status &= ~CACHE_BLK_VALID;
+	      tags[way] = 0;
 
-	      if (blk->status & CACHE_BLK_DIRTY)
-		{
-		  /* write back the invalidated block */
-          	  cp->writebacks++;
-		  lat += cp->blk_access_fn(Write,
-					   CACHE_MK_BADDR(cp, blk->tag, i),
-					   cp->bsize, blk, now+lat);
-		}
+	      /* write back the invalidated block */
+	      lat += leave_level(cp, blk, CACHE_MK_BADDR(cp, blk->tag, i),
+				 blk->status, now+lat);
 	    }
 	}
     }
 
+  /* the victim cache and prefetch buffer go too */
+  for (i=0; i < cp->nvc; i++)
+    {
+      if (cp->vc[i].valid)
+	{
+	  cp->invalidations++;
+	  cp->vc[i].valid = FALSE;
+	  lat += leave_level(cp, NULL, cp->vc[i].baddr, cp->vc[i].status,
+			     now+lat);
+	}
+    }
+  for (i=0; i < cp->pf_nbuf; i++)
+    cp->pf_buf[i].valid = FALSE;
+
   /* return latency of the flush operation */
   return lat;
 }
@@ -809,52 +2064,33 @@ cache_flush_addr(struct cache_t *cp,	/* cache instance to flush */
   md_addr_t tag = CACHE_TAG(cp, addr);
   md_addr_t set = CACHE_SET(cp, addr);
   struct cache_blk_t *blk;
-  int lat = cp->hit_latency; /* min latency to probe cache */
-
-  if (cp->hsize)
-    {
-      /* higly-associativity cache, access through the per-set hash tables */
-      int hindex = CACHE_HASH(cp, tag);
+  struct cache_vc_t *vent;
+  int way, lat = cp->hit_latency; /* min latency to probe cache */
 
-      for (blk=cp->sets[set].hash[hindex];
-	   blk;
-	   blk=blk->hash_next)
-	{
-	  if (blk->tag == tag && (blk->status & CACHE_BLK_VALID))
-	    break;
-	}
-    }
-  else
-    {
-      /* low-associativity cache, linear search the way list */
-      for (blk=cp->sets[set].way_head;
-	   blk;
-	   blk=blk->way_next)
-	{
-	  if (blk->tag == tag && (blk->status & CACHE_BLK_VALID))
-	    break;
-	}
-    }
-
-  if (blk)
+  way = find_way(cp, CACHE_TAGS(cp, set), tag);
+  if (way >= 0)
     {
+      blk = CACHE_SET_BLK(cp, set, way);
       cp->invalidations++;
       blk->status &= ~CACHE_BLK_VALID;
+      CACHE_TAGS(cp, set)[way] = 0;
 
       /* blow away the last block to hit */
-      cp->last_tagset = 0;
+      cp->last_tagset = NO_TAGSET;
       cp->last_blk = NULL;
 
-      if (blk->status & CACHE_BLK_DIRTY)
-	{
-	  /* write back the invalidated block */
-          cp->writebacks++;
-	  lat += cp->blk_access_fn(Write,
-				   CACHE_MK_BADDR(cp, blk->tag, set),
-				   cp->bsize, blk, now+lat);
-	}
-      /* move this block to tail of the way (LRU) list */
-      update_way_list(&cp->sets[set], blk, Tail);
+      /* write back the invalidated block */
+      lat += leave_level(cp, blk, CACHE_MK_BADDR(cp, blk->tag, set),
+			 blk->status, now+lat);
+
+      /* make this the next way to replace */
+      demote_way(cp, CACHE_STAMPS(cp, set), way);
+    }
+  else if (cp->nvc && (vent = vc_lookup(cp, CACHE_BADDR(cp, addr))) != NULL)
+    {
+      cp->invalidations++;
+      vent->valid = FALSE;
+      lat += leave_level(cp, NULL, vent->baddr, vent->status, now+lat);
     }
 
   /* return latency of the operation */
@@ -59,6 +59,7 @@
 #include "machine.h"
 #include "memory.h"
 #include "stats.h"
+#include "prefetch.h"
 
 /*
  * This module contains code to implement various cache-like structures.  The
@@ -78,9 +79,38 @@
  * physical page address information, etc...
  *
  * The caches implemented by this module provide efficient storage management
- * and fast access for all cache geometries.  When sets become highly
- * associative, a hash table (indexed by address) is allocated for each set
- * in the cache.
+ * and fast access for all cache geometries.  The tags of each set are kept
+ * apart from the blocks, packed next to a small vector of stamps that orders
+ * the ways for replacement, so probing a set and updating its replacement
+ * order touches a line or two of host cache rather than a chain of blocks.
+ *
+ * The stamps hold whatever state the replacement policy keeps for each way:
+ * the time of last use (LRU) or fill (FIFO), the node bits of the tree
+ * (PLRU), a 2-bit re-reference prediction value (RRIP), or the position of
+ * the next use of the block in a recorded reference stream (OPT).  OPT needs
+ * to know the future, so an OPT cache replays a reference stream recorded by
+ * an earlier run of the same program with the same cache configuration
+ * upstream, see cache_trace(), and the simulator must see the exact same
+ * stream of references again, i.e., OPT is usable with the functional
+ * simulators only.
+ *
+ * A cache may have a prefetcher attached, see cache_prefetcher().  Each
+ * demand access trains it, and the blocks it predicts are read through the
+ * block access function like misses, as long as a bus slot and an MSHR (if
+ * the cache has any) are free, either straight into the cache or into a
+ * small fully-associative prefetch buffer beside it, from which a demand miss
+ * moves the block into the cache.
+ *
+ * A cache may also have a small fully-associative victim cache, see
+ * cache_victims(), that catches the blocks the cache replaces.  A miss that
+ * finds its block there swaps it back in, a block that falls out of the
+ * victim cache leaves the cache level for good.
+ *
+ * Levels of a hierarchy are non-inclusive unless linked with
+ * cache_inclusion(): an inclusive level takes every block that leaves it out
+ * of the levels above it as well (counted as invalidations up there), an
+ * exclusive level hands the blocks the levels above read up to them without
+ * keeping a copy, and takes the blocks they replace, clean or dirty.
  *
  * This module also tracks latency of accessing the data cache, each cache has
  * a hit latency defined when instantiated, miss latency is returned by the
@@ -94,31 +124,54 @@
  * reordering of requests in the memory hierarchy is not possible.
  */
 
-/* highly associative caches are implemented using a hash table lookup to
-   speed block access, this macro decides if a cache is "highly associative" */
-#define CACHE_HIGHLY_ASSOC(cp)	((cp)->assoc > 4)
-
 /* cache replacement policy */
 enum cache_policy {
   LRU,		/* replace least recently used block (perfect LRU) */
   Random,	/* replace a random block */
-  FIFO		/* replace the oldest block in the set */
+  FIFO,		/* replace the oldest block in the set */
+  PLRU,		/* replace the block a binary tree of use bits points at */
+  SRRIP,	/* static re-reference interval prediction (RRIP) */
+  BRRIP,	/* bimodal RRIP, most fills are predicted distant */
+  DRRIP,	/* SRRIP or BRRIP, whichever misses less in its leader sets,
+		   needs 4 sets or more */
+  OPT		/* replace the block used farthest in the future (Belady),
+		   replays a reference stream recorded by an earlier run */
 };
 
+/* inclusion of the levels above a cache in it */
+enum cache_inclusion {
+  NonInclusive,	/* a block may be in either level, or both */
+  Inclusive,	/* every block above is also here, a block that leaves this
+		   level is invalidated above */
+  Exclusive	/* a block is in one level only, reads from above move blocks
+		   up, blocks replaced above move down */
+};
+
+/* most levels one cache may be below */
+#define CACHE_MAX_UPPERS	2
+
 /* block status values */
 #define CACHE_BLK_VALID		0x00000001	/* block in valid, in use */
 #define CACHE_BLK_DIRTY		0x00000002	/* dirty block */
+#define CACHE_BLK_PREFETCHED	0x00000004	/* prefetched, not used yet */
+
+/* cache features, each takes extra work on the access path, a cache with
+   none of them set in its FEATURES takes the plain hit and miss paths */
+#define CACHE_FEAT_TRACE	0x00000001	/* references traced */
+#define CACHE_FEAT_MSHRS	0x00000002	/* limited number of MSHRs */
+#define CACHE_FEAT_PREFETCH	0x00000004	/* prefetcher attached */
+#define CACHE_FEAT_VICTIMS	0x00000008	/* victim cache attached */
+#define CACHE_FEAT_INCL	0x00000010	/* inclusive of levels above */
+#define CACHE_FEAT_EXCL	0x00000020	/* exclusive of levels above */
+#define CACHE_FEAT_LOWER_EXCL	0x00000040	/* level below is exclusive */
+
+/* packed tag valid bit, tags are shifted down by at least the block offset,
+   so the top bit of a tag is always free to mark a valid way */
+#define CACHE_TAG_VALID		((md_addr_t)1 << (sizeof(md_addr_t)*8 - 1))
 
 /* cache block (or line) definition */
 struct cache_blk_t
 {
-  struct cache_blk_t *way_next;	/* next block in the ordered way chain, used
-				   to order blocks for replacement */
-  struct cache_blk_t *way_prev;	/* previous block in the order way chain */
-  struct cache_blk_t *hash_next;/* next block in the hash bucket chain, only
-				   used in highly-associative caches */
-  /* since hash table lists are typically small, there is no previous
-     pointer, deletion requires a trip through the hash table bucket list */
   md_addr_t tag;		/* data block tag value */
   unsigned int status;		/* block status, see CACHE_BLK_* defs above */
   tick_t ready;		/* time when block will be accessible, field
@@ -132,16 +185,30 @@ struct cache_blk_t
 				   should probably be a multiple of 8 */
 };
 
-/* cache set definition (one or more blocks sharing the same set index) */
-struct cache_set_t
+/* miss status holding register (MSHR), tracks one outstanding fill */
+struct cache_mshr_t
 {
-  struct cache_blk_t **hash;	/* hash table: for fast access w/assoc, NULL
-				   for low-assoc caches */
-  struct cache_blk_t *way_head;	/* head of way list */
-  struct cache_blk_t *way_tail;	/* tail pf way list */
-  struct cache_blk_t *blks;	/* cache blocks, allocated sequentially, so
-				   this pointer can also be used for random
-				   access to cache blocks */
+  md_addr_t baddr;		/* block being filled */
+  tick_t ready;			/* time when the fill completes, the MSHR is
+				   free from then on */
+};
+
+/* prefetch buffer entry */
+struct cache_pbuf_t
+{
+  int valid;			/* entry in use? */
+  md_addr_t baddr;		/* block prefetched */
+  tick_t ready;			/* time when the prefetch completes */
+};
+
+/* victim cache entry */
+struct cache_vc_t
+{
+  int valid;			/* entry in use? */
+  md_addr_t baddr;		/* block replaced into it */
+  unsigned int status;		/* block status, see CACHE_BLK_* defs above */
+  tick_t ready;			/* time when the block is accessible */
+  counter_t stamp;		/* time of insertion, for LRU replacement */
 };
 
 /* cache definition */
@@ -174,7 +241,6 @@ struct cache_t
 		     tick_t now);		/* when fetch was initiated */
 
   /* derived data, for fast decoding */
-  int hsize;			/* cache set hash table size */
   md_addr_t blk_mask;
   int set_shift;
   md_addr_t set_mask;		/* use *after* shift */
@@ -203,12 +269,88 @@ struct cache_t
   md_addr_t last_tagset;	/* tag of last line accessed */
   struct cache_blk_t *last_blk;	/* cache block last accessed */
 
+  /* features in use, CACHE_FEAT_* bits, kept up to date by the functions
+     that attach them, so an access tests them all at once */
+  unsigned int features;
+
   /* data blocks */
   byte_t *data;			/* pointer to data blocks allocation */
 
-  /* NOTE: this is a variable-size tail array, this must be the LAST field
-     defined in this structure! */
-  struct cache_set_t sets[1];	/* each entry is a set */
+  /* packed tags and stamps, one slot per set holds the tags of its ways,
+     the tag of a valid way or'ed with CACHE_TAG_VALID, followed by their
+     replacement stamps, the way with the lowest stamp is the next one to
+     replace, a use (or fill) restamps a way */
+  byte_t *tag_data;		/* pointer to tags and stamps allocation */
+  byte_t *tags;			/* first slot, aligned to a host cache line */
+  int slot_shift;		/* log2 of the slot size in bytes */
+  word_t stamp;			/* last replacement stamp handed out */
+
+  /* RRIP state, DRRIP duels SRRIP against BRRIP in the sets whose index
+     bits under DUEL_MASK are all clear or all set (the leader sets, 32 for
+     each, or a quarter of the sets in caches with fewer than 128), the
+     followers insert with whichever policy PSEL says misses less */
+  md_addr_t duel_mask;		/* picks out the leader sets */
+  int psel;			/* policy selector, counts up on SRRIP leader
+				   misses and down on BRRIP leader misses */
+  word_t bip_count;		/* BRRIP fills, every BIP_EPSILON'th is long */
+
+  /* recorded reference stream, see cache_trace(), a cache records the block
+     address of every reference that is not to the same block as the one
+     before it, an OPT cache replays the stream to find the next use of
+     each block */
+  int traced;			/* recording or replaying a stream? */
+  FILE *trace_fd;		/* stream being recorded */
+  md_addr_t *trace_addrs;	/* block addresses being replayed */
+  word_t *trace_next;		/* position of the next use of each */
+  word_t trace_len;		/* number of references replayed */
+  word_t trace_pos;		/* next reference to replay */
+  md_addr_t trace_last;		/* last block address recorded/replayed */
+  word_t next_use;		/* next use of the block accessed last */
+
+  /* miss status holding registers, see cache_mshrs(), without them any
+     number of misses may be outstanding */
+  int nmshrs;			/* number of MSHRs, 0 for unlimited */
+  struct cache_mshr_t *mshrs;	/* MSHR file */
+  counter_t mshr_merges;	/* secondary misses merged onto an MSHR */
+  counter_t mshr_full;		/* primary misses that waited for an MSHR */
+
+  /* prefetcher, see cache_prefetcher(), prefetched blocks go into the
+     prefetch buffer, if the cache has one, or else straight into the cache
+     marked CACHE_BLK_PREFETCHED until their first use */
+  struct prefetch_t *pf;	/* prefetcher, NULL if none */
+  md_addr_t pc;			/* PC of the next access, set by the
+				   simulator for PC-indexed prefetchers */
+  int demand;			/* is the next access a demand access, not a
+				   writeback or prefetch fill of the level
+				   above? set by the simulator with PC, only
+				   demand accesses train the prefetcher */
+  int pf_reading;		/* reading a prefetched block from the level
+				   below? tells the simulator to clear DEMAND
+				   there */
+  int pf_nbuf;			/* prefetch buffer entries, 0 for none */
+  struct cache_pbuf_t *pf_buf;	/* prefetch buffer, FIFO replacement */
+  int pf_next;			/* next prefetch buffer entry to replace */
+  md_addr_t *pf_evicted;	/* blocks prefetches evicted, or'ed with 1,
+				   hashed by block address */
+  counter_t pf_issued;		/* prefetches sent to the next level */
+  counter_t pf_useful;		/* prefetched blocks used by the program */
+  counter_t pf_late;		/* used while still on their way */
+  counter_t pf_pollution;	/* misses on blocks prefetches evicted */
+  double pf_accuracy;		/* pf_useful/pf_issued, kept as they count,
+				   0 until the first prefetch is issued */
+
+  /* victim cache, see cache_victims(), hits in it count as hits */
+  int nvc;			/* victim cache entries, 0 for none */
+  struct cache_vc_t *vc;	/* victim cache entries */
+  counter_t vc_stamp;		/* last victim cache stamp handed out */
+  counter_t vc_hits;		/* misses that found their block in it */
+
+  /* inclusion, see cache_inclusion() */
+  enum cache_inclusion inclusion;	/* of the levels above in this one */
+  int nuppers;				/* number of levels above */
+  struct cache_t *uppers[CACHE_MAX_UPPERS];/* levels above */
+  struct cache_t *lower;		/* level below, if linked */
+  int moved_dirty;			/* block last handed up was dirty */
 };
 
 /* create and initialize a general cache structure */
@@ -231,6 +373,54 @@ cache_create(char *name,		/* name of the cache */
 enum cache_policy			/* replacement policy enum */
 cache_char2policy(char c);		/* replacement policy as a char */
 
+/* record the reference stream of cache CP to file <PREFIX>.<name>, or if CP
+   uses OPT replacement, read back the stream recorded there, a run with an
+   OPT cache must make the same references to it as the recording run did,
+   it stops with an error when the streams diverge */
+void
+cache_trace(struct cache_t *cp,		/* cache instance */
+	    char *prefix);		/* stream file name prefix */
+
+/* give cache CP NMSHRS miss status holding registers, a primary miss holds
+   one until its fill completes, a miss to a block still being filled is a
+   secondary miss and merges onto the MSHR filling it, and a primary miss
+   that finds all of them busy waits for the first to free up */
+void
+cache_mshrs(struct cache_t *cp,		/* cache instance */
+	    int nmshrs);		/* number of MSHRs, 0 for unlimited */
+
+/* non-zero if an access to ADDR at NOW would be a primary miss in cache CP
+   and find all of its MSHRs busy, lets a pipeline hold the access back
+   rather than have cache_access() charge the wait */
+int					/* non-zero if the access would stall */
+cache_mshr_busy(struct cache_t *cp,	/* cache instance */
+		md_addr_t addr,		/* address of access */
+		tick_t now);		/* time of access */
+
+/* attach prefetcher PF to cache CP, the blocks it predicts go into a
+   prefetch buffer with NBUF entries, or if NBUF is zero, straight into the
+   cache */
+void
+cache_prefetcher(struct cache_t *cp,	/* cache instance */
+		 struct prefetch_t *pf,	/* prefetcher to attach */
+		 int nbuf);		/* prefetch buffer entries, or 0 */
+
+/* give cache CP a fully-associative victim cache with NVC entries */
+void
+cache_victims(struct cache_t *cp,	/* cache instance */
+	      int nvc);			/* victim cache entries */
+
+/* parse inclusion policy */
+enum cache_inclusion			/* inclusion policy enum */
+cache_char2inclusion(char c);		/* inclusion policy as a char */
+
+/* make cache CP the level below cache UPPER, with inclusion policy
+   INCLUSION, UPPER's misses must go to CP */
+void
+cache_inclusion(struct cache_t *cp,	/* cache instance */
+		enum cache_inclusion inclusion,/* inclusion policy */
+		struct cache_t *upper);	/* level above it */
+
 /* print cache configuration */
 void
 cache_config(struct cache_t *cp,	/* cache instance */
@@ -0,0 +1,517 @@
+/* dram.c - DRAM controller model routines */
+
+/* SimpleScalar(TM) Tool Suite
+ * Copyright (C) 1994-2003 by Todd M. Austin, Ph.D. and SimpleScalar, LLC.
+ * All Rights Reserved. 
+ * 
+ * THIS IS A LEGAL DOCUMENT, BY USING SIMPLESCALAR,
+ * YOU ARE AGREEING TO THESE TERMS AND CONDITIONS.
+ * 
+ * No portion of this work may be used by any commercial entity, or for any
+ * commercial purpose, without the prior, written permission of SimpleScalar,
+ * LLC (info@simplescalar.com). Nonprofit and noncommercial use is permitted
+ * as described below.
+ * 
+ * 1. SimpleScalar is provided AS IS, with no warranty of any kind, express
+ * or implied. The user of the program accepts full responsibility for the
+ * application of the program and the use of any results.
+ * 
+ * 2. Nonprofit and noncommercial use is encouraged. SimpleScalar may be
+ * downloaded, compiled, executed, copied, and modified solely for nonprofit,
+ * educational, noncommercial research, and noncommercial scholarship
+ * purposes provided that this notice in its entirety accompanies all copies.
+ * Copies of the modified software can be delivered to persons who use it
+ * solely for nonprofit, educational, noncommercial research, and
+ * noncommercial scholarship purposes provided that this notice in its
+ * entirety accompanies all copies.
+ * 
+ * 3. ALL COMMERCIAL USE, AND ALL USE BY FOR PROFIT ENTITIES, IS EXPRESSLY
+ * PROHIBITED WITHOUT A LICENSE FROM SIMPLESCALAR, LLC (info@simplescalar.com).
+ * 
+ * 4. No nonprofit user may place any restrictions on the use of this software,
+ * including as modified by the user, by any other authorized user.
+ * 
+ * 5. Noncommercial and nonprofit users may distribute copies of SimpleScalar
+ * in compiled or executable form as set forth in Section 2, provided that
+ * either: (A) it is accompanied by the corresponding machine-readable source
+ * code, or (B) it is accompanied by a written offer, with no time limit, to
+ * give anyone a machine-readable copy of the corresponding source code in
+ * return for reimbursement of the cost of distribution. This written offer
+ * must permit verbatim duplication by anyone, or (C) it is distributed by
+ * someone who received only the executable form, and is accompanied by a
+ * copy of the written offer of source code.
+ * 
+ * 6. SimpleScalar was developed by Todd M. Austin, Ph.D. The tool suite is
+ * currently maintained by SimpleScalar LLC (info@simplescalar.com). US Mail:
+ * 2395 Timbercrest Court, Ann Arbor, MI 48105.
+ * 
+ * Copyright (C) 1994-2003 by Todd M. Austin, Ph.D. and SimpleScalar, LLC.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "host.h"
+#include "misc.h"
+#include "machine.h"
+#include "dram.h"
+
+/* a cycle no simulation reaches */
+#define DRAM_NEVER		((tick_t)1e18)
+
+/* what chan_step() issued */
+#define ISSUED_NONE		0	/* no command could issue */
+#define ISSUED_ROW		1	/* an activate or precharge */
+#define ISSUED_COLUMN		2	/* a column access, a request is done */
+
+/* allocate the queue and banks of channel CH, all banks precharged */
+static void
+chan_alloc(struct dram_t *dram,			/* DRAM of the channel */
+	   struct dram_chan_t *ch)		/* channel to allocate */
+{
+  int i;
+
+  ch->now = 0;
+  ch->bus_free = 0;
+  ch->nqueued = 0;
+  ch->queue = (struct dram_req_t *)
+    calloc(dram->queue_size, sizeof(struct dram_req_t));
+  ch->banks = (struct dram_bank_t *)
+    calloc(dram->nranks * dram->nbanks, sizeof(struct dram_bank_t));
+  if (!ch->queue || !ch->banks)
+    fatal("out of virtual memory");
+
+  for (i=0; i < dram->nranks * dram->nbanks; i++)
+    {
+      ch->banks[i].closed = TRUE;
+      ch->banks[i].open_row = 0;
+      ch->banks[i].ready = 0;
+      ch->banks[i].act_time = 0;
+      ch->banks[i].busy_until = 0;
+    }
+}
+
+/* copy the state of channel SRC to DST */
+static void
+chan_copy(struct dram_t *dram,			/* DRAM of the channels */
+	  struct dram_chan_t *dst,		/* channel to copy to */
+	  struct dram_chan_t *src)		/* channel to copy */
+{
+  dst->now = src->now;
+  dst->bus_free = src->bus_free;
+  dst->nqueued = src->nqueued;
+  memcpy(dst->queue, src->queue, src->nqueued * sizeof(struct dram_req_t));
+  memcpy(dst->banks, src->banks,
+	 dram->nranks * dram->nbanks * sizeof(struct dram_bank_t));
+}
+
+/* non-zero if a request queued on channel CH wants row ROW of bank BANK,
+   FR-FCFS does not close a row that queued requests hit in */
+static int
+row_wanted(struct dram_chan_t *ch,		/* channel to search */
+	   int bank,				/* bank of the row */
+	   md_addr_t row)			/* row to look for */
+{
+  int i;
+
+  for (i=0; i < ch->nqueued; i++)
+    {
+      if (ch->queue[i].bank == bank && ch->queue[i].row == row)
+	return TRUE;
+    }
+  return FALSE;
+}
+
+/* issue the command FR-FCFS picks for channel CH at cycle CH->NOW, if any
+   can issue, a column access finishes a request, which leaves the queue
+   with its number in *SEQ and the cycle its data is done in *DONE, stats
+   are only updated for the real channels (REAL) */
+static int					/* what was issued */
+chan_step(struct dram_t *dram,			/* DRAM of the channel */
+	  struct dram_chan_t *ch,		/* channel to issue for */
+	  int real,				/* one of the real channels? */
+	  counter_t *seq,			/* for number of done request */
+	  tick_t *done)				/* for when its data is done */
+{
+  int i, row_cmd = -1;
+  tick_t now = ch->now;
+  struct dram_req_t *req;
+  struct dram_bank_t *bank;
+
+  /* find the oldest ready column access, or else the oldest request whose
+     bank can be activated or precharged */
+  for (i=0; i < ch->nqueued; i++)
+    {
+      req = &ch->queue[i];
+      bank = &ch->banks[req->bank];
+      if (bank->ready > now)
+	continue;
+
+      if (!bank->closed && bank->open_row == req->row)
+	{
+	  /* a row buffer hit, it can go if the data bus is free by the time
+	     the data comes out */
+	  if (ch->bus_free <= now + dram->t_cas)
+	    break;
+	}
+      else if (row_cmd < 0
+	       && (bank->closed
+		   || (now >= bank->act_time + dram->t_ras
+		       && !row_wanted(ch, req->bank, bank->open_row))))
+	row_cmd = i;
+    }
+
+  if (i < ch->nqueued)
+    {
+      /* column access, the request is done once its data is out */
+      req = &ch->queue[i];
+      bank = &ch->banks[req->bank];
+      if (req->kind == RowUnknown)
+	req->kind = RowHit;
+
+      *seq = req->seq;
+      *done = now + dram->t_cas + req->burst;
+      ch->bus_free = *done;
+      bank->ready = now + req->burst;
+      if (dram->page == ClosedPage)
+	{
+	  /* precharge once the data is out and the row was open long
+	     enough */
+	  bank->closed = TRUE;
+	  bank->ready = MAX(*done, bank->act_time + dram->t_ras) + dram->t_rp;
+	}
+      bank->busy_until = MAX(bank->busy_until, MAX(*done, bank->ready));
+
+      if (real)
+	{
+	  switch (req->kind) {
+	  case RowHit: dram->row_hits++; break;
+	  case RowMiss: dram->row_misses++; break;
+	  case RowConflict: dram->row_conflicts++; break;
+	  default: panic("bogus row buffer outcome");
+	  }
+	  dram->bus_busy += req->burst;
+	  if (*done > req->promised)
+	    dram->late_reads++;
+	}
+
+      /* the request leaves the queue */
+      ch->nqueued--;
+      memmove(req, req + 1, (ch->nqueued - i) * sizeof(struct dram_req_t));
+      return ISSUED_COLUMN;
+    }
+  else if (row_cmd >= 0)
+    {
+      req = &ch->queue[row_cmd];
+      bank = &ch->banks[req->bank];
+      if (bank->closed)
+	{
+	  /* activate the request's row */
+	  if (req->kind == RowUnknown)
+	    req->kind = RowMiss;
+	  bank->closed = FALSE;
+	  bank->open_row = req->row;
+	  bank->act_time = now;
+	  bank->ready = now + dram->t_rcd;
+	}
+      else
+	{
+	  /* precharge the bank, closing the row in the way */
+	  if (req->kind == RowUnknown)
+	    req->kind = RowConflict;
+	  bank->closed = TRUE;
+	  bank->ready = now + dram->t_rp;
+	}
+      bank->busy_until = MAX(bank->busy_until, bank->ready);
+      return ISSUED_ROW;
+    }
+  return ISSUED_NONE;
+}
+
+/* return the first cycle after CH->NOW at which a command might issue on
+   channel CH, when one could not issue at CH->NOW */
+static tick_t					/* next cycle to try */
+chan_next(struct dram_t *dram,			/* DRAM of the channel */
+	  struct dram_chan_t *ch)		/* channel to search */
+{
+  int i;
+  tick_t t, next = DRAM_NEVER;
+  struct dram_req_t *req;
+  struct dram_bank_t *bank;
+
+  for (i=0; i < ch->nqueued; i++)
+    {
+      req = &ch->queue[i];
+      bank = &ch->banks[req->bank];
+      t = bank->ready;
+      if (!bank->closed && bank->open_row == req->row)
+	{
+	  /* waits for the data bus */
+	  t = MAX(t, ch->bus_free - dram->t_cas);
+	}
+      else if (!bank->closed)
+	{
+	  /* waits for the row hits ahead of it, or for the row to have been
+	     open long enough */
+	  if (row_wanted(ch, req->bank, bank->open_row))
+	    continue;
+	  t = MAX(t, bank->act_time + dram->t_ras);
+	}
+      next = MIN(next, t);
+    }
+  return MAX(next, ch->now + 1);
+}
+
+/* account the bank activity of channel CH from CH->NOW up to NEXT */
+static void
+chan_account(struct dram_t *dram,		/* DRAM of the channel */
+	     struct dram_chan_t *ch,		/* channel to account */
+	     tick_t next)			/* end of the interval */
+{
+  int i;
+  tick_t t, any = 0;
+
+  /* every operation underway started by CH->NOW, so the banks busy at any
+     point of the interval are busy from its start */
+  for (i=0; i < dram->nranks * dram->nbanks; i++)
+    {
+      t = MIN(ch->banks[i].busy_until, next) - ch->now;
+      if (t > 0)
+	{
+	  dram->bank_busy += t;
+	  any = MAX(any, t);
+	}
+    }
+  dram->busy += any;
+}
+
+/* issue a command on channel CH at CH->NOW, if one can issue, and move on
+   to the next cycle one might, but no later than LIMIT */
+static int					/* what was issued */
+chan_tick(struct dram_t *dram,			/* DRAM of the channel */
+	  struct dram_chan_t *ch,		/* channel to run */
+	  int real,				/* one of the real channels? */
+	  tick_t limit,				/* cycle to stop at */
+	  counter_t *seq,			/* for number of done request */
+	  tick_t *done)				/* for when its data is done */
+{
+  int issued;
+  tick_t next;
+
+  issued = chan_step(dram, ch, real, seq, done);
+
+  /* one command per cycle */
+  next = issued != ISSUED_NONE ? ch->now + 1 : chan_next(dram, ch);
+  next = MIN(next, limit);
+  if (real)
+    chan_account(dram, ch, next);
+  ch->now = next;
+  return issued;
+}
+
+/* create a DRAM with NCHANNELS channels of NRANKS ranks of NBANKS banks
+   with ROW_SIZE byte rows */
+struct dram_t *				/* pointer to DRAM created */
+dram_create(int nchannels,		/* number of channels */
+	    int nranks,			/* ranks per channel */
+	    int nbanks,			/* banks per rank */
+	    int row_size,		/* row size in bytes */
+	    enum dram_page_policy page,	/* row buffer management policy */
+	    int t_rcd,			/* activate to column access */
+	    int t_cas,			/* column access to first data */
+	    int t_rp,			/* precharge to activate */
+	    int t_ras,			/* activate to precharge */
+	    int bus_width,		/* data bus width in bytes */
+	    int xfer_lat,		/* data bus cycles per bus width */
+	    int queue_size)		/* request queue entries per channel */
+{
+  struct dram_t *dram;
+  int i;
+
+  /* check all DRAM parameters */
+  if (nchannels <= 0 || nranks <= 0 || nbanks <= 0)
+    fatal("DRAM channels, ranks and banks must be non-zero and positive");
+  if (row_size <= 0 || (row_size & (row_size-1)) != 0)
+    fatal("DRAM row size `%d' must be a power of two", row_size);
+  if (t_rcd < 1 || t_cas < 1 || t_rp < 1 || t_ras < 1)
+    fatal("DRAM timings must be greater than zero");
+  if (bus_width <= 0 || (bus_width & (bus_width-1)) != 0)
+    fatal("DRAM bus width `%d' must be a power of two", bus_width);
+  if (xfer_lat < 1)
+    fatal("DRAM transfer latency must be greater than zero");
+  if (queue_size < 1)
+    fatal("DRAM queue size must be greater than zero");
+
+  /* allocate the DRAM structure */
+  dram = (struct dram_t *)calloc(1, sizeof(struct dram_t));
+  if (!dram)
+    fatal("out of virtual memory");
+
+  /* initialize user parameters */
+  dram->nchannels = nchannels;
+  dram->nranks = nranks;
+  dram->nbanks = nbanks;
+  dram->row_size = row_size;
+  dram->page = page;
+  dram->t_rcd = t_rcd;
+  dram->t_cas = t_cas;
+  dram->t_rp = t_rp;
+  dram->t_ras = t_ras;
+  dram->bus_width = bus_width;
+  dram->xfer_lat = xfer_lat;
+  dram->queue_size = queue_size;
+
+  /* compute derived parameters */
+  dram->row_shift = log_base2(row_size);
+
+  /* allocate the channels */
+  dram->chans = (struct dram_chan_t *)
+    calloc(nchannels, sizeof(struct dram_chan_t));
+  if (!dram->chans)
+    fatal("out of virtual memory");
+  for (i=0; i < nchannels; i++)
+    chan_alloc(dram, &dram->chans[i]);
+  chan_alloc(dram, &dram->ahead);
+
+  return dram;
+}
+
+/* print DRAM configuration */
+void
+dram_config(struct dram_t *dram,	/* DRAM instance */
+	    FILE *stream)		/* output stream */
+{
+  fprintf(stream,
+	  "dram: %d channels, %d ranks/channel, %d banks/rank, "
+	  "%d byte rows, %s page\n",
+	  dram->nchannels, dram->nranks, dram->nbanks, dram->row_size,
+	  dram->page == OpenPage ? "open" : "closed");
+  fprintf(stream,
+	  "dram: tRCD %d, tCAS %d, tRP %d, tRAS %d, %d byte bus at %d "
+	  "cycles/transfer, %d entry queues\n",
+	  dram->t_rcd, dram->t_cas, dram->t_rp, dram->t_ras,
+	  dram->bus_width, dram->xfer_lat, dram->queue_size);
+}
+
+/* register DRAM stats */
+void
+dram_reg_stats(struct dram_t *dram,	/* DRAM instance */
+	       struct stat_sdb_t *sdb)	/* stats database */
+{
+  char buf[512];
+
+  stat_reg_counter(sdb, "dram.reads", "total number of DRAM reads",
+		   &dram->reads, 0, NULL);
+  stat_reg_counter(sdb, "dram.writes", "total number of DRAM writes",
+		   &dram->writes, 0, NULL);
+  stat_reg_counter(sdb, "dram.row_hits",
+		   "requests that found their row open",
+		   &dram->row_hits, 0, NULL);
+  stat_reg_counter(sdb, "dram.row_misses",
+		   "requests that found their bank precharged",
+		   &dram->row_misses, 0, NULL);
+  stat_reg_counter(sdb, "dram.row_conflicts",
+		   "requests that found another row open",
+		   &dram->row_conflicts, 0, NULL);
+  stat_reg_formula(sdb, "dram.row_hit_rate",
+		   "row buffer hit rate (i.e., hits/request)",
+		   "dram.row_hits / (dram.row_hits + dram.row_misses"
+		   " + dram.row_conflicts)", NULL);
+  stat_reg_counter(sdb, "dram.read_lat",
+		   "total latency of DRAM reads (cycles)",
+		   &dram->read_lat, 0, NULL);
+  stat_reg_formula(sdb, "dram.avg_read_lat",
+		   "average latency of DRAM reads (cycles)",
+		   "dram.read_lat / dram.reads", NULL);
+  stat_reg_counter(sdb, "dram.write_lat",
+		   "total cycles DRAM writes waited for a queue entry",
+		   &dram->write_lat, 0, NULL);
+  stat_reg_counter(sdb, "dram.late_reads",
+		   "reads done later than charged, behind later requests",
+		   &dram->late_reads, 0, NULL);
+  stat_reg_counter(sdb, "dram.queue_full",
+		   "requests that waited for a queue entry",
+		   &dram->queue_full, 0, NULL);
+  stat_reg_counter(sdb, "dram.bank_busy", "cumulative busy bank cycles",
+		   &dram->bank_busy, 0, NULL);
+  stat_reg_counter(sdb, "dram.busy",
+		   "cumulative channel cycles with any bank busy",
+		   &dram->busy, 0, NULL);
+  stat_reg_formula(sdb, "dram.blp",
+		   "bank-level parallelism (i.e., banks busy when any is)",
+		   "dram.bank_busy / dram.busy", NULL);
+  stat_reg_counter(sdb, "dram.bus_busy",
+		   "cumulative data bus busy cycles",
+		   &dram->bus_busy, 0, NULL);
+  sprintf(buf, "dram.bus_busy / (sim_cycle * %d)", dram->nchannels);
+  stat_reg_formula(sdb, "dram.bus_util",
+		   "data bus utilization (i.e., busy cycles/cycle/channel)",
+		   buf, NULL);
+}
+
+/* access DRAM, make a CMD request for the BSIZE bytes at block address BADDR
+   at cycle NOW, returns the latency of a read, or the wait of a write for a
+   queue entry */
+unsigned int				/* latency of access in cycles */
+dram_access(struct dram_t *dram,	/* DRAM to access */
+	    enum mem_cmd cmd,		/* access type, Read or Write */
+	    md_addr_t baddr,		/* block address to access */
+	    int bsize,			/* size of the block */
+	    tick_t now)			/* time of access */
+{
+  md_addr_t rows = baddr >> dram->row_shift;
+  struct dram_chan_t *ch = &dram->chans[rows % dram->nchannels];
+  struct dram_req_t *req;
+  counter_t seq;
+  tick_t done;
+  unsigned int lat;
+
+  /* bring the channel up to the time of the request */
+  while (ch->now < now)
+    chan_tick(dram, ch, /* real */TRUE, now, &seq, &done);
+
+  /* wait for a queue entry */
+  if (ch->nqueued == dram->queue_size)
+    {
+      dram->queue_full++;
+      while (ch->nqueued == dram->queue_size)
+	chan_tick(dram, ch, /* real */TRUE, DRAM_NEVER, &seq, &done);
+    }
+
+  /* queue the request */
+  rows /= dram->nchannels;
+  req = &ch->queue[ch->nqueued++];
+  req->cmd = cmd;
+  req->bank = rows % (dram->nranks * dram->nbanks);
+  req->row = rows / (dram->nranks * dram->nbanks);
+  req->burst = ((bsize + dram->bus_width - 1) / dram->bus_width)
+    * dram->xfer_lat;
+  req->kind = RowUnknown;
+  req->arrive = ch->now;
+  req->promised = DRAM_NEVER;
+  req->seq = dram->seq++;
+
+  /* the queue is the write buffer, a write costs only the wait for it */
+  if (cmd == Write)
+    {
+      lat = ch->now - now;
+      dram->writes++;
+      dram->write_lat += lat;
+      return lat;
+    }
+
+  /* play a copy of the channel forward until the read is done */
+  chan_copy(dram, &dram->ahead, ch);
+  while (chan_tick(dram, &dram->ahead, /* !real */FALSE, DRAM_NEVER,
+		   &seq, &done) != ISSUED_COLUMN
+	 || seq != req->seq)
+    /* nada */;
+
+  req->promised = done;
+  lat = done - now;
+  dram->reads++;
+  dram->read_lat += lat;
+  return lat;
+}
@@ -0,0 +1,216 @@
+/* dram.h - DRAM controller model interfaces */
+
+/* SimpleScalar(TM) Tool Suite
+ * Copyright (C) 1994-2003 by Todd M. Austin, Ph.D. and SimpleScalar, LLC.
+ * All Rights Reserved. 
+ * 
+ * THIS IS A LEGAL DOCUMENT, BY USING SIMPLESCALAR,
+ * YOU ARE AGREEING TO THESE TERMS AND CONDITIONS.
+ * 
+ * No portion of this work may be used by any commercial entity, or for any
+ * commercial purpose, without the prior, written permission of SimpleScalar,
+ * LLC (info@simplescalar.com). Nonprofit and noncommercial use is permitted
+ * as described below.
+ * 
+ * 1. SimpleScalar is provided AS IS, with no warranty of any kind, express
+ * or implied. The user of the program accepts full responsibility for the
+ * application of the program and the use of any results.
+ * 
+ * 2. Nonprofit and noncommercial use is encouraged. SimpleScalar may be
+ * downloaded, compiled, executed, copied, and modified solely for nonprofit,
+ * educational, noncommercial research, and noncommercial scholarship
+ * purposes provided that this notice in its entirety accompanies all copies.
+ * Copies of the modified software can be delivered to persons who use it
+ * solely for nonprofit, educational, noncommercial research, and
+ * noncommercial scholarship purposes provided that this notice in its
+ * entirety accompanies all copies.
+ * 
+ * 3. ALL COMMERCIAL USE, AND ALL USE BY FOR PROFIT ENTITIES, IS EXPRESSLY
+ * PROHIBITED WITHOUT A LICENSE FROM SIMPLESCALAR, LLC (info@simplescalar.com).
+ * 
+ * 4. No nonprofit user may place any restrictions on the use of this software,
+ * including as modified by the user, by any other authorized user.
+ * 
+ * 5. Noncommercial and nonprofit users may distribute copies of SimpleScalar
+ * in compiled or executable form as set forth in Section 2, provided that
+ * either: (A) it is accompanied by the corresponding machine-readable source
+ * code, or (B) it is accompanied by a written offer, with no time limit, to
+ * give anyone a machine-readable copy of the corresponding source code in
+ * return for reimbursement of the cost of distribution. This written offer
+ * must permit verbatim duplication by anyone, or (C) it is distributed by
+ * someone who received only the executable form, and is accompanied by a
+ * copy of the written offer of source code.
+ * 
+ * 6. SimpleScalar was developed by Todd M. Austin, Ph.D. The tool suite is
+ * currently maintained by SimpleScalar LLC (info@simplescalar.com). US Mail:
+ * 2395 Timbercrest Court, Ann Arbor, MI 48105.
+ * 
+ * Copyright (C) 1994-2003 by Todd M. Austin, Ph.D. and SimpleScalar, LLC.
+ */
+
+
+#ifndef DRAM_H
+#define DRAM_H
+
+#include <stdio.h>
+
+#include "host.h"
+#include "misc.h"
+#include "machine.h"
+#include "memory.h"
+#include "stats.h"
+
+/*
+ * This module models the DRAM behind the last level of cache.  The memory
+ * is split into independent channels, each with its own data bus, command
+ * bus and request queue, and a number of ranks of banks, each bank with one
+ * row buffer.  The controller of a channel issues at most one command per
+ * cycle and picks requests first-ready first-come-first-served (FR-FCFS):
+ * the oldest queued request whose column access can go now (i.e., whose row
+ * is in its bank's row buffer) goes first, otherwise the oldest request that
+ * needs its bank activated or precharged.  Under the open page policy a row
+ * stays open until a request for another row of the bank closes it, under
+ * the closed page policy every column access precharges its bank.
+ *
+ * Addresses map row:rank:bank:channel:column, i.e., consecutive rows of
+ * addresses go to consecutive channels, then banks, then ranks.  All times
+ * are in CPU cycles; a column access holds the data bus of its channel for
+ * one transfer time per bus width of data, which bounds the bandwidth.
+ *
+ * The controller runs from event to event, jumping over the cycles in which
+ * no command can issue.  Like the cache module it must return the latency of
+ * a read when the read is made, so it brings the channel up to the time of
+ * the read, queues it, and plays a copy of the channel forward until the
+ * read's data is back, i.e., as if no other request came along.  Later
+ * requests then compete with the read in the channel itself, so row buffer
+ * hits, conflicts and bandwidth reflect the FR-FCFS order, but the latency
+ * charged to a read never includes a later request scheduled ahead of it,
+ * the late_reads stat counts the reads this happens to.  Writes are queued
+ * like reads, the request queue doubles as a bounded write buffer: a write
+ * takes no time unless the queue of its channel is full, then it costs the
+ * wait for an entry.
+ */
+
+/* row buffer management policy */
+enum dram_page_policy {
+  OpenPage,		/* leave a row open until another row needs the bank */
+  ClosedPage		/* precharge the bank after every column access */
+};
+
+/* what a request found in its bank's row buffer */
+enum dram_row_kind {
+  RowUnknown = -1,	/* no command issued for the request yet */
+  RowHit,		/* its row was open */
+  RowMiss,		/* the bank was precharged, needed an activate */
+  RowConflict		/* another row was open, needed a precharge too */
+};
+
+/* queued DRAM request */
+struct dram_req_t
+{
+  enum mem_cmd cmd;		/* Read or Write */
+  int bank;			/* bank within the channel, rank-major */
+  md_addr_t row;		/* row within the bank */
+  int burst;			/* data bus cycles of the transfer */
+  enum dram_row_kind kind;	/* what the request found */
+  tick_t arrive;		/* cycle the request was queued */
+  tick_t promised;		/* completion charged to a read */
+  counter_t seq;		/* request number, in arrival order */
+};
+
+/* DRAM bank, with its row buffer */
+struct dram_bank_t
+{
+  md_addr_t open_row;		/* row in the row buffer, if !closed */
+  int closed;			/* bank precharged, no row open? */
+  tick_t ready;			/* first cycle the bank takes a command */
+  tick_t act_time;		/* cycle of the last activate */
+  tick_t busy_until;		/* end of the last operation underway */
+};
+
+/* DRAM channel and its controller */
+struct dram_chan_t
+{
+  tick_t now;			/* cycle the controller is at */
+  tick_t bus_free;		/* first cycle the data bus is free */
+  int nqueued;			/* number of queued requests */
+  struct dram_req_t *queue;	/* queued requests, oldest first */
+  struct dram_bank_t *banks;	/* banks, rank-major */
+};
+
+/* DRAM definition */
+struct dram_t
+{
+  /* parameters */
+  int nchannels;		/* number of channels */
+  int nranks;			/* ranks per channel */
+  int nbanks;			/* banks per rank */
+  int row_size;			/* row size in bytes */
+  enum dram_page_policy page;	/* row buffer management policy */
+  int t_rcd;			/* activate to column access */
+  int t_cas;			/* column access to first data */
+  int t_rp;			/* precharge to activate */
+  int t_ras;			/* activate to precharge */
+  int bus_width;		/* data bus width in bytes */
+  int xfer_lat;			/* data bus cycles per bus width of data */
+  int queue_size;		/* request queue entries per channel */
+
+  /* derived data, for fast decoding */
+  int row_shift;		/* log2 of the row size */
+
+  /* channels, and a scratch channel to play forward */
+  struct dram_chan_t *chans;
+  struct dram_chan_t ahead;
+  counter_t seq;		/* requests made */
+
+  /* stats */
+  counter_t reads;		/* reads made */
+  counter_t writes;		/* writes made */
+  counter_t row_hits;		/* requests that found their row open */
+  counter_t row_misses;		/* requests that found their bank closed */
+  counter_t row_conflicts;	/* requests that found another row open */
+  counter_t read_lat;		/* total latency charged to reads */
+  counter_t write_lat;		/* total wait of writes for a queue entry */
+  counter_t late_reads;		/* reads done later than charged */
+  counter_t queue_full;		/* requests that waited for a queue entry */
+  counter_t bank_busy;		/* cumulative busy bank cycles */
+  counter_t busy;		/* cycles with any bank of a channel busy */
+  counter_t bus_busy;		/* cumulative data bus busy cycles */
+};
+
+/* create a DRAM with NCHANNELS channels of NRANKS ranks of NBANKS banks
+   with ROW_SIZE byte rows */
+struct dram_t *				/* pointer to DRAM created */
+dram_create(int nchannels,		/* number of channels */
+	    int nranks,			/* ranks per channel */
+	    int nbanks,			/* banks per rank */
+	    int row_size,		/* row size in bytes */
+	    enum dram_page_policy page,	/* row buffer management policy */
+	    int t_rcd,			/* activate to column access */
+	    int t_cas,			/* column access to first data */
+	    int t_rp,			/* precharge to activate */
+	    int t_ras,			/* activate to precharge */
+	    int bus_width,		/* data bus width in bytes */
+	    int xfer_lat,		/* data bus cycles per bus width */
+	    int queue_size);		/* request queue entries per channel */
+
+/* print DRAM configuration */
+void
+dram_config(struct dram_t *dram,	/* DRAM instance */
+	    FILE *stream);		/* output stream */
+
+/* register DRAM stats */
+void
+dram_reg_stats(struct dram_t *dram,	/* DRAM instance */
+	       struct stat_sdb_t *sdb);	/* stats database */
+
+/* access DRAM, make a CMD request for the BSIZE bytes at block address BADDR
+   at cycle NOW, returns the latency of a read, writes take no time */
+unsigned int				/* latency of access in cycles */
+dram_access(struct dram_t *dram,	/* DRAM to access */
+	    enum mem_cmd cmd,		/* access type, Read or Write */
+	    md_addr_t baddr,		/* block address to access */
+	    int bsize,			/* size of the block */
+	    tick_t now);		/* time of access */
+
+#endif /* DRAM_H */
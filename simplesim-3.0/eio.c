@@ -290,7 +290,7 @@ eio_write_chkpt(struct regs_t *regs,		/* regs to dump */
       /* dump this page... */
       exo = exo_new(ec_list,
 		    exo_new(ec_address, (exo_integer_t)MEM_PTE_ADDR(pte, i)),
-		    exo_new(ec_blob, MD_PAGE_SIZE, pte->page),
+		    exo_new(ec_blob, MD_PAGE_SIZE, MEM_PTE_PAGE(mem, pte, i)),
 		    NULL);
       exo_print(exo, fd);
       fprintf(fd, "\n\n");
@@ -761,6 +761,8 @@ eio_read_trace(FILE *eio_fd,			/* EIO stream file desc */
   if (!brkrec || brkrec->ec != ec_address)
     fatal("EIO trace inconsistency: missing memory breakpoint");
   ld_brk_point = (md_addr_t)brkrec->as_integer.val;
+  mem_protect(mem, ld_data_base, ld_brk_point - ld_data_base,
+	      MEM_PG_R|MEM_PG_W);
 
   /* write integer register outputs */
   for (i=MD_FIRST_OUT_REG, regrec=exo_outregs->as_list.head->next;
@@ -59,6 +59,7 @@
 #ifndef _MSC_VER
 #include <unistd.h>
 #include <sys/time.h>
+#include <sys/resource.h>
 #endif
 #ifdef BFD_LOADER
 #include <bfd.h>
@@ -92,10 +93,10 @@ signal_exit_now(int sigtype)
 /* execution instruction counter */
 counter_t sim_num_insn = 0;
 
-#if 0 /* not portable... :-( */
-/* total simulator (data) memory usage */
+#ifndef _MSC_VER
+/* peak simulator resident set size, in kilobytes */
 unsigned int sim_mem_usage = 0;
-#endif
+#endif /* !_MSC_VER */
 
 /* execution start/end times */
 time_t sim_start_time;
@@ -188,9 +189,9 @@ static int running = FALSE;
 void
 sim_print_stats(FILE *fd)		/* output stream */
 {
-#if 0 /* not portable... :-( */
-  extern char etext, *sbrk(int);
-#endif
+#ifndef _MSC_VER
+  struct rusage ru;
+#endif /* !_MSC_VER */
 
   if (!running)
     return;
@@ -199,10 +200,15 @@ sim_print_stats(FILE *fd)		/* output stream */
   sim_end_time = time((time_t *)NULL);
   sim_elapsed_time = MAX(sim_end_time - sim_start_time, 1);
 
-#if 0 /* not portable... :-( */
-  /* compute simulator memory usage */
-  sim_mem_usage = (sbrk(0) - &etext) / 1024;
+#ifndef _MSC_VER
+  /* compute simulator memory usage, ru_maxrss is in bytes on Mac OS X */
+  getrusage(RUSAGE_SELF, &ru);
+#ifdef __APPLE__
+  sim_mem_usage = ru.ru_maxrss / 1024;
+#else
+  sim_mem_usage = ru.ru_maxrss;
 #endif
+#endif /* !_MSC_VER */
 
   /* print simulation stats */
   fprintf(fd, "\nsim: ** simulation statistics **\n");
@@ -287,6 +293,9 @@ main(int argc, char **argv, char **envp)
 
   /* FIXME: add stats intervals and max insts... */
 
+  /* register memory system options, the page profile counts instructions */
+  mem_reg_options(sim_odb, &sim_num_insn);
+
   /* register all simulator-specific options */
   sim_reg_options(sim_odb);
 
@@ -383,11 +392,11 @@ main(int argc, char **argv, char **envp)
   /* register all simulator stats */
   sim_sdb = stat_new();
   sim_reg_stats(sim_sdb);
-#if 0 /* not portable... :-( */
+#ifndef _MSC_VER
   stat_reg_uint(sim_sdb, "sim_mem_usage",
-		"total simulator (data) memory usage",
-		&sim_mem_usage, sim_mem_usage, "%11dk");
-#endif
+		"peak simulator resident set size",
+		&sim_mem_usage, sim_mem_usage, "%11uk");
+#endif /* !_MSC_VER */
 
   /* record start of execution time, used in rate stats */
   sim_start_time = time((time_t *)NULL);
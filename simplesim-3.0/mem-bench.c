@@ -0,0 +1,295 @@
+/*
+ * mem-bench.c - micro-benchmark for the memory accessors
+ *
+ * Replays one synthetic sim-fast style reference stream (two word fetches
+ * per instruction out of a small loop body, with a load every fourth and a
+ * store every eighth instruction on a strided walk over an array) through
+ * the old MEM_READ/MEM_WRITE macros, which translate an address once for
+ * the page check and again for the access, and through the current ones,
+ * which translate once in the mem_rptr() and mem_wptr() inline accessors
+ * of page table builds (flat builds have nothing to translate, both are the
+ * same there), checks that both read back the same values, and reports the
+ * best host time per simulated instruction for each over a number of
+ * repetitions.  Before that it checks mem_snapshot() and mem_restore():
+ * after writes to pages that existed at the snapshot and to new ones, a
+ * restore must bring back the old contents and drop the new pages, twice
+ * over the same snapshot.
+ *
+ * usage: mem-bench [-n instructions] [-a array_bytes] [-s stride_bytes]
+ *                  [-r repetitions]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "host.h"
+#include "misc.h"
+#include "machine.h"
+#include "memory.h"
+
+/* where the synthetic program lives */
+#define TEXT_BASE	0x00400000
+#define TEXT_INSTS	64
+#define DATA_BASE	0x10000000
+
+/*
+ * reference version: the accessor macros as they were, with a second
+ * translation for the access itself
+ */
+
+#ifdef MEM_FLAT
+
+#define REF_READ(MEM, ADDR, TYPE)					\
+  (*((TYPE *)((MEM)->base + (md_addr_t)(ADDR))))
+
+#define REF_WRITE(MEM, ADDR, TYPE, VAL)					\
+  (MEM_TICKLE(MEM, (md_addr_t)(ADDR)),					\
+   *((TYPE *)((MEM)->base + (md_addr_t)(ADDR))) = (VAL))
+
+#else /* !MEM_FLAT */
+
+#define REF_READ(MEM, ADDR, TYPE)					\
+  (MEM_PAGE(MEM, (md_addr_t)(ADDR))					\
+   ? *((TYPE *)(MEM_PAGE(MEM, (md_addr_t)(ADDR)) + MEM_OFFSET(ADDR)))	\
+   : 0)
+
+#define REF_WRITE(MEM, ADDR, TYPE, VAL)					\
+  (MEM_TICKLE(MEM, (md_addr_t)(ADDR)),					\
+   *((TYPE *)(MEM_PAGE(MEM, (md_addr_t)(ADDR)) + MEM_OFFSET(ADDR))) = (VAL))
+
+#endif /* MEM_FLAT */
+
+/* wall clock in usecs */
+static double
+now_usec(void)
+{
+  struct timeval tv;
+
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec * 1e6 + tv.tv_usec;
+}
+
+/* load the loop body and the array into MEM */
+static void
+init_mem(struct mem_t *mem, int array_bytes)
+{
+  int i;
+
+  for (i = 0; i < TEXT_INSTS * 2; i++)
+    MEM_WRITE_WORD(mem, TEXT_BASE + i * sizeof(word_t), i);
+  for (i = 0; i < array_bytes; i += sizeof(word_t))
+    MEM_WRITE_WORD(mem, DATA_BASE + i, i);
+}
+
+/* pages the snapshot check writes, the last SNAP_NEW only after the
+   snapshot */
+#define SNAP_PAGES	8
+#define SNAP_NEW	3
+#define SNAP_BASE	0x20000000
+
+/* value of word I of page P in round R of the snapshot check */
+#define SNAP_VAL(P, I, R)	((word_t)(((P) << 20) + ((I) << 2) + (R)))
+
+/* is the page at ADDR of MEM allocated? */
+static int
+page_allocated(struct mem_t *mem, md_addr_t addr)
+{
+#ifdef MEM_FLAT
+  return (mem->pmap[MEM_VPN(addr)] & MEM_PG_VALID) != 0;
+#else /* !MEM_FLAT */
+  return mem_translate(mem, addr) != NULL;
+#endif /* MEM_FLAT */
+}
+
+/* check that a restore undoes the writes made since mem_snapshot(), both
+   to existing pages and to new ones, fatal if not */
+static void
+check_snapshot(void)
+{
+  struct mem_t *mem = mem_create("snap");
+  md_addr_t addr;
+  counter_t pages;
+  int p, i, r, old = SNAP_PAGES - SNAP_NEW;
+
+  mem_init(mem);
+  for (p = 0; p < old; p++)
+    for (i = 0; i < MD_PAGE_SIZE; i += sizeof(word_t))
+      MEM_WRITE_WORD(mem, SNAP_BASE + p * MD_PAGE_SIZE + i,
+		     SNAP_VAL(p, i, 0));
+  pages = mem->page_count;
+  mem_snapshot(mem);
+
+  for (r = 1; r <= 2; r++)
+    {
+      /* overwrite every other word of the old pages, fill the new ones */
+      for (p = 0; p < SNAP_PAGES; p++)
+	for (i = 0; i < MD_PAGE_SIZE; i += 2 * sizeof(word_t))
+	  MEM_WRITE_WORD(mem, SNAP_BASE + p * MD_PAGE_SIZE + i,
+			 SNAP_VAL(p, i, r));
+      for (p = 0; p < SNAP_PAGES; p++)
+	if (MEM_READ_WORD(mem, SNAP_BASE + p * MD_PAGE_SIZE)
+	    != SNAP_VAL(p, 0, r))
+	  fatal("snapshot check: round %d write to page %d lost", r, p);
+
+      mem_restore(mem);
+
+      if (mem->page_count != pages)
+	fatal("snapshot check: round %d left %d pages, not %d",
+	      r, (int)mem->page_count, (int)pages);
+      for (p = 0; p < SNAP_PAGES; p++)
+	{
+	  addr = SNAP_BASE + p * MD_PAGE_SIZE;
+	  if (p >= old)
+	    {
+	      if (page_allocated(mem, addr) || MEM_READ_WORD(mem, addr) != 0)
+		fatal("snapshot check: round %d new page %d not freed", r, p);
+	      continue;
+	    }
+	  for (i = 0; i < MD_PAGE_SIZE; i += sizeof(word_t))
+	    if (MEM_READ_WORD(mem, addr + i) != SNAP_VAL(p, i, 0))
+	      fatal("snapshot check: round %d page %d word %d not restored",
+		    r, p, i / (int)sizeof(word_t));
+	}
+    }
+
+  fprintf(stdout, "mem-bench: snapshot check passed, %d pages copied\n",
+	  (int)mem->snap_copies);
+}
+
+/* run N instructions through the reference macros, returns elapsed usecs
+   and the sum of the values read in *SUM */
+static double __attribute__((noinline))
+run_macro(struct mem_t *mem, int n, int array_bytes, int stride, word_t *sum)
+{
+  double start;
+  md_addr_t pc = TEXT_BASE, daddr = 0;
+  word_t acc = 0;
+  int i;
+
+  start = now_usec();
+  for (i = 0; i < n; i++)
+    {
+      acc += MD_SWAPW(REF_READ(mem, pc, word_t));
+      acc += MD_SWAPW(REF_READ(mem, pc + sizeof(word_t), word_t));
+      pc += 2 * sizeof(word_t);
+      if (pc == TEXT_BASE + TEXT_INSTS * 2 * sizeof(word_t))
+	pc = TEXT_BASE;
+
+      if ((i & 3) == 0)
+	{
+	  if ((i & 7) == 0)
+	    REF_WRITE(mem, DATA_BASE + daddr, word_t, MD_SWAPW(acc));
+	  else
+	    acc += MD_SWAPW(REF_READ(mem, DATA_BASE + daddr, word_t));
+	  daddr += stride;
+	  if (daddr >= (md_addr_t)array_bytes)
+	    daddr = 0;
+	}
+    }
+  *sum = acc;
+  return now_usec() - start;
+}
+
+/* run N instructions through the current accessors, returns elapsed usecs
+   and the sum of the values read in *SUM */
+static double __attribute__((noinline))
+run_current(struct mem_t *mem, int n, int array_bytes, int stride, word_t *sum)
+{
+  double start;
+  md_addr_t pc = TEXT_BASE, daddr = 0;
+  word_t acc = 0;
+  int i;
+
+  start = now_usec();
+  for (i = 0; i < n; i++)
+    {
+      acc += MEM_READ_WORD(mem, pc);
+      acc += MEM_READ_WORD(mem, pc + sizeof(word_t));
+      pc += 2 * sizeof(word_t);
+      if (pc == TEXT_BASE + TEXT_INSTS * 2 * sizeof(word_t))
+	pc = TEXT_BASE;
+
+      if ((i & 3) == 0)
+	{
+	  if ((i & 7) == 0)
+	    MEM_WRITE_WORD(mem, DATA_BASE + daddr, acc);
+	  else
+	    acc += MEM_READ_WORD(mem, DATA_BASE + daddr);
+	  daddr += stride;
+	  if (daddr >= (md_addr_t)array_bytes)
+	    daddr = 0;
+	}
+    }
+  *sum = acc;
+  return now_usec() - start;
+}
+
+int
+main(int argc, char **argv)
+{
+  int i, n = 20000000, array_bytes = 16*1024*1024, stride = 64, reps = 5;
+  struct mem_t *mmem, *cmem;
+  word_t msum, csum;
+  double t, t_macro = 0.0, t_cur = 0.0;
+
+  for (i = 1; i < argc - 1; i++)
+    {
+      if (!strcmp(argv[i], "-n"))
+	n = atoi(argv[++i]);
+      else if (!strcmp(argv[i], "-a"))
+	array_bytes = atoi(argv[++i]);
+      else if (!strcmp(argv[i], "-s"))
+	stride = atoi(argv[++i]);
+      else if (!strcmp(argv[i], "-r"))
+	reps = atoi(argv[++i]);
+    }
+  if (n <= 0 || array_bytes < 4 || stride <= 0 || (stride & 3) != 0
+      || reps <= 0)
+    fatal("usage: mem-bench [-n instructions] [-a array_bytes] "
+	  "[-s stride_bytes] [-r repetitions]");
+
+  check_snapshot();
+
+  mmem = mem_create("macro");
+  mem_init(mmem);
+  init_mem(mmem, array_bytes);
+  cmem = mem_create("current");
+  mem_init(cmem);
+  init_mem(cmem, array_bytes);
+
+  /* alternate the two versions so host noise hits both alike */
+  for (i = 0; i < reps; i++)
+    {
+      t = run_macro(mmem, n, array_bytes, stride, &msum);
+      if (i == 0 || t < t_macro)
+	t_macro = t;
+
+      t = run_current(cmem, n, array_bytes, stride, &csum);
+      if (i == 0 || t < t_cur)
+	t_cur = t;
+    }
+
+  fprintf(stdout,
+	  "mem-bench: %d instructions, %d byte array, %d byte stride, "
+	  "best of %d, %s memory\n", n, array_bytes, stride, reps,
+#ifdef MEM_FLAT
+	  "flat"
+#else /* !MEM_FLAT */
+	  "page table"
+#endif /* MEM_FLAT */
+	  );
+  fprintf(stdout, "%-8s %12s %10s %10s\n",
+	  "version", "checksum", "ns/inst", "Minst/s");
+  fprintf(stdout, "%-8s %12u %10.2f %10.1f\n", "macro",
+	  msum, t_macro * 1000.0 / n, n / t_macro);
+  fprintf(stdout, "%-8s %12u %10.2f %10.1f\n", "current",
+	  csum, t_cur * 1000.0 / n, n / t_cur);
+  fprintf(stdout, "speedup: %.2fx\n", t_macro / t_cur);
+
+  if (msum != csum)
+    fatal("macro and current accessors disagree");
+
+  return 0;
+}
@@ -51,6 +51,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "host.h"
 #include "misc.h"
@@ -59,6 +60,42 @@
 #include "stats.h"
 #include "memory.h"
 
+#ifndef _MSC_VER
+#include <sys/mman.h>
+#ifndef MAP_NORESERVE
+#define MAP_NORESERVE		0
+#endif
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS		MAP_ANON
+#endif
+#endif /* !_MSC_VER */
+
+#ifndef MEM_FLAT
+/* reads of pages never written are served from here, see mem_rptr() */
+dfloat_t mem_zeroes[2];
+#endif /* !MEM_FLAT */
+
+/* enforce the regions set by mem_protect(), -mem:protect */
+static int mem_prot_opt = FALSE;
+
+#ifdef MEM_PROFILE
+/* page profile options */
+static char *mem_heatmap_fname;		/* heatmap file, NULL for none */
+static char *mem_heatmap_fmt;		/* heatmap format, csv or bin */
+static char *mem_ws_fname;		/* working set file, NULL for none */
+static int mem_ws_int;			/* instructions per working set sample */
+
+/* page profile time source, set by mem_reg_options() */
+static counter_t mem_prof_noclock = 0;
+static counter_t *mem_prof_clock = &mem_prof_noclock;
+
+/* profiled memory spaces, written out at exit */
+static struct mem_t *mem_prof_list = NULL;
+static FILE *mem_ws_fd = NULL;
+
+static void mem_prof_init(void);
+#endif /* MEM_PROFILE */
+
 
 /* create a flat memory space */
 struct mem_t *
@@ -71,18 +108,86 @@ mem_create(char *name)			/* name of the memory space */
     fatal("out of virtual memory");
 
   mem->name = mystrdup(name);
+
+#ifdef MEM_FLAT
+  if (sizeof(void *) <= sizeof(md_addr_t))
+    fatal("flat memory needs a 64-bit host, rebuild with -DMEM_NO_FLAT");
+
+  /* reserve the whole simulated address space, the host backs each page
+     with zeroes on first touch */
+  mem->base = mmap(NULL, (size_t)MEM_FLAT_PAGES * MD_PAGE_SIZE,
+		   PROT_READ|PROT_WRITE,
+		   MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE, -1, 0);
+  if (mem->base == MAP_FAILED)
+    fatal("cannot reserve %s address space, rebuild with -DMEM_NO_FLAT",
+	  name);
+
+  /* every page permits any access until mem_protect() says otherwise */
+  mem->pmap = malloc(MEM_FLAT_PAGES * sizeof(byte_t));
+  if (!mem->pmap)
+    fatal("out of virtual memory");
+  memset(mem->pmap, MEM_PG_RWX, MEM_FLAT_PAGES * sizeof(byte_t));
+#endif /* MEM_FLAT */
+
+#ifdef MEM_PROFILE
+  if (mem_heatmap_fname || mem_ws_fname)
+    {
+      if (!mem_prof_list)
+	mem_prof_init();
+
+#ifdef MEM_FLAT
+      /* zeroed on first touch like the pages themselves */
+      mem->prof = calloc(MEM_FLAT_PAGES, sizeof(struct mem_prof_t));
+      if (!mem->prof)
+	fatal("out of virtual memory");
+#endif /* MEM_FLAT */
+
+      mem->prof_on = TRUE;
+      mem->ws_next = mem_ws_int;
+      mem->prof_next = mem_prof_list;
+      mem_prof_list = mem;
+    }
+#endif /* MEM_PROFILE */
+
   return mem;
 }
 
+/* MEM_PG_R/W/X permissions of the page at ADDR */
+static int
+mem_perms(struct mem_t *mem,		/* memory space to access */
+	  md_addr_t addr)		/* virtual address to access */
+{
+  int i;
+
+  if (!mem->nregions)
+    return MEM_PG_RWX;
+
+  /* the latest region wins where they overlap */
+  for (i=mem->nregions-1; i >= 0; i--)
+    {
+      if (MEM_VPN(addr) >= mem->regions[i].base
+	  && MEM_VPN(addr) < mem->regions[i].bound)
+	return mem->regions[i].perms;
+    }
+
+  /* outside every region */
+  return 0;
+}
+
 /* translate address ADDR in memory space MEM, returns pointer to host page */
 byte_t *
 mem_translate(struct mem_t *mem,	/* memory space to access */
 	      md_addr_t addr)		/* virtual address to translate */
 {
+#ifdef MEM_FLAT
+  return MEM_PAGE(mem, addr);
+#else /* !MEM_FLAT */
   struct mem_pte_t *pte, *prev;
+  struct mem_tlb_t *tlb;
 
-  /* got here via a first level miss in the page tables */
-  mem->ptab_misses++; mem->ptab_accesses++;
+  /* got here via a TLB miss, pages that share a bucket share a TLB entry
+     too, so a TLB hit is always a first level hit in the page table */
+  mem->tlb_misses++;
 
   /* locate accessed PTE */
   for (prev=NULL, pte=mem->ptab[MEM_PTAB_SET(addr)];
@@ -94,16 +199,84 @@ mem_translate(struct mem_t *mem,	/* memory space to access */
 	  /* move this PTE to head of the bucket list */
 	  if (prev)
 	    {
+	      mem->ptab_misses++;
 	      prev->next = pte->next;
 	      pte->next = mem->ptab[MEM_PTAB_SET(addr)];
 	      mem->ptab[MEM_PTAB_SET(addr)] = pte;
 	    }
+
+	  /* refill the TLB */
+	  tlb = MEM_TLB_ENT(mem, addr);
+	  tlb->vpn = MEM_VPN(addr);
+	  tlb->wvpn = (pte->flags & MEM_PG_COW) ? MEM_TLB_INVALID : tlb->vpn;
+	  tlb->page = pte->page;
+	  tlb->perms = mem_perms(mem, addr);
+#ifdef MEM_PROFILE
+	  tlb->prof = &pte->prof;
+#endif /* MEM_PROFILE */
 	  return pte->page;
 	}
     }
 
   /* no translation found, return NULL */
+  mem->ptab_misses++;
   return NULL;
+#endif /* MEM_FLAT */
+}
+
+#ifndef MEM_FLAT
+/* allocate a zeroed, MEM_ARENA_SIZE-aligned arena for guest pages, the
+   alignment lets the host back it with huge pages */
+static byte_t *
+mem_arena_alloc(void)
+{
+#ifndef _MSC_VER
+  byte_t *p, *arena;
+
+  /* over-allocate, then trim down to an aligned arena */
+  p = mmap(NULL, 2 * MEM_ARENA_SIZE, PROT_READ|PROT_WRITE,
+	   MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+  if (p == MAP_FAILED)
+    fatal("out of virtual memory");
+
+  arena = (byte_t *)(((unsigned long)p + MEM_ARENA_SIZE - 1)
+		     & ~(unsigned long)(MEM_ARENA_SIZE - 1));
+  if (arena != p)
+    munmap(p, arena - p);
+  munmap(arena + MEM_ARENA_SIZE, (p + MEM_ARENA_SIZE) - arena);
+
+#ifdef MADV_HUGEPAGE
+  madvise(arena, MEM_ARENA_SIZE, MADV_HUGEPAGE);
+#endif /* MADV_HUGEPAGE */
+
+  return arena;
+#else /* _MSC_VER */
+  byte_t *arena;
+
+  /* see misc.c for details on the getcore() function */
+  arena = getcore(MEM_ARENA_SIZE);
+  if (!arena)
+    fatal("out of virtual memory");
+  return arena;
+#endif /* !_MSC_VER */
+}
+#endif /* !MEM_FLAT */
+
+/* add the page at ADDR to the snapshot log, DATA is its saved contents */
+static void
+mem_snap_log(struct mem_t *mem,		/* memory space to access */
+	     md_addr_t addr,		/* virtual address of page */
+	     byte_t *data)		/* saved page, NULL if new */
+{
+  struct mem_snap_t *sp;
+
+  sp = calloc(1, sizeof(struct mem_snap_t));
+  if (!sp)
+    fatal("out of virtual memory");
+  sp->addr = addr & ~(md_addr_t)(MD_PAGE_SIZE - 1);
+  sp->data = data;
+  sp->next = mem->snap;
+  mem->snap = sp;
 }
 
 /* allocate a memory page */
@@ -111,27 +284,315 @@ void
 mem_newpage(struct mem_t *mem,		/* memory space to allocate in */
 	    md_addr_t addr)		/* virtual address to allocate */
 {
+#ifdef MEM_FLAT
+  /* the page is already mapped, just account for it */
+  mem->pmap[MEM_VPN(addr)] = (mem->pmap[MEM_VPN(addr)] & MEM_PG_RWX)
+			     | MEM_PG_VALID;
+#else /* !MEM_FLAT */
   byte_t *page;
   struct mem_pte_t *pte;
 
-  /* see misc.c for details on the getcore() function */
-  page = getcore(MD_PAGE_SIZE);
-  if (!page)
-    fatal("out of virtual memory");
+  if (mem->pte_freelist)
+    {
+      /* reuse a page dropped by mem_restore() */
+      pte = mem->pte_freelist;
+      mem->pte_freelist = pte->next;
+      page = pte->page;
+      memset(page, 0, MD_PAGE_SIZE);
+#ifdef MEM_PROFILE
+      memset(&pte->prof, 0, sizeof(struct mem_prof_t));
+#endif /* MEM_PROFILE */
+    }
+  else
+    {
+      /* take the next page of the current arena */
+      if (!mem->arena_free)
+	{
+	  mem->arena = mem_arena_alloc();
+	  mem->arena_free = MEM_ARENA_SIZE / MD_PAGE_SIZE;
+	}
+      page = mem->arena;
+      mem->arena += MD_PAGE_SIZE;
+      mem->arena_free--;
 
-  /* generate a new PTE */
-  pte = calloc(1, sizeof(struct mem_pte_t));
-  if (!pte)
-    fatal("out of virtual memory");
+      /* generate a new PTE from the current slab */
+      if (!mem->pte_free)
+	{
+	  mem->pte_slab = calloc(MEM_PTE_SLAB, sizeof(struct mem_pte_t));
+	  if (!mem->pte_slab)
+	    fatal("out of virtual memory");
+	  mem->pte_free = MEM_PTE_SLAB;
+	}
+      pte = mem->pte_slab++;
+      mem->pte_free--;
+    }
   pte->tag = MEM_PTAB_TAG(addr);
   pte->page = page;
+  pte->flags = 0;
 
   /* insert PTE into inverted hash table */
   pte->next = mem->ptab[MEM_PTAB_SET(addr)];
   mem->ptab[MEM_PTAB_SET(addr)] = pte;
 
+  /* the write that allocated it accesses the page next */
+  MEM_TLB_ENT(mem, addr)->vpn = MEM_VPN(addr);
+  MEM_TLB_ENT(mem, addr)->wvpn = MEM_VPN(addr);
+  MEM_TLB_ENT(mem, addr)->page = page;
+  MEM_TLB_ENT(mem, addr)->perms = mem_perms(mem, addr);
+#ifdef MEM_PROFILE
+  MEM_TLB_ENT(mem, addr)->prof = &pte->prof;
+#endif /* MEM_PROFILE */
+#endif /* MEM_FLAT */
+
   /* one more page allocated */
   mem->page_count++;
+
+  /* the snapshot drops it on restore */
+  if (mem->snap_valid)
+    mem_snap_log(mem, addr, NULL);
+}
+
+/* prepare the page at ADDR for a write, called by MEM_TICKLE() on its
+   first write since it was allocated or since mem_snapshot() */
+void
+mem_writepage(struct mem_t *mem,	/* memory space to access */
+	      md_addr_t addr)		/* virtual address to write */
+{
+  byte_t *page, *data;
+#ifndef MEM_FLAT
+  struct mem_pte_t *pte;
+#endif /* !MEM_FLAT */
+
+  page = mem_translate(mem, addr);
+  if (!page)
+    {
+      /* first write to page at address ADDR */
+      mem_newpage(mem, addr);
+      return;
+    }
+
+#ifdef MEM_FLAT
+  if (!(mem->pmap[MEM_VPN(addr)] & MEM_PG_COW))
+    return;
+  mem->pmap[MEM_VPN(addr)] &= ~MEM_PG_COW;
+#else /* !MEM_FLAT */
+  /* mem_translate() moved the PTE to the head of its bucket */
+  pte = mem->ptab[MEM_PTAB_SET(addr)];
+  if (!(pte->flags & MEM_PG_COW))
+    return;
+  pte->flags &= ~MEM_PG_COW;
+  MEM_TLB_ENT(mem, addr)->wvpn = MEM_VPN(addr);
+#endif /* MEM_FLAT */
+
+  /* first write since the snapshot, save the page for mem_restore() */
+  data = malloc(MD_PAGE_SIZE);
+  if (!data)
+    fatal("out of virtual memory");
+  memcpy(data, page, MD_PAGE_SIZE);
+  mem_snap_log(mem, addr, data);
+  mem->snap_copies++;
+}
+
+/* drop the page at ADDR, allocated since the snapshot */
+static void
+mem_droppage(struct mem_t *mem,		/* memory space to access */
+	     md_addr_t addr)		/* virtual address of page */
+{
+#ifdef MEM_FLAT
+  /* reads of unwritten pages return zero */
+  memset(MEM_WPAGE(mem, addr), 0, MD_PAGE_SIZE);
+  mem->pmap[MEM_VPN(addr)] &= MEM_PG_RWX;
+#else /* !MEM_FLAT */
+  struct mem_pte_t *pte, **prev;
+
+  /* unlink the PTE, mem_newpage() reuses it and its page */
+  for (prev=&mem->ptab[MEM_PTAB_SET(addr)]; *prev; prev=&(*prev)->next)
+    {
+      pte = *prev;
+      if (pte->tag == MEM_PTAB_TAG(addr))
+	{
+	  *prev = pte->next;
+	  pte->next = mem->pte_freelist;
+	  mem->pte_freelist = pte;
+	  break;
+	}
+    }
+
+  if (MEM_TLB_ENT(mem, addr)->vpn == MEM_VPN(addr))
+    {
+      MEM_TLB_ENT(mem, addr)->vpn = MEM_TLB_INVALID;
+      MEM_TLB_ENT(mem, addr)->wvpn = MEM_TLB_INVALID;
+    }
+#endif /* MEM_FLAT */
+
+  mem->page_count--;
+}
+
+/* set the permissions of the pages spanning [ADDR, ADDR+NBYTES) to PERMS,
+   a MEM_PG_R/W/X mask, replacing any region with the same first page; once
+   any region is set, pages outside every region permit no access and the
+   latest region wins where they overlap.  Does nothing unless -mem:protect
+   is given, then MEM_CHECK() and mem_access() fault with md_fault_access */
+void
+mem_protect(struct mem_t *mem,		/* memory space to protect */
+	    md_addr_t addr,		/* start of region */
+	    md_addr_t nbytes,		/* size of region in bytes */
+	    int perms)			/* MEM_PG_R/W/X permissions */
+{
+  int i;
+  md_addr_t base, bound, lo, hi;
+
+  if (!mem_prot_opt)
+    return;
+
+  base = MEM_VPN(addr);
+  bound = nbytes ? MEM_VPN(addr + nbytes - 1) + 1 : base;
+
+  /* a region is named by its first page, as brk() moves only its end */
+  for (i=0; i < mem->nregions; i++)
+    {
+      if (mem->regions[i].base == base)
+	break;
+    }
+  if (i < mem->nregions)
+    {
+      /* pages the region grows over or gives up */
+      lo = base;
+      hi = MAX(bound, mem->regions[i].bound);
+    }
+  else if (mem->nregions < MEM_MAX_REGIONS)
+    {
+      /* the first region revokes access to every other page */
+      lo = mem->nregions ? base : 0;
+      hi = mem->nregions ? bound : MEM_FLAT_PAGES;
+      mem->nregions++;
+    }
+  else
+    fatal("too many protected regions, increase MEM_MAX_REGIONS");
+
+  mem->regions[i].base = base;
+  mem->regions[i].bound = bound;
+  mem->regions[i].perms = perms;
+
+#ifdef MEM_FLAT
+  /* restamp the page map over the pages affected */
+  for (; lo < hi; lo++)
+    mem->pmap[lo] = (mem->pmap[lo] & ~MEM_PG_RWX)
+		    | mem_perms(mem, lo << MD_LOG_PAGE_SIZE);
+#else /* !MEM_FLAT */
+  /* the TLB caches permissions, drop the pages affected */
+  for (i=0; i < MEM_TLB_SIZE; i++)
+    {
+      if (mem->tlb[i].vpn >= lo && mem->tlb[i].vpn < hi)
+	mem->tlb[i].vpn = mem->tlb[i].wvpn = MEM_TLB_INVALID;
+    }
+#endif /* MEM_FLAT */
+}
+
+#ifndef MEM_FLAT
+/* check the permissions of the page at ADDR on a MEM_CHECK() TLB miss */
+enum md_fault_type
+mem_check(struct mem_t *mem,		/* memory space to access */
+	  md_addr_t addr,		/* virtual address to access */
+	  int perm)			/* MEM_PG_R/W/X access */
+{
+  /* bring an allocated page into the TLB for the access that follows */
+  mem_translate(mem, addr);
+
+  return (mem_perms(mem, addr) & perm) ? md_fault_none : md_fault_access;
+}
+#endif /* !MEM_FLAT */
+
+/* take a copy-on-write snapshot of memory space MEM, replacing any earlier
+   one; pages are shared with the snapshot until their next write, and
+   mem_restore() can roll back to it any number of times.  Register and
+   loader state (regs_t, ld_brk_point, ld_stack_min) are the caller's to
+   save alongside it */
+void
+mem_snapshot(struct mem_t *mem)		/* memory space to snapshot */
+{
+  int i;
+  struct mem_snap_t *sp;
+#ifndef MEM_FLAT
+  struct mem_pte_t *pte;
+#endif /* !MEM_FLAT */
+
+  /* forget the earlier snapshot */
+  while (mem->snap)
+    {
+      sp = mem->snap;
+      mem->snap = sp->next;
+      if (sp->data)
+	free(sp->data);
+      free(sp);
+    }
+
+  /* share every page with the snapshot until its next write */
+#ifdef MEM_FLAT
+  for (i=0; i < MEM_FLAT_PAGES; i++)
+    if (mem->pmap[i] & MEM_PG_VALID)
+      mem->pmap[i] |= MEM_PG_COW;
+#else /* !MEM_FLAT */
+  MEM_FORALL(mem, i, pte)
+    pte->flags |= MEM_PG_COW;
+
+  for (i=0; i < MEM_TLB_SIZE; i++)
+    mem->tlb[i].wvpn = MEM_TLB_INVALID;
+#endif /* MEM_FLAT */
+
+  mem->snap_valid = TRUE;
+}
+
+/* roll memory space MEM back to its snapshot, pages allocated since are
+   dropped, the snapshot stays valid */
+void
+mem_restore(struct mem_t *mem)		/* memory space to restore */
+{
+  struct mem_snap_t *sp, **prev;
+
+  if (!mem->snap_valid)
+    fatal("memory space `%s' has no snapshot to restore", mem->name);
+
+  for (prev=&mem->snap; (sp=*prev) != NULL; )
+    {
+      if (sp->data)
+	{
+	  /* written since the snapshot, copy it back; the saved copy stays
+	     in the log so the page needs no copy on its next write */
+	  memcpy(mem_translate(mem, sp->addr), sp->data, MD_PAGE_SIZE);
+	  prev = &sp->next;
+	}
+      else
+	{
+	  /* allocated since the snapshot */
+	  mem_droppage(mem, sp->addr);
+	  *prev = sp->next;
+	  free(sp);
+	}
+    }
+}
+
+/* locate the host address of simulated address ADDR for an access of type
+   CMD, a write allocates the page if needed, a read of an unallocated page
+   returns NULL; one page translation per call */
+static byte_t *
+mem_host_addr(struct mem_t *mem,	/* memory space to access */
+	      enum mem_cmd cmd,		/* Read (from sim mem) or Write */
+	      md_addr_t addr)		/* target address to access */
+{
+  byte_t *page;
+
+  if (cmd == Read)
+    {
+      page = MEM_PAGE(mem, addr);
+      if (!page)
+	return NULL;
+      MEM_PROF_TOUCH(mem, addr, Read);
+      return page + MEM_OFFSET(addr);
+    }
+
+  /* allocate the page, or copy it for the snapshot, on its first write */
+  return mem_wptr(mem, addr);
 }
 
 /* generic memory access function, it's safe because alignments and permissions
@@ -144,7 +605,8 @@ mem_access(struct mem_t *mem,		/* memory space to access */
 	   void *vp,			/* host memory address to access */
 	   int nbytes)			/* number of bytes to access */
 {
-  byte_t *p = vp;
+  byte_t *p = vp, *h;
+  enum md_fault_type fault;
 
   /* check alignments */
   if (/* check size */(nbytes & (nbytes-1)) != 0
@@ -154,70 +616,305 @@ mem_access(struct mem_t *mem,		/* memory space to access */
   if (/* check natural alignment */(addr & (nbytes-1)) != 0)
     return md_fault_alignment;
 
-  /* perform the copy */
-  {
-    if (cmd == Read)
-      {
-	while (nbytes-- > 0)
-	  {
-	    *((byte_t *)p) = MEM_READ_BYTE(mem, addr);
-	    p += sizeof(byte_t);
-	    addr += sizeof(byte_t);
-	  }
-      }
-    else
-      {
-	while (nbytes-- > 0)
-	  {
-	    MEM_WRITE_BYTE(mem, addr, *((byte_t *)p));
-	    p += sizeof(byte_t);
-	    addr += sizeof(byte_t);
-	  }
-      }
-  }
+  /* check permissions */
+  fault = MEM_CHECK(mem, addr, cmd == Read ? MEM_PG_R : MEM_PG_W);
+  if (fault != md_fault_none)
+    return fault;
 
-#if 0
+  /* a naturally aligned access never crosses a page, translate it once */
+  h = mem_host_addr(mem, cmd, addr);
+  if (!h)
+    {
+      /* page not yet allocated, read zero value */
+      memset(p, 0, nbytes);
+      return md_fault_none;
+    }
+
+  /* perform the copy, constant sizes compile into a single move */
   switch (nbytes)
     {
     case 1:
       if (cmd == Read)
-	*((byte_t *)p) = MEM_READ_BYTE(mem, addr);
+	memcpy(p, h, 1);
       else
-	MEM_WRITE_BYTE(mem, addr, *((byte_t *)p));
+	memcpy(h, p, 1);
       break;
 
     case 2:
       if (cmd == Read)
-	*((half_t *)p) = MEM_READ_HALF(mem, addr);
+	memcpy(p, h, 2);
       else
-	MEM_WRITE_HALF(mem, addr, *((half_t *)p));
+	memcpy(h, p, 2);
       break;
 
     case 4:
       if (cmd == Read)
-	*((word_t *)p) = MEM_READ_WORD(mem, addr);
+	memcpy(p, h, 4);
       else
-	MEM_WRITE_WORD(mem, addr, *((word_t *)p));
+	memcpy(h, p, 4);
       break;
 
-#ifdef HOST_HAS_QWORD
     case 8:
       if (cmd == Read)
-	*((qword_t *)p) = MEM_READ_QWORD(mem, addr);
+	memcpy(p, h, 8);
       else
-	MEM_WRITE_QWORD(mem, addr, *((qword_t *)p));
+	memcpy(h, p, 8);
       break;
-#endif /* HOST_HAS_QWORD */
 
     default:
+      if (cmd == Read)
+	memcpy(p, h, nbytes);
+      else
+	memcpy(h, p, nbytes);
       break;
     }
-#endif
 
   /* no fault... */
   return md_fault_none;
 }
 
+/* bulk memory access function, copies NBYTES of any size and alignment
+   to/from simulated memory, one page translation and memcpy() per page
+   spanned; a Read of unallocated pages returns zeroes, a Write allocates
+   them, returns any faults encountered */
+enum md_fault_type
+mem_access_bulk(struct mem_t *mem,	/* memory space to access */
+		enum mem_cmd cmd,	/* Read (from sim mem) or Write */
+		md_addr_t addr,		/* target address to access */
+		void *vp,		/* host memory address to access */
+		int nbytes)		/* number of bytes to access */
+{
+  byte_t *p = vp, *h;
+  int span;
+  enum md_fault_type fault;
+
+  if (nbytes < 0)
+    return md_fault_access;
+
+  while (nbytes > 0)
+    {
+      /* bytes left in this page */
+      span = MD_PAGE_SIZE - MEM_OFFSET(addr);
+      if (span > nbytes)
+	span = nbytes;
+
+      fault = MEM_CHECK(mem, addr, cmd == Read ? MEM_PG_R : MEM_PG_W);
+      if (fault != md_fault_none)
+	return fault;
+
+      h = mem_host_addr(mem, cmd, addr);
+      if (cmd == Read)
+	{
+	  if (h)
+	    memcpy(p, h, span);
+	  else
+	    memset(p, 0, span);
+	}
+      else
+	memcpy(h, p, span);
+
+      p += span;
+      addr += span;
+      nbytes -= span;
+    }
+
+  /* no fault... */
+  return md_fault_none;
+}
+
+#ifdef MEM_PROFILE
+/* take a working set sample of MEM at time NOW, the pages touched since
+   the last one */
+static void
+mem_ws_sample(struct mem_t *mem,	/* memory space to sample */
+	      counter_t now)		/* current time */
+{
+  if (mem->ws_pages > mem->ws_peak)
+    mem->ws_peak = mem->ws_pages;
+  mem->ws_samples++;
+
+  if (mem_ws_fd)
+    myfprintf(mem_ws_fd, "%s,%n,%n\n", mem->name, now, mem->ws_pages);
+
+  mem->ws_start = now;
+  mem->ws_pages = 0;
+  if (mem_ws_int > 0)
+    mem->ws_next = (now / mem_ws_int + 1) * mem_ws_int;
+}
+
+/* record an access of type CMD to ADDR in the page profile */
+void
+mem_prof_touch(struct mem_t *mem,	/* memory space accessed */
+	       md_addr_t addr,		/* virtual address accessed */
+	       enum mem_cmd cmd)	/* Read or Write */
+{
+  struct mem_prof_t *prof;
+  counter_t now = *mem_prof_clock;
+
+#ifdef MEM_FLAT
+  prof = &mem->prof[MEM_VPN(addr)];
+#else /* !MEM_FLAT */
+  /* the access left an allocated page in the TLB */
+  if (MEM_TLB_ENT(mem, addr)->vpn != MEM_VPN(addr))
+    return;
+  prof = MEM_TLB_ENT(mem, addr)->prof;
+#endif /* MEM_FLAT */
+
+  if (mem_ws_int > 0 && now >= mem->ws_next)
+    mem_ws_sample(mem, now);
+
+  if (!prof->reads && !prof->writes)
+    {
+      /* first touch */
+      prof->first = now;
+      mem->ws_pages++;
+    }
+  else if (prof->last < mem->ws_start)
+    {
+      /* first touch in this working set interval */
+      mem->ws_pages++;
+    }
+  prof->last = now;
+
+  if (cmd == Read)
+    prof->reads++;
+  else
+    prof->writes++;
+}
+
+/* write the page profile of every profiled memory space, at exit */
+static void
+mem_prof_dump(void)
+{
+  int i, bin;
+  struct mem_t *mem;
+  struct mem_pte_t *pte;
+  struct mem_prof_t *prof;
+  counter_t rec[5], hdr[2];
+  FILE *fd = NULL;
+
+  bin = !mystricmp(mem_heatmap_fmt, "bin");
+  if (mem_heatmap_fname)
+    {
+      fd = fopen(mem_heatmap_fname, bin ? "wb" : "w");
+      if (!fd)
+	fatal("cannot open heatmap file `%s'", mem_heatmap_fname);
+      if (!bin)
+	fprintf(fd, "mem,addr,reads,writes,first,last\n");
+    }
+
+  for (mem=mem_prof_list; mem != NULL; mem=mem->prof_next)
+    {
+      /* close the last, partial, working set interval */
+      if (mem_ws_fname)
+	mem_ws_sample(mem, *mem_prof_clock);
+
+      if (!fd)
+	continue;
+
+      /* binary format: a header of the space's name and page count, then
+	 one record of address, reads, writes, first and last per page, all
+	 host-order counter_t's */
+      if (bin)
+	{
+	  memset(hdr, 0, sizeof(hdr));
+	  strncpy((char *)&hdr[0], mem->name, sizeof(counter_t));
+	  hdr[1] = mem->page_count;
+	  fwrite(hdr, sizeof(hdr), 1, fd);
+	}
+
+      MEM_FORALL(mem, i, pte)
+	{
+#ifdef MEM_FLAT
+	  prof = &mem->prof[i];
+#else /* !MEM_FLAT */
+	  prof = &pte->prof;
+#endif /* MEM_FLAT */
+	  if (bin)
+	    {
+	      rec[0] = MEM_PTE_ADDR(pte, i);
+	      rec[1] = prof->reads;
+	      rec[2] = prof->writes;
+	      rec[3] = prof->first;
+	      rec[4] = prof->last;
+	      fwrite(rec, sizeof(rec), 1, fd);
+	    }
+	  else
+	    myfprintf(fd, "%s,0x%08p,%n,%n,%n,%n\n", mem->name,
+		      MEM_PTE_ADDR(pte, i), prof->reads, prof->writes,
+		      prof->first, prof->last);
+	}
+    }
+
+  if (fd)
+    fclose(fd);
+  if (mem_ws_fd)
+    fclose(mem_ws_fd);
+}
+
+/* check the profile options and open the working set file, on creation
+   of the first profiled memory space */
+static void
+mem_prof_init(void)
+{
+  if (mystricmp(mem_heatmap_fmt, "csv") && mystricmp(mem_heatmap_fmt, "bin"))
+    fatal("unknown heatmap format `%s', use csv or bin", mem_heatmap_fmt);
+
+  if (mem_ws_fname)
+    {
+      if (mem_ws_int <= 0)
+	fatal("working set interval must be positive");
+      mem_ws_fd = fopen(mem_ws_fname, "w");
+      if (!mem_ws_fd)
+	fatal("cannot open working set file `%s'", mem_ws_fname);
+      fprintf(mem_ws_fd, "mem,time,pages\n");
+    }
+
+  atexit(mem_prof_dump);
+}
+#endif /* MEM_PROFILE */
+
+/* register -mem:protect, only simulators that check the permissions of
+   their accesses, with MEM_CHECK() or mem_access(), offer it */
+void
+mem_reg_protect(struct opt_odb_t *odb)	/* options database */
+{
+  opt_reg_flag(odb, "-mem:protect",
+	       "fault on accesses outside the program's text, data and stack",
+	       &mem_prot_opt, /* default */FALSE, /* print */TRUE, NULL);
+}
+
+/* register memory system options, CLOCK is the time source of the page
+   profile (MEM_PROFILE only) */
+void
+mem_reg_options(struct opt_odb_t *odb,	/* options database */
+		counter_t *clock)	/* profile time, e.g. sim_num_insn */
+{
+#ifdef MEM_PROFILE
+  opt_reg_string(odb, "-mem:heatmap",
+		 "per-page access heatmap written at exit (file name)",
+		 &mem_heatmap_fname, /* default */NULL,
+		 /* print */TRUE, NULL);
+
+  opt_reg_string(odb, "-mem:heatfmt",
+		 "heatmap format {csv|bin}",
+		 &mem_heatmap_fmt, /* default */"csv",
+		 /* print */TRUE, NULL);
+
+  opt_reg_string(odb, "-mem:wsfile",
+		 "working set curve written during the run (file name)",
+		 &mem_ws_fname, /* default */NULL,
+		 /* print */TRUE, NULL);
+
+  opt_reg_int(odb, "-mem:wsint",
+	      "instructions per working set sample",
+	      &mem_ws_int, /* default */1000000,
+	      /* print */TRUE, NULL);
+
+  mem_prof_clock = clock;
+#endif /* MEM_PROFILE */
+}
+
 /* register memory system-specific statistics */
 void
 mem_reg_stats(struct mem_t *mem,	/* memory space to declare */
@@ -229,37 +926,92 @@ mem_reg_stats(struct mem_t *mem,	/* memory space to declare */
   stat_reg_counter(sdb, buf, "total number of pages allocated",
 		   &mem->page_count, mem->page_count, NULL);
 
+  sprintf(buf, "%s.snap_copies", mem->name);
+  stat_reg_counter(sdb, buf, "total pages copied for the snapshot",
+		   &mem->snap_copies, mem->snap_copies, NULL);
+
+#ifdef MEM_PROFILE
+  if (mem->prof_on)
+    {
+      sprintf(buf, "%s.ws_peak", mem->name);
+      stat_reg_counter(sdb, buf, "largest working set sampled (pages)",
+		       &mem->ws_peak, mem->ws_peak, NULL);
+
+      sprintf(buf, "%s.ws_samples", mem->name);
+      stat_reg_counter(sdb, buf, "total working set samples taken",
+		       &mem->ws_samples, mem->ws_samples, NULL);
+    }
+#endif /* MEM_PROFILE */
+
   sprintf(buf, "%s.page_mem", mem->name);
   sprintf(buf1, "%s.page_count * %d / 1024", mem->name, MD_PAGE_SIZE);
   stat_reg_formula(sdb, buf, "total size of memory pages allocated",
 		   buf1, "%11.0fk");
 
+#ifndef MEM_FLAT
+  sprintf(buf, "%s.tlb_hits", mem->name);
+  stat_reg_counter(sdb, buf, "total translation cache hits",
+		   &mem->tlb_hits, mem->tlb_hits, NULL);
+
+  sprintf(buf, "%s.tlb_misses", mem->name);
+  stat_reg_counter(sdb, buf, "total translation cache misses",
+		   &mem->tlb_misses, mem->tlb_misses, NULL);
+
+  sprintf(buf, "%s.tlb_miss_rate", mem->name);
+  sprintf(buf1, "%s.tlb_misses / (%s.tlb_hits + %s.tlb_misses)",
+	  mem->name, mem->name, mem->name);
+  stat_reg_formula(sdb, buf, "translation cache miss rate", buf1, NULL);
+
   sprintf(buf, "%s.ptab_misses", mem->name);
   stat_reg_counter(sdb, buf, "total first level page table misses",
 		   &mem->ptab_misses, mem->ptab_misses, NULL);
 
+  /* every translation is a page table access, as without the TLB */
   sprintf(buf, "%s.ptab_accesses", mem->name);
-  stat_reg_counter(sdb, buf, "total page table accesses",
-		   &mem->ptab_accesses, mem->ptab_accesses, NULL);
+  sprintf(buf1, "%s.tlb_hits + %s.tlb_misses", mem->name, mem->name);
+  stat_reg_formula(sdb, buf, "total page table accesses", buf1, "%12.0f");
 
   sprintf(buf, "%s.ptab_miss_rate", mem->name);
   sprintf(buf1, "%s.ptab_misses / %s.ptab_accesses", mem->name, mem->name);
   stat_reg_formula(sdb, buf, "first level page table miss rate", buf1, NULL);
+#else /* MEM_FLAT */
+  /* a flat memory space translates without a page table, its stats read
+     zero rather than disappear from the output */
+  sprintf(buf, "%s.ptab_misses", mem->name);
+  stat_reg_formula(sdb, buf, "total first level page table misses (flat)",
+		   "0", "%12.0f");
+
+  sprintf(buf, "%s.ptab_accesses", mem->name);
+  stat_reg_formula(sdb, buf, "total page table accesses (flat)",
+		   "0", "%12.0f");
+
+  sprintf(buf, "%s.ptab_miss_rate", mem->name);
+  stat_reg_formula(sdb, buf, "first level page table miss rate (flat)",
+		   "0", NULL);
+#endif /* !MEM_FLAT */
 }
 
 /* initialize memory system, call before loader.c */
 void
 mem_init(struct mem_t *mem)	/* memory space to initialize */
 {
+#ifndef MEM_FLAT
   int i;
 
   /* initialize the first level page table to all empty */
   for (i=0; i < MEM_PTAB_SIZE; i++)
     mem->ptab[i] = NULL;
 
+  /* and the TLB */
+  for (i=0; i < MEM_TLB_SIZE; i++)
+    mem->tlb[i].vpn = mem->tlb[i].wvpn = MEM_TLB_INVALID;
+#endif /* !MEM_FLAT */
+
   mem->page_count = 0;
+  mem->tlb_hits = 0;
+  mem->tlb_misses = 0;
   mem->ptab_misses = 0;
-  mem->ptab_accesses = 0;
+  mem->snap_copies = 0;
 }
 
 /* dump a block of memory, returns any faults encountered */
@@ -318,6 +1070,10 @@ mem_strcpy(mem_access_fn mem_fn,	/* user-specified memory accessor */
       break;
 
     case Write:
+      /* direct access, copy the string and its terminator in bulk */
+      if (mem_fn == mem_access)
+	return mem_access_bulk(mem, Write, addr, s, strlen(s) + 1);
+
       /* copy until string terminator ('\0') is encountered */
       do {
 	c = *s++;
@@ -348,6 +1104,10 @@ mem_bcopy(mem_access_fn mem_fn,		/* user-specified memory accessor */
   byte_t *p = vp;
   enum md_fault_type fault;
 
+  /* direct access, copy a page at a time */
+  if (mem_fn == mem_access)
+    return mem_access_bulk(mem, cmd, addr, vp, nbytes);
+
   /* copy NBYTES bytes to/from simulator memory */
   while (nbytes-- > 0)
     {
@@ -375,6 +1135,10 @@ mem_bcopy4(mem_access_fn mem_fn,	/* user-specified memory accessor */
   int words = nbytes >> 2;		/* note: nbytes % 2 == 0 is assumed */
   enum md_fault_type fault;
 
+  /* direct access, copy a page at a time */
+  if (mem_fn == mem_access)
+    return mem_access_bulk(mem, cmd, addr, vp, words << 2);
+
   while (words-- > 0)
     {
       fault = mem_fn(mem, cmd, addr, p, sizeof(word_t));
@@ -396,9 +1160,32 @@ mem_bzero(mem_access_fn mem_fn,		/* user-specified memory accessor */
 	  md_addr_t addr,		/* target address to access */
 	  int nbytes)
 {
-  byte_t c = 0;
+  byte_t c = 0, *h;
+  int span;
   enum md_fault_type fault;
 
+  /* direct access, clear a page at a time */
+  if (mem_fn == mem_access)
+    {
+      while (nbytes > 0)
+	{
+	  span = MD_PAGE_SIZE - MEM_OFFSET(addr);
+	  if (span > nbytes)
+	    span = nbytes;
+
+	  fault = MEM_CHECK(mem, addr, MEM_PG_W);
+	  if (fault != md_fault_none)
+	    return fault;
+
+	  h = mem_host_addr(mem, Write, addr);
+	  memset(h, 0, span);
+
+	  addr += span;
+	  nbytes -= span;
+	}
+      return md_fault_none;
+    }
+
   /* zero out NBYTES of simulator memory */
   while (nbytes-- > 0)
     {
@@ -60,27 +60,139 @@
 #include "options.h"
 #include "stats.h"
 
+/* targets with 32-bit addresses keep the whole simulated address space in
+   one host mapping reserved with mmap(), a simulated address is then an
+   offset from its base and the host allocates pages on first touch, and
+   the page table stats read zero; this is the default, define MEM_NO_FLAT
+   to use the inverted page table below, as 64-bit targets do */
+#if !defined(MD_QWORD_ADDRS) && !defined(MEM_NO_FLAT) && !defined(_MSC_VER)
+#define MEM_FLAT
+#endif
+
+/* define MEM_PROFILE to keep a per-page access profile, a heatmap and a
+   working set curve written at exit, see mem_reg_options() */
+
+/* number of pages in a flat memory space */
+#define MEM_FLAT_PAGES							\
+  ((md_addr_t)1 << (sizeof(md_addr_t) * 8 - MD_LOG_PAGE_SIZE))
+
 /* number of entries in page translation hash table (must be power-of-two) */
 #define MEM_PTAB_SIZE		(32*1024)
 #define MEM_LOG_PTAB_SIZE	15
 
+/* guest pages are carved out of host arenas of this many bytes, a multiple
+   of the host huge page size */
+#define MEM_ARENA_SIZE		(2*1024*1024)
+
+/* page table entries are allocated in slabs of this many entries */
+#define MEM_PTE_SLAB		1024
+
+/* page state flags, kept in the flat page map or in the PTE */
+#define MEM_PG_VALID		0x01	/* page has been written */
+#define MEM_PG_COW		0x02	/* copy page for the snapshot on write */
+#define MEM_PG_R		0x04	/* page may be read */
+#define MEM_PG_W		0x08	/* page may be written */
+#define MEM_PG_X		0x10	/* page may be executed */
+#define MEM_PG_RWX		(MEM_PG_R|MEM_PG_W|MEM_PG_X)
+
+/* maximum number of protected regions, see mem_protect() */
+#define MEM_MAX_REGIONS		8
+
+/* protected region of the address space, in pages */
+struct mem_region_t {
+  md_addr_t base;		/* first page of the region */
+  md_addr_t bound;		/* first page past the region */
+  int perms;			/* MEM_PG_R/W/X permissions of its pages */
+};
+
+#ifdef MEM_PROFILE
+/* per-page access profile, times are instruction counts */
+struct mem_prof_t {
+  counter_t reads;		/* total reads of the page */
+  counter_t writes;		/* total writes of the page */
+  counter_t first;		/* time of first access */
+  counter_t last;		/* time of last access */
+};
+#endif /* MEM_PROFILE */
+
 /* page table entry */
 struct mem_pte_t {
   struct mem_pte_t *next;	/* next translation in this bucket */
   md_addr_t tag;		/* virtual page number tag */
   byte_t *page;			/* page pointer */
+  int flags;			/* page state, MEM_PG_COW */
+#ifdef MEM_PROFILE
+  struct mem_prof_t prof;	/* access profile of the page */
+#endif /* MEM_PROFILE */
+};
+
+/* number of entries in the host-side translation cache (power-of-two, at
+   most MEM_PTAB_SIZE, so the page table stats keep their meaning) */
+#define MEM_TLB_SIZE		1024
+
+/* translation cache entry, caches the page table lookup of one page */
+struct mem_tlb_t {
+  md_addr_t vpn;		/* virtual page number, MEM_TLB_INVALID if empty */
+  md_addr_t wvpn;		/* VPN if writes need no MEM_PG_COW copy */
+  byte_t *page;			/* page pointer */
+  int perms;			/* MEM_PG_R/W/X permissions of the page */
+#ifdef MEM_PROFILE
+  struct mem_prof_t *prof;	/* access profile of the page */
+#endif /* MEM_PROFILE */
 };
 
+/* snapshot log entry, the contents of one page at mem_snapshot() time */
+struct mem_snap_t {
+  struct mem_snap_t *next;	/* next logged page */
+  md_addr_t addr;		/* virtual address of page */
+  byte_t *data;			/* saved page, NULL if allocated since */
+};
+
+/* an impossible virtual page number, marks an empty TLB entry */
+#define MEM_TLB_INVALID		(~(md_addr_t)0)
+
 /* memory object */
 struct mem_t {
   /* memory object state */
   char *name;				/* name of this memory space */
+#ifdef MEM_FLAT
+  byte_t *base;				/* host address of simulated address 0 */
+  byte_t *pmap;				/* MEM_PG_* flags and permissions
+					   of each page */
+#ifdef MEM_PROFILE
+  struct mem_prof_t *prof;		/* access profile of each page */
+#endif /* MEM_PROFILE */
+#else /* !MEM_FLAT */
+  struct mem_tlb_t tlb[MEM_TLB_SIZE];	/* direct-mapped translation cache */
   struct mem_pte_t *ptab[MEM_PTAB_SIZE];/* inverted page table */
+  byte_t *arena;			/* next free page in current arena */
+  int arena_free;			/* pages left in current arena */
+  struct mem_pte_t *pte_slab;		/* next free PTE in current slab */
+  int pte_free;				/* PTEs left in current slab */
+  struct mem_pte_t *pte_freelist;	/* PTEs of pages dropped by restore */
+#endif /* MEM_FLAT */
+  int snap_valid;			/* non-zero once a snapshot is taken */
+  struct mem_snap_t *snap;		/* pages written since the snapshot */
+  int nregions;				/* protected regions, none if zero */
+  struct mem_region_t regions[MEM_MAX_REGIONS];
+#ifdef MEM_PROFILE
+  int prof_on;				/* non-zero if accesses are profiled */
+  struct mem_t *prof_next;		/* next profiled memory space */
+  counter_t ws_start;			/* start of working set interval */
+  counter_t ws_next;			/* time of next working set sample */
+#endif /* MEM_PROFILE */
 
   /* memory object stats */
   counter_t page_count;			/* total number of pages allocated */
+  counter_t tlb_hits;			/* total translation cache hits */
+  counter_t tlb_misses;			/* total translation cache misses */
   counter_t ptab_misses;		/* total first level page tbl misses */
-  counter_t ptab_accesses;		/* total page table accesses */
+  counter_t snap_copies;		/* total pages copied for snapshot */
+#ifdef MEM_PROFILE
+  counter_t ws_pages;			/* pages touched in this interval */
+  counter_t ws_peak;			/* largest working set sampled */
+  counter_t ws_samples;			/* working set samples taken */
+#endif /* MEM_PROFILE */
 };
 
 /* memory access command */
@@ -102,6 +214,64 @@ typedef enum md_fault_type
  * virtual to host page translation macros
  */
 
+/* compute virtual page number */
+#define MEM_VPN(ADDR)		((md_addr_t)(ADDR) >> MD_LOG_PAGE_SIZE)
+
+/* record an access of type CMD to ADDR in the page profile, after the
+   access has translated ADDR */
+#ifdef MEM_PROFILE
+#define MEM_PROF_TOUCH(MEM, ADDR, CMD)					\
+  ((MEM)->prof_on ? mem_prof_touch((MEM), (ADDR), (CMD)) : (void)0)
+#else /* !MEM_PROFILE */
+#define MEM_PROF_TOUCH(MEM, ADDR, CMD)	((void)0)
+#endif /* MEM_PROFILE */
+
+#ifdef MEM_FLAT
+
+/* convert page number IDX to a block address */
+#define MEM_PTE_ADDR(PTE, IDX)						\
+  ((void)(PTE), (md_addr_t)(IDX) << MD_LOG_PAGE_SIZE)
+
+/* host page of page number IDX */
+#define MEM_PTE_PAGE(MEM, PTE, IDX)					\
+  ((void)(PTE), (MEM)->base + MEM_PTE_ADDR(PTE, IDX))
+
+/* locate host page for virtual address ADDR, returns NULL if unallocated */
+#define MEM_PAGE(MEM, ADDR)						\
+  (((MEM)->pmap[(md_addr_t)(ADDR) >> MD_LOG_PAGE_SIZE] & MEM_PG_VALID)	\
+   ? (MEM)->base + ((md_addr_t)(ADDR) & ~(md_addr_t)(MD_PAGE_SIZE - 1))	\
+   : NULL)
+
+/* compute address of access within a host page */
+#define MEM_OFFSET(ADDR)	((ADDR) & (MD_PAGE_SIZE - 1))
+
+/* memory tickle function, the host allocates the page itself, this only
+   records that it has been written */
+#define MEM_TICKLE(MEM, ADDR)						\
+  (((MEM)->pmap[MEM_VPN(ADDR)] & (MEM_PG_VALID|MEM_PG_COW))		\
+   != MEM_PG_VALID							\
+   ? (/* first write to page at address ADDR, or since the snapshot */	\
+      mem_writepage(MEM, ADDR))						\
+   : (/* nada... */ (void)0))
+
+/* host page of virtual address ADDR right after MEM_TICKLE() */
+#define MEM_WPAGE(MEM, ADDR)						\
+  ((MEM)->base + ((md_addr_t)(ADDR) & ~(md_addr_t)(MD_PAGE_SIZE - 1)))
+
+/* check that the page of ADDR permits access PERM (MEM_PG_R/W/X), the
+   permissions live in the page map next to the tickle flags */
+#define MEM_CHECK(MEM, ADDR, PERM)					\
+  (((MEM)->pmap[MEM_VPN(ADDR)] & (PERM))				\
+   ? md_fault_none							\
+   : md_fault_access)
+
+/* memory page iterator, visits the pages written */
+#define MEM_FORALL(MEM, ITER, PTE)					\
+  for ((ITER)=0, (PTE)=NULL; (ITER) < MEM_FLAT_PAGES; (ITER)++)		\
+    if ((MEM)->pmap[(ITER)] & MEM_PG_VALID)
+
+#else /* !MEM_FLAT */
+
 /* compute page table set */
 #define MEM_PTAB_SET(ADDR)						\
   (((ADDR) >> MD_LOG_PAGE_SIZE) & (MEM_PTAB_SIZE - 1))
@@ -115,58 +285,101 @@ typedef enum md_fault_type
   (((PTE)->tag << (MD_LOG_PAGE_SIZE + MEM_LOG_PTAB_SIZE))		\
    | ((IDX) << MD_LOG_PAGE_SIZE))
 
+/* host page of PTE */
+#define MEM_PTE_PAGE(MEM, PTE, IDX)	((PTE)->page)
+
+/* translation cache entry of virtual address ADDR */
+#define MEM_TLB_ENT(MEM, ADDR)						\
+  (&(MEM)->tlb[MEM_VPN(ADDR) & (MEM_TLB_SIZE - 1)])
+
 /* locate host page for virtual address ADDR, returns NULL if unallocated */
 #define MEM_PAGE(MEM, ADDR)						\
-  (/* first attempt to hit in first entry, otherwise call xlation fn */	\
-   ((MEM)->ptab[MEM_PTAB_SET(ADDR)]					\
-    && (MEM)->ptab[MEM_PTAB_SET(ADDR)]->tag == MEM_PTAB_TAG(ADDR))	\
+  (/* first attempt to hit in the TLB, otherwise call xlation fn */	\
+   MEM_TLB_ENT(MEM, ADDR)->vpn == MEM_VPN(ADDR)				\
    ? (/* hit - return the page address on host */			\
-      (MEM)->ptab_accesses++,						\
-      (MEM)->ptab[MEM_PTAB_SET(ADDR)]->page)				\
-   : (/* first level miss - call the translation helper function */	\
+      (MEM)->tlb_hits++,						\
+      MEM_TLB_ENT(MEM, ADDR)->page)					\
+   : (/* TLB miss - call the translation helper function */		\
       mem_translate((MEM), (ADDR))))
 
 /* compute address of access within a host page */
 #define MEM_OFFSET(ADDR)	((ADDR) & (MD_PAGE_SIZE - 1))
 
-/* memory tickle function, allocates pages when they are first written */
+/* memory tickle function, allocates pages when they are first written,
+   the TLB write tag misses on unallocated and MEM_PG_COW pages */
 #define MEM_TICKLE(MEM, ADDR)						\
-  (!MEM_PAGE(MEM, ADDR)							\
-   ? (/* allocate page at address ADDR */				\
-      mem_newpage(MEM, ADDR))						\
-   : (/* nada... */ (void)0))
+  (MEM_TLB_ENT(MEM, ADDR)->wvpn == MEM_VPN(ADDR)			\
+   ? (/* hit - page is writable */					\
+      (void)(MEM)->tlb_hits++)						\
+   : (/* allocate page at address ADDR, or copy it for the snapshot */	\
+      mem_writepage(MEM, ADDR)))
+
+/* host page of virtual address ADDR right after MEM_TICKLE() */
+#define MEM_WPAGE(MEM, ADDR)	(MEM_TLB_ENT(MEM, ADDR)->page)
+
+/* check that the page of ADDR permits access PERM (MEM_PG_R/W/X), a TLB
+   hit carries the permissions of its page */
+#define MEM_CHECK(MEM, ADDR, PERM)					\
+  (MEM_TLB_ENT(MEM, ADDR)->vpn == MEM_VPN(ADDR)				\
+   ? ((MEM_TLB_ENT(MEM, ADDR)->perms & (PERM))				\
+      ? md_fault_none							\
+      : md_fault_access)						\
+   : mem_check((MEM), (ADDR), (PERM)))
 
 /* memory page iterator */
 #define MEM_FORALL(MEM, ITER, PTE)					\
   for ((ITER)=0; (ITER) < MEM_PTAB_SIZE; (ITER)++)			\
     for ((PTE)=(MEM)->ptab[i]; (PTE) != NULL; (PTE)=(PTE)->next)
 
+#endif /* MEM_FLAT */
+
 
 /*
  * memory accessors macros, fast but difficult to debug...
  */
 
-/* safe version, works only with scalar types */
-/* FIXME: write a more efficient GNU C expression for this... */
+#ifdef MEM_FLAT
+
+/* pages never written read as zero, as in the page table version; a flat
+   address needs no translation, so these skip mem_rptr()/mem_wptr() and
+   stay macros even in unoptimized builds */
+#define MEM_READ(MEM, ADDR, TYPE)					\
+  (MEM_PROF_TOUCH(MEM, (md_addr_t)(ADDR), Read),			\
+   *((TYPE *)((MEM)->base + (md_addr_t)(ADDR))))
+
+#define __UNCHK_MEM_READ(MEM, ADDR, TYPE)				\
+  (*((TYPE *)((MEM)->base + (md_addr_t)(ADDR))))
+
+#define MEM_WRITE(MEM, ADDR, TYPE, VAL)					\
+  (MEM_TICKLE(MEM, (md_addr_t)(ADDR)),					\
+   MEM_PROF_TOUCH(MEM, (md_addr_t)(ADDR), Write),			\
+   *((TYPE *)((MEM)->base + (md_addr_t)(ADDR))) = (VAL))
+
+#define __UNCHK_MEM_WRITE(MEM, ADDR, TYPE, VAL)				\
+  (*((TYPE *)((MEM)->base + (md_addr_t)(ADDR))) = (VAL))
+
+#else /* !MEM_FLAT */
+
+/* safe version, works only with scalar types, translates ADDR once through
+   mem_rptr(), pages never written read as zero */
 #define MEM_READ(MEM, ADDR, TYPE)					\
-  (MEM_PAGE(MEM, (md_addr_t)(ADDR))					\
-   ? *((TYPE *)(MEM_PAGE(MEM, (md_addr_t)(ADDR)) + MEM_OFFSET(ADDR)))	\
-   : /* page not yet allocated, return zero value */ 0)
+  (*((TYPE *)mem_rptr((MEM), (md_addr_t)(ADDR))))
 
 /* unsafe version, works with any type */
 #define __UNCHK_MEM_READ(MEM, ADDR, TYPE)				\
   (*((TYPE *)(MEM_PAGE(MEM, (md_addr_t)(ADDR)) + MEM_OFFSET(ADDR))))
 
-/* safe version, works only with scalar types */
-/* FIXME: write a more efficient GNU C expression for this... */
+/* safe version, works only with scalar types, translates ADDR once through
+   mem_wptr() */
 #define MEM_WRITE(MEM, ADDR, TYPE, VAL)					\
-  (MEM_TICKLE(MEM, (md_addr_t)(ADDR)),					\
-   *((TYPE *)(MEM_PAGE(MEM, (md_addr_t)(ADDR)) + MEM_OFFSET(ADDR))) = (VAL))
-      
+  (*((TYPE *)mem_wptr((MEM), (md_addr_t)(ADDR))) = (VAL))
+
 /* unsafe version, works with any type */
 #define __UNCHK_MEM_WRITE(MEM, ADDR, TYPE, VAL)				\
   (*((TYPE *)(MEM_PAGE(MEM, (md_addr_t)(ADDR)) + MEM_OFFSET(ADDR))) = (VAL))
 
+#endif /* MEM_FLAT */
+
 
 /* fast memory accessor macros, typed versions */
 #define MEM_READ_BYTE(MEM, ADDR)	MEM_READ(MEM, ADDR, byte_t)
@@ -218,8 +431,46 @@ void
 mem_newpage(struct mem_t *mem,		/* memory space to allocate in */
 	    md_addr_t addr);		/* virtual address to allocate */
 
+/* prepare the page at ADDR for a write, called by MEM_TICKLE() on its
+   first write since it was allocated or since mem_snapshot() */
+void
+mem_writepage(struct mem_t *mem,	/* memory space to access */
+	      md_addr_t addr);		/* virtual address to write */
+
+/* set the permissions of the pages spanning [ADDR, ADDR+NBYTES) to PERMS,
+   a MEM_PG_R/W/X mask, replacing any region with the same first page; once
+   any region is set, pages outside every region permit no access and the
+   latest region wins where they overlap.  Does nothing unless -mem:protect
+   is given, then MEM_CHECK() and mem_access() fault with md_fault_access */
+void
+mem_protect(struct mem_t *mem,		/* memory space to protect */
+	    md_addr_t addr,		/* start of region */
+	    md_addr_t nbytes,		/* size of region in bytes */
+	    int perms);			/* MEM_PG_R/W/X permissions */
+
+#ifndef MEM_FLAT
+/* check the permissions of the page at ADDR on a MEM_CHECK() TLB miss */
+enum md_fault_type
+mem_check(struct mem_t *mem,		/* memory space to access */
+	  md_addr_t addr,		/* virtual address to access */
+	  int perm);			/* MEM_PG_R/W/X access */
+#endif /* !MEM_FLAT */
+
+/* take a copy-on-write snapshot of memory space MEM, replacing any earlier
+   one; pages are shared with the snapshot until their next write, and
+   mem_restore() can roll back to it any number of times.  Register and
+   loader state (regs_t, ld_brk_point, ld_stack_min) are the caller's to
+   save alongside it */
+void
+mem_snapshot(struct mem_t *mem);	/* memory space to snapshot */
+
+/* roll memory space MEM back to its snapshot, pages allocated since are
+   dropped, the snapshot stays valid */
+void
+mem_restore(struct mem_t *mem);		/* memory space to restore */
+
 /* generic memory access function, it's safe because alignments and permissions
-   are checked, handles any natural transfer sizes; note, faults out if nbytes
+   are checked (see mem_protect()), handles any natural transfer sizes; note, faults out if nbytes
    is not a power-of-two or larger then MD_PAGE_SIZE */
 enum md_fault_type
 mem_access(struct mem_t *mem,		/* memory space to access */
@@ -228,6 +479,36 @@ mem_access(struct mem_t *mem,		/* memory space to access */
 	   void *vp,			/* host memory address to access */
 	   int nbytes);			/* number of bytes to access */
 
+/* bulk memory access function, copies NBYTES of any size and alignment
+   to/from simulated memory, one page translation and memcpy() per page
+   spanned; a Read of unallocated pages returns zeroes, a Write allocates
+   them, returns any faults encountered */
+enum md_fault_type
+mem_access_bulk(struct mem_t *mem,	/* memory space to access */
+		enum mem_cmd cmd,	/* Read (from sim mem) or Write */
+		md_addr_t addr,		/* target address to access */
+		void *vp,		/* host memory address to access */
+		int nbytes);		/* number of bytes to access */
+
+/* register -mem:protect, only simulators that check the permissions of
+   their accesses, with MEM_CHECK() or mem_access(), offer it */
+void
+mem_reg_protect(struct opt_odb_t *odb);	/* options database */
+
+/* register memory system options, CLOCK is the time source of the page
+   profile (MEM_PROFILE only) */
+void
+mem_reg_options(struct opt_odb_t *odb,	/* options database */
+		counter_t *clock);	/* profile time, e.g. sim_num_insn */
+
+#ifdef MEM_PROFILE
+/* record an access of type CMD to ADDR in the page profile */
+void
+mem_prof_touch(struct mem_t *mem,	/* memory space accessed */
+	       md_addr_t addr,		/* virtual address accessed */
+	       enum mem_cmd cmd);	/* Read or Write */
+#endif /* MEM_PROFILE */
+
 /* register memory system-specific statistics */
 void
 mem_reg_stats(struct mem_t *mem,	/* memory space to declare */
@@ -250,7 +531,8 @@ mem_dump(struct mem_t *mem,		/* memory space to display */
  * definition to access memory, the memory access function provides a "hook"
  * for programs to instrument memory accesses, this is used by various
  * simulators for various reasons; for the default operation - direct access
- * to the memory system, pass mem_access() as the memory access function
+ * to the memory system, pass mem_access() as the memory access function,
+ * the copies then go through mem_access_bulk() a page at a time
  */
 
 /* copy a '\0' terminated string to/from simulated memory space, returns
@@ -289,4 +571,58 @@ mem_bzero(mem_access_fn mem_fn,		/* user-specified memory accessor */
 	  md_addr_t addr,		/* target address to access */
 	  int nbytes);			/* number of bytes to clear */
 
+
+/*
+ * inline memory accessors, behind MEM_READ() and MEM_WRITE()
+ */
+
+#ifndef MEM_FLAT
+/* reads of pages never written are served from here */
+extern dfloat_t mem_zeroes[];
+#endif /* !MEM_FLAT */
+
+/* host address of virtual address ADDR for a read, one translation */
+static INLINE byte_t *
+mem_rptr(struct mem_t *mem,		/* memory space to access */
+	 md_addr_t addr)		/* virtual address to read */
+{
+#ifdef MEM_FLAT
+  /* pages never written read as zero, as in the page table version */
+  MEM_PROF_TOUCH(mem, addr, Read);
+  return mem->base + addr;
+#else /* !MEM_FLAT */
+  struct mem_tlb_t *tlb = MEM_TLB_ENT(mem, addr);
+  byte_t *page;
+
+  if (tlb->vpn == MEM_VPN(addr))
+    {
+      /* hit - the page address on host */
+      mem->tlb_hits++;
+      page = tlb->page;
+    }
+  else if (!(page = mem_translate(mem, addr)))
+    {
+      /* page not yet allocated, return zero value */
+      return (byte_t *)mem_zeroes;
+    }
+  MEM_PROF_TOUCH(mem, addr, Read);
+  return page + MEM_OFFSET(addr);
+#endif /* MEM_FLAT */
+}
+
+/* host address of virtual address ADDR for a write, one translation, the
+   page is allocated or copied for the snapshot as needed */
+static INLINE byte_t *
+mem_wptr(struct mem_t *mem,		/* memory space to access */
+	 md_addr_t addr)		/* virtual address to write */
+{
+  MEM_TICKLE(mem, addr);
+  MEM_PROF_TOUCH(mem, addr, Write);
+#ifdef MEM_FLAT
+  return mem->base + addr;
+#else /* !MEM_FLAT */
+  return MEM_WPAGE(mem, addr) + MEM_OFFSET(addr);
+#endif /* MEM_FLAT */
+}
+
 #endif /* MEMORY_H */
@@ -0,0 +1,377 @@
+/* prefetch.c - hardware prefetcher routines */
+
+/* SimpleScalar(TM) Tool Suite
+ * Copyright (C) 1994-2003 by Todd M. Austin, Ph.D. and SimpleScalar, LLC.
+ * All Rights Reserved. 
+ * 
+ * THIS IS A LEGAL DOCUMENT, BY USING SIMPLESCALAR,
+ * YOU ARE AGREEING TO THESE TERMS AND CONDITIONS.
+ * 
+ * No portion of this work may be used by any commercial entity, or for any
+ * commercial purpose, without the prior, written permission of SimpleScalar,
+ * LLC (info@simplescalar.com). Nonprofit and noncommercial use is permitted
+ * as described below.
+ * 
+ * 1. SimpleScalar is provided AS IS, with no warranty of any kind, express
+ * or implied. The user of the program accepts full responsibility for the
+ * application of the program and the use of any results.
+ * 
+ * 2. Nonprofit and noncommercial use is encouraged. SimpleScalar may be
+ * downloaded, compiled, executed, copied, and modified solely for nonprofit,
+ * educational, noncommercial research, and noncommercial scholarship
+ * purposes provided that this notice in its entirety accompanies all copies.
+ * Copies of the modified software can be delivered to persons who use it
+ * solely for nonprofit, educational, noncommercial research, and
+ * noncommercial scholarship purposes provided that this notice in its
+ * entirety accompanies all copies.
+ * 
+ * 3. ALL COMMERCIAL USE, AND ALL USE BY FOR PROFIT ENTITIES, IS EXPRESSLY
+ * PROHIBITED WITHOUT A LICENSE FROM SIMPLESCALAR, LLC (info@simplescalar.com).
+ * 
+ * 4. No nonprofit user may place any restrictions on the use of this software,
+ * including as modified by the user, by any other authorized user.
+ * 
+ * 5. Noncommercial and nonprofit users may distribute copies of SimpleScalar
+ * in compiled or executable form as set forth in Section 2, provided that
+ * either: (A) it is accompanied by the corresponding machine-readable source
+ * code, or (B) it is accompanied by a written offer, with no time limit, to
+ * give anyone a machine-readable copy of the corresponding source code in
+ * return for reimbursement of the cost of distribution. This written offer
+ * must permit verbatim duplication by anyone, or (C) it is distributed by
+ * someone who received only the executable form, and is accompanied by a
+ * copy of the written offer of source code.
+ * 
+ * 6. SimpleScalar was developed by Todd M. Austin, Ph.D. The tool suite is
+ * currently maintained by SimpleScalar LLC (info@simplescalar.com). US Mail:
+ * 2395 Timbercrest Court, Ann Arbor, MI 48105.
+ * 
+ * Copyright (C) 1994-2003 by Todd M. Austin, Ph.D. and SimpleScalar, LLC.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "host.h"
+#include "misc.h"
+#include "machine.h"
+#include "prefetch.h"
+
+/* block number and block address of ADDR */
+#define PF_BLOCK(pf, addr)	((addr) >> (pf)->blk_shift)
+#define PF_BADDR(pf, addr)	((addr) & ~(md_addr_t)((pf)->bsize - 1))
+
+/* confidence a stride needs before it is prefetched */
+#define RPT_CONF_MAX		3
+#define RPT_CONF_PREDICT	2
+
+/* farthest a miss may be from the last miss of a stream, in blocks, and
+   still continue it */
+#define STREAM_WINDOW		16
+
+/* create a KIND prefetcher with ENTRIES table entries that prefetches up to
+   DEGREE blocks of BSIZE bytes per trigger */
+struct prefetch_t *			/* pointer to prefetcher created */
+prefetch_create(enum prefetch_kind kind,/* prefetcher kind */
+		int entries,		/* table entries */
+		int degree,		/* prefetches per trigger */
+		int bsize)		/* cache block size */
+{
+  struct prefetch_t *pf;
+  int i;
+
+  /* check all prefetcher parameters */
+  if (entries <= 0 || (entries & (entries-1)) != 0)
+    fatal("prefetcher table entries `%d' must be a power of two", entries);
+  if (degree < 1 || degree > PREFETCH_MAX_DEGREE)
+    fatal("prefetch degree `%d' must be between 1 and %d",
+	  degree, PREFETCH_MAX_DEGREE);
+  if (bsize <= 0 || (bsize & (bsize-1)) != 0)
+    fatal("prefetch block size `%d' must be a power of two", bsize);
+
+  /* allocate the prefetcher structure */
+  pf = (struct prefetch_t *)calloc(1, sizeof(struct prefetch_t));
+  if (!pf)
+    fatal("out of virtual memory");
+
+  /* initialize user parameters */
+  pf->kind = kind;
+  pf->entries = entries;
+  pf->degree = degree;
+  pf->bsize = bsize;
+
+  /* compute derived parameters */
+  pf->blk_shift = log_base2(bsize);
+
+  /* allocate the tables of the kind */
+  switch (kind) {
+  case PF_NextLine:
+    /* no state */
+    break;
+  case PF_Stride:
+    pf->rpt = (struct pf_rpt_t *)calloc(entries, sizeof(struct pf_rpt_t));
+    if (!pf->rpt)
+      fatal("out of virtual memory");
+    break;
+  case PF_Stream:
+    pf->streams = (struct pf_stream_t *)
+      calloc(entries, sizeof(struct pf_stream_t));
+    if (!pf->streams)
+      fatal("out of virtual memory");
+    pf->stream_stamp = 0;
+    break;
+  case PF_GHB:
+    pf->ghb = (struct pf_ghb_t *)calloc(entries, sizeof(struct pf_ghb_t));
+    pf->index = (struct pf_index_t *)
+      calloc(entries, sizeof(struct pf_index_t));
+    if (!pf->ghb || !pf->index)
+      fatal("out of virtual memory");
+    for (i=0; i < entries; i++)
+      {
+	pf->ghb[i].link = -1;
+	pf->index[i].pos = -1;
+      }
+    pf->ghb_count = 0;
+    break;
+  default:
+    panic("bogus prefetcher kind");
+  }
+
+  return pf;
+}
+
+/* parse prefetcher kind */
+enum prefetch_kind			/* prefetcher kind enum */
+prefetch_char2kind(char c)		/* prefetcher kind as a char */
+{
+  switch (c) {
+  case 'n': return PF_NextLine;
+  case 'p': return PF_Stride;
+  case 's': return PF_Stream;
+  case 'g': return PF_GHB;
+  default: fatal("bogus prefetcher kind, `%c'", c);
+  }
+}
+
+/* return the name of prefetcher kind KIND */
+char *					/* prefetcher kind name */
+prefetch_kind_name(enum prefetch_kind kind)
+{
+  switch (kind) {
+  case PF_NextLine: return "next-line";
+  case PF_Stride: return "PC stride";
+  case PF_Stream: return "stream";
+  case PF_GHB: return "GHB";
+  default: panic("bogus prefetcher kind");
+  }
+}
+
+/* the next DEGREE blocks after the one of ADDR */
+static int				/* number of blocks to prefetch */
+next_line(struct prefetch_t *pf,	/* prefetcher to train */
+	  md_addr_t addr,		/* address accessed */
+	  md_addr_t *targets)		/* for blocks to prefetch */
+{
+  int n;
+
+  for (n=0; n < pf->degree; n++)
+    targets[n] = PF_BADDR(pf, addr) + (n+1) * pf->bsize;
+  return n;
+}
+
+/* train the reference prediction table with an access to ADDR at PC, and
+   predict the next DEGREE strides once the stride is confirmed */
+static int				/* number of blocks to prefetch */
+pc_stride(struct prefetch_t *pf,	/* prefetcher to train */
+	  md_addr_t pc,			/* PC of the access */
+	  md_addr_t addr,		/* address accessed */
+	  md_addr_t *targets)		/* for blocks to prefetch */
+{
+  struct pf_rpt_t *e = &pf->rpt[(pc >> 2) & (pf->entries - 1)];
+  sword_t stride;
+  md_addr_t baddr, last = PF_BADDR(pf, addr);
+  int k, n;
+
+  if (e->pc != pc)
+    {
+      /* a new instruction, start over */
+      e->pc = pc;
+      e->last = addr;
+      e->stride = 0;
+      e->conf = 0;
+      return 0;
+    }
+
+  stride = (sword_t)(addr - e->last);
+  e->last = addr;
+  if (stride == e->stride)
+    e->conf = MIN(e->conf + 1, RPT_CONF_MAX);
+  else if (e->conf > 0)
+    e->conf--;
+  else
+    e->stride = stride;
+
+  if (e->conf < RPT_CONF_PREDICT || e->stride == 0)
+    return 0;
+
+  for (n=0,k=1; k <= pf->degree; k++)
+    {
+      /* strides within a block prefetch the blocks that follow */
+      if (e->stride >= pf->bsize || -e->stride >= pf->bsize)
+	baddr = PF_BADDR(pf, addr + k * e->stride);
+      else
+	baddr = PF_BADDR(pf, addr) + k * (e->stride > 0 ? pf->bsize
+					  : -pf->bsize);
+      if (baddr != last)
+	targets[n++] = last = baddr;
+    }
+  return n;
+}
+
+/* continue the stream a miss to ADDR belongs to, or start a new one, and
+   keep the stream DEGREE blocks ahead of its misses */
+static int				/* number of blocks to prefetch */
+stream(struct prefetch_t *pf,		/* prefetcher to train */
+       md_addr_t addr,			/* address missed */
+       md_addr_t *targets)		/* for blocks to prefetch */
+{
+  md_addr_t b = PF_BLOCK(pf, addr), up, down, ahead;
+  struct pf_stream_t *s, *lru = NULL, *match = NULL;
+  int i, n;
+
+  /* find a stream the miss continues */
+  for (i=0; i < pf->entries; i++)
+    {
+      s = &pf->streams[i];
+      if (!s->valid)
+	{
+	  if (!lru || lru->valid)
+	    lru = s;
+	  continue;
+	}
+      if (!lru || (lru->valid && s->stamp < lru->stamp))
+	lru = s;
+
+      up = b - s->last;
+      down = s->last - b;
+      if (s->dir >= 0 && up >= 1 && up <= STREAM_WINDOW)
+	{
+	  s->dir = 1;
+	  match = s;
+	  break;
+	}
+      if (s->dir <= 0 && down >= 1 && down <= STREAM_WINDOW)
+	{
+	  s->dir = -1;
+	  match = s;
+	  break;
+	}
+    }
+
+  if (!match)
+    {
+      /* start a new stream, its direction is known at its next miss */
+      s = lru;
+      s->valid = TRUE;
+      s->last = b;
+      s->head = b;
+      s->dir = 0;
+      s->stamp = ++pf->stream_stamp;
+      return 0;
+    }
+
+  s = match;
+  s->last = b;
+  s->stamp = ++pf->stream_stamp;
+
+  /* restart a stream that fell behind its misses */
+  ahead = s->dir > 0 ? s->head - b : b - s->head;
+  if (ahead == 0 || ahead > STREAM_WINDOW + pf->degree)
+    {
+      s->head = b + s->dir;
+      ahead = 1;
+    }
+
+  for (n=0; ahead <= (md_addr_t)pf->degree; ahead++)
+    {
+      targets[n++] = s->head << pf->blk_shift;
+      s->head += s->dir;
+    }
+  return n;
+}
+
+/* insert a miss to ADDR into the global history buffer, and predict the
+   DEGREE misses that followed the earlier misses to the same block, walking
+   their links back from the last one (address correlation) */
+static int				/* number of blocks to prefetch */
+ghb(struct prefetch_t *pf,		/* prefetcher to train */
+    md_addr_t addr,			/* address missed */
+    md_addr_t *targets)			/* for blocks to prefetch */
+{
+  md_addr_t baddr = PF_BADDR(pf, addr), b = PF_BLOCK(pf, addr), target;
+  struct pf_index_t *ix;
+  sqword_t prev, next, pos, oldest;
+  int i, n;
+
+  ix = &pf->index[(b ^ (b >> log_base2(pf->entries))) & (pf->entries - 1)];
+  prev = ix->baddr == baddr ? ix->pos : -1;
+
+  /* insert the miss, the oldest entry falls out */
+  pos = pf->ghb_count++;
+  pf->ghb[pos & (pf->entries - 1)].baddr = baddr;
+  pf->ghb[pos & (pf->entries - 1)].link = prev;
+  ix->baddr = baddr;
+  ix->pos = pos;
+
+  /* each earlier miss to the block still in the buffer predicts the misses
+     that followed it up to the next miss to the block, newest first */
+  oldest = pf->ghb_count - pf->entries;
+  for (n=0; n < pf->degree && prev >= 0 && prev >= oldest;
+       prev = pf->ghb[prev & (pf->entries - 1)].link)
+    {
+      for (next=prev+1; n < pf->degree && next < pos; next++)
+	{
+	  target = pf->ghb[next & (pf->entries - 1)].baddr;
+	  if (target == baddr)
+	    break;
+
+	  /* predicted by a later miss already? */
+	  for (i=0; i < n && targets[i] != target; i++)
+	    /* nada */;
+	  if (i == n)
+	    targets[n++] = target;
+	}
+    }
+  return n;
+}
+
+/* train prefetcher PF with a demand access to ADDR by the instruction at
+   PC, MISS if it missed the cache and PF_HIT if it was the first hit on a
+   prefetched block, places the block addresses to prefetch in TARGETS,
+   returns how many there are */
+int					/* number of blocks to prefetch */
+prefetch_train(struct prefetch_t *pf,	/* prefetcher to train */
+	       md_addr_t pc,		/* PC of the access */
+	       md_addr_t addr,		/* address accessed */
+	       int miss,		/* did the access miss? */
+	       int pf_hit,		/* first hit on a prefetched block? */
+	       md_addr_t *targets)	/* for blocks to prefetch, DEGREE */
+{
+  /* all but the stride prefetcher train on misses and the hits that would
+     have been misses */
+  if (pf->kind != PF_Stride && !miss && !pf_hit)
+    return 0;
+
+  switch (pf->kind) {
+  case PF_NextLine:
+    return next_line(pf, addr, targets);
+  case PF_Stride:
+    return pc_stride(pf, pc, addr, targets);
+  case PF_Stream:
+    return stream(pf, addr, targets);
+  case PF_GHB:
+    return ghb(pf, addr, targets);
+  default:
+    panic("bogus prefetcher kind");
+  }
+}
@@ -0,0 +1,177 @@
+/* prefetch.h - hardware prefetcher interfaces */
+
+/* SimpleScalar(TM) Tool Suite
+ * Copyright (C) 1994-2003 by Todd M. Austin, Ph.D. and SimpleScalar, LLC.
+ * All Rights Reserved. 
+ * 
+ * THIS IS A LEGAL DOCUMENT, BY USING SIMPLESCALAR,
+ * YOU ARE AGREEING TO THESE TERMS AND CONDITIONS.
+ * 
+ * No portion of this work may be used by any commercial entity, or for any
+ * commercial purpose, without the prior, written permission of SimpleScalar,
+ * LLC (info@simplescalar.com). Nonprofit and noncommercial use is permitted
+ * as described below.
+ * 
+ * 1. SimpleScalar is provided AS IS, with no warranty of any kind, express
+ * or implied. The user of the program accepts full responsibility for the
+ * application of the program and the use of any results.
+ * 
+ * 2. Nonprofit and noncommercial use is encouraged. SimpleScalar may be
+ * downloaded, compiled, executed, copied, and modified solely for nonprofit,
+ * educational, noncommercial research, and noncommercial scholarship
+ * purposes provided that this notice in its entirety accompanies all copies.
+ * Copies of the modified software can be delivered to persons who use it
+ * solely for nonprofit, educational, noncommercial research, and
+ * noncommercial scholarship purposes provided that this notice in its
+ * entirety accompanies all copies.
+ * 
+ * 3. ALL COMMERCIAL USE, AND ALL USE BY FOR PROFIT ENTITIES, IS EXPRESSLY
+ * PROHIBITED WITHOUT A LICENSE FROM SIMPLESCALAR, LLC (info@simplescalar.com).
+ * 
+ * 4. No nonprofit user may place any restrictions on the use of this software,
+ * including as modified by the user, by any other authorized user.
+ * 
+ * 5. Noncommercial and nonprofit users may distribute copies of SimpleScalar
+ * in compiled or executable form as set forth in Section 2, provided that
+ * either: (A) it is accompanied by the corresponding machine-readable source
+ * code, or (B) it is accompanied by a written offer, with no time limit, to
+ * give anyone a machine-readable copy of the corresponding source code in
+ * return for reimbursement of the cost of distribution. This written offer
+ * must permit verbatim duplication by anyone, or (C) it is distributed by
+ * someone who received only the executable form, and is accompanied by a
+ * copy of the written offer of source code.
+ * 
+ * 6. SimpleScalar was developed by Todd M. Austin, Ph.D. The tool suite is
+ * currently maintained by SimpleScalar LLC (info@simplescalar.com). US Mail:
+ * 2395 Timbercrest Court, Ann Arbor, MI 48105.
+ * 
+ * Copyright (C) 1994-2003 by Todd M. Austin, Ph.D. and SimpleScalar, LLC.
+ */
+
+
+#ifndef PREFETCH_H
+#define PREFETCH_H
+
+#include <stdio.h>
+
+#include "host.h"
+#include "misc.h"
+#include "machine.h"
+
+/*
+ * This module predicts the blocks a cache will want next.  A cache with a
+ * prefetcher attached, see cache_prefetcher(), trains it with each demand
+ * access and issues the block addresses it returns, the cache module owns
+ * the prefetch buffer, the fills and the stats, this module only holds the
+ * prediction tables.  The prefetchers are:
+ *
+ *   next-line	on a miss, or the first hit on a prefetched block (tagged
+ *		prefetching), the next DEGREE blocks
+ *   PC stride	a reference prediction table indexed by the PC of the
+ *		access, once an instruction strides the same way twice in a
+ *		row, the next DEGREE strides (or blocks, for strides shorter
+ *		than a block) ahead of it
+ *   stream	a table of streams of misses, a miss near the last one of a
+ *		stream that already has a direction keeps the stream DEGREE
+ *		blocks ahead of the misses
+ *   GHB	a global history buffer of misses, an index table finds the
+ *		last miss to the same block and each miss links to the one
+ *		to its block before it, the DEGREE misses that followed
+ *		those, newest first (address correlation)
+ */
+
+/* prefetcher kinds */
+enum prefetch_kind {
+  PF_NextLine,		/* next-line, tagged */
+  PF_Stride,		/* PC-indexed stride (reference prediction table) */
+  PF_Stream,		/* stream detection */
+  PF_GHB		/* global history buffer, address correlation */
+};
+
+/* most prefetches one access may trigger */
+#define PREFETCH_MAX_DEGREE	16
+
+/* reference prediction table entry */
+struct pf_rpt_t
+{
+  md_addr_t pc;			/* PC of the instruction tracked */
+  md_addr_t last;		/* address it accessed last */
+  sword_t stride;		/* last stride seen */
+  int conf;			/* 2-bit confidence in the stride */
+};
+
+/* stream table entry, positions are block numbers */
+struct pf_stream_t
+{
+  int valid;			/* entry in use? */
+  md_addr_t last;		/* block of the last miss of the stream */
+  md_addr_t head;		/* next block to prefetch */
+  int dir;			/* +1 ascending, -1 descending, 0 unknown */
+  word_t stamp;			/* time of last use, for replacement */
+};
+
+/* global history buffer entry, positions count the misses ever inserted */
+struct pf_ghb_t
+{
+  md_addr_t baddr;		/* block address missed */
+  sqword_t link;		/* position of the miss to the same block
+				   before it, or -1 */
+};
+
+/* index table entry of the global history buffer */
+struct pf_index_t
+{
+  md_addr_t baddr;		/* block address indexed */
+  sqword_t pos;			/* position of its last miss, or -1 */
+};
+
+/* prefetcher definition */
+struct prefetch_t
+{
+  /* parameters */
+  enum prefetch_kind kind;	/* prefetcher kind */
+  int entries;			/* table entries (RPT, streams, or GHB) */
+  int degree;			/* prefetches per trigger */
+  int bsize;			/* block size of the cache prefetched for */
+
+  /* derived data */
+  int blk_shift;		/* log2 of the block size */
+
+  /* tables, only those of the kind are allocated */
+  struct pf_rpt_t *rpt;		/* PC stride reference prediction table */
+  struct pf_stream_t *streams;	/* stream table */
+  word_t stream_stamp;		/* last stream stamp handed out */
+  struct pf_ghb_t *ghb;		/* global history buffer */
+  struct pf_index_t *index;	/* its index table */
+  sqword_t ghb_count;		/* misses inserted into the GHB */
+};
+
+/* create a KIND prefetcher with ENTRIES table entries that prefetches up to
+   DEGREE blocks of BSIZE bytes per trigger */
+struct prefetch_t *			/* pointer to prefetcher created */
+prefetch_create(enum prefetch_kind kind,/* prefetcher kind */
+		int entries,		/* table entries */
+		int degree,		/* prefetches per trigger */
+		int bsize);		/* cache block size */
+
+/* parse prefetcher kind */
+enum prefetch_kind			/* prefetcher kind enum */
+prefetch_char2kind(char c);		/* prefetcher kind as a char */
+
+/* return the name of prefetcher kind KIND */
+char *					/* prefetcher kind name */
+prefetch_kind_name(enum prefetch_kind kind);
+
+/* train prefetcher PF with a demand access to ADDR by the instruction at
+   PC, MISS if it missed the cache and PF_HIT if it was the first hit on a
+   prefetched block, places the block addresses to prefetch in TARGETS,
+   returns how many there are */
+int					/* number of blocks to prefetch */
+prefetch_train(struct prefetch_t *pf,	/* prefetcher to train */
+	       md_addr_t pc,		/* PC of the access */
+	       md_addr_t addr,		/* address accessed */
+	       int miss,		/* did the access miss? */
+	       int pf_hit,		/* first hit on a prefetched block? */
+	       md_addr_t *targets);	/* for blocks to prefetch, DEGREE */
+
+#endif /* PREFETCH_H */
@@ -63,6 +63,7 @@
 #include "cache.h"
 #include "loader.h"
 #include "syscall.h"
+#include "eio.h"
 #include "dlite.h"
 #include "sim.h"
 
@@ -71,7 +72,9 @@
  * generated for a user-selected cache and TLB configuration, which may include
  * up to two levels of instruction and data cache (with any levels unified),
  * and one level of instruction and data TLBs.  No timing information is
- * generated (hence the distinction, "functional" simulator).
+ * generated (hence the distinction, "functional" simulator).  Any number of
+ * other data cache configurations can be evaluated in the same run, see
+ * -cache:sweep and -cache:stack.
  */
 
 /* simulated registers */
@@ -104,6 +107,10 @@ static struct cache_t *itlb = NULL;
 /* data TLB */
 static struct cache_t *dtlb = NULL;
 
+/* sweep data caches, fed the same data references as dl1 */
+#define MAX_SWEEP_CACHES 64
+static struct cache_t *sweep_caches[MAX_SWEEP_CACHES];
+
 /* text-based stat profiles */
 #define MAX_PCSTAT_VARS 8
 static struct stat_stat_t *pcstat_stats[MAX_PCSTAT_VARS];
@@ -226,6 +233,19 @@ dtlb_access_fn(enum mem_cmd cmd,	/* access cmd, Read or Write */
   return /* access latency, ignored */1;
 }
 
+/* sweep cache block miss handler function */
+static unsigned int			/* latency of block access */
+sweep_access_fn(enum mem_cmd cmd,	/* access cmd, Read or Write */
+		md_addr_t baddr,	/* block address to access */
+		int bsize,		/* size of block to access */
+		struct cache_blk_t *blk,/* ptr to block in upper level */
+		tick_t now)		/* time of access */
+{
+  /* sweep caches stand alone, a miss goes to main memory, which is always
+     done in the main simulator loop */
+  return /* access latency, ignored */1;
+}
+
 /* cache/TLB options */
 static char *cache_dl1_opt /* = "none" */;
 static char *cache_dl2_opt /* = "none" */;
@@ -235,11 +255,152 @@ static char *itlb_opt /* = "none" */;
 static char *dtlb_opt /* = "none" */;
 static int flush_on_syscalls /* = FALSE */;
 static int compress_icache_addrs /* = FALSE */;
+static char *cache_trace_opt /* = "none" */;
+
+/* external I/O of the run recording the reference streams, <prefix>.eio */
+static char trace_eio_fname[1024];
+static FILE *trace_eio_fd = NULL;
+static int trace_replay = FALSE;
+
+/* does cache CP replay a recorded reference stream? */
+#define OPT_CACHE(CP)		((CP) != NULL && (CP)->policy == OPT)
+static int cache_il1_nvc /* = 0 */;
+static int cache_dl1_nvc /* = 0 */;
+static int cache_il2_nvc /* = 0 */;
+static int cache_dl2_nvc /* = 0 */;
+static char *cache_inclusion_opt /* = "n" */;
+
+/* sweep cache options */
+static int sweep_nelt = 0;
+static char *sweep_opts[MAX_SWEEP_CACHES];
+static char *stack_opt /* = "none" */;
 
 /* text-based stat profiles */
 static int pcstat_nelt = 0;
 static char *pcstat_vars[MAX_PCSTAT_VARS];
 
+/*
+ * LRU stack distance (Mattson) engine, one pass yields the misses of every
+ * LRU data cache of one block size with any power-of-two number of sets up
+ * to stack_nsets and any associativity up to stack_assoc: each level keeps
+ * an LRU stack of block addresses per set, cut off at stack_assoc entries,
+ * and a reference found at depth D of its set's stack hits in every cache
+ * with that many sets and more than D ways
+ */
+
+/* stack engine state for one number of sets */
+struct stack_level_t {
+  int nsets;			/* number of sets */
+  md_addr_t *tags;		/* per-set LRU stacks, most recent first */
+  int *fill;			/* entries in use in each set's stack */
+  counter_t *hits;		/* references found at each depth */
+};
+
+static int stack_bsize, stack_nsets, stack_assoc;
+static int stack_nlevels = 0;		/* levels in use, 0 if none */
+static struct stack_level_t *stack_levels = NULL;
+static counter_t stack_refs = 0;	/* references seen by the engine */
+
+/* create the stack engine levels, 1 to STACK_NSETS sets */
+static void
+stack_create(void)
+{
+  int i, nsets;
+  struct stack_level_t *lv;
+
+  for (nsets=1; nsets <= stack_nsets; nsets <<= 1)
+    stack_nlevels++;
+
+  stack_levels = calloc(stack_nlevels, sizeof(struct stack_level_t));
+  if (!stack_levels)
+    fatal("out of virtual memory");
+
+  for (i=0, nsets=1; i < stack_nlevels; i++, nsets <<= 1)
+    {
+      lv = &stack_levels[i];
+      lv->nsets = nsets;
+      lv->tags = calloc(nsets * stack_assoc, sizeof(md_addr_t));
+      lv->fill = calloc(nsets, sizeof(int));
+      lv->hits = calloc(stack_assoc, sizeof(counter_t));
+      if (!lv->tags || !lv->fill || !lv->hits)
+	fatal("out of virtual memory");
+    }
+}
+
+/* look up the block of ADDR in every level and move it to the top */
+static void
+stack_access(md_addr_t addr)		/* data address accessed */
+{
+  int i, d, n;
+  md_addr_t blk = addr / stack_bsize, *tags;
+  struct stack_level_t *lv;
+
+  stack_refs++;
+  for (i=0; i < stack_nlevels; i++)
+    {
+      lv = &stack_levels[i];
+      tags = lv->tags + (blk & (lv->nsets - 1)) * stack_assoc;
+      n = lv->fill[blk & (lv->nsets - 1)];
+
+      for (d=0; d < n && tags[d] != blk; d++)
+	/* nada */;
+
+      if (d < n)
+	lv->hits[d]++;
+      else if (n < stack_assoc)
+	{
+	  /* miss, the stack grows by one */
+	  lv->fill[blk & (lv->nsets - 1)]++;
+	}
+      else
+	{
+	  /* miss, the bottom entry falls off */
+	  d = stack_assoc - 1;
+	}
+
+      memmove(tags + 1, tags, d * sizeof(md_addr_t));
+      tags[0] = blk;
+    }
+}
+
+/* empty every stack, as a cache flush would */
+static void
+stack_flush(void)
+{
+  int i;
+
+  for (i=0; i < stack_nlevels; i++)
+    memset(stack_levels[i].fill, 0, stack_levels[i].nsets * sizeof(int));
+}
+
+/* feed a data reference to the sweep caches and the stack engine */
+static void
+sweep_access(enum mem_cmd cmd,		/* access cmd, Read or Write */
+	     md_addr_t addr,		/* data address accessed */
+	     int nbytes)		/* size of the access */
+{
+  int i;
+
+  for (i=0; i < sweep_nelt; i++)
+    cache_access(sweep_caches[i], cmd, addr, NULL, nbytes, 0, NULL, NULL);
+  if (stack_nlevels)
+    stack_access(addr);
+}
+
+/* flush the sweep caches and the stack engine */
+static void
+sweep_flush(void)
+{
+  int i;
+
+  for (i=0; i < sweep_nelt; i++)
+    cache_flush(sweep_caches[i], 0);
+  stack_flush();
+}
+
+/* non-zero if any sweep caches or the stack engine are in use */
+#define SWEEP_ON		(sweep_nelt || stack_nlevels)
+
 /* convert 64-bit inst text addresses to 32-bit inst equivalents */
 #ifdef TARGET_PISA
 #define IACOMPRESS(A)							\
@@ -268,6 +429,9 @@ sim_reg_options(struct opt_odb_t *odb)	/* options database */
 	       &max_insts, /* default */0,
 	       /* print */TRUE, /* format */NULL);
 
+  /* page permissions, checked on every access */
+  mem_reg_protect(odb);
+
   opt_reg_string(odb, "-cache:dl1",
 		 "l1 data cache config, i.e., {<config>|none}",
 		 &cache_dl1_opt, "dl1:256:32:1:l", /* print */TRUE, NULL);
@@ -280,7 +444,9 @@ sim_reg_options(struct opt_odb_t *odb)	/* options database */
 "    <nsets>  - number of sets in the cache\n"
 "    <bsize>  - block size of the cache\n"
 "    <assoc>  - associativity of the cache\n"
-"    <repl>   - block replacement strategy, 'l'-LRU, 'f'-FIFO, 'r'-random\n"
+"    <repl>   - block replacement strategy, 'l'-LRU, 'f'-FIFO, 'r'-random,\n"
+"               'p'-tree PLRU, 's'-SRRIP, 'b'-BRRIP, 'd'-DRRIP,\n"
+"               'o'-OPT (Belady, see -cache:trace)\n"
 "\n"
 "    Examples:   -cache:dl1 dl1:4096:32:1:l\n"
 "                -dtlb dtlb:128:4096:32:r\n"
@@ -307,6 +473,30 @@ sim_reg_options(struct opt_odb_t *odb)	/* options database */
   opt_reg_string(odb, "-cache:il2",
 		 "l2 instruction cache config, i.e., {<config>|dl2|none}",
 		 &cache_il2_opt, "dl2", /* print */TRUE, NULL);
+  opt_reg_int(odb, "-cache:il1vc",
+	      "l1 inst cache victim cache entries, 0 for none",
+	      &cache_il1_nvc, /* default */0, /* print */TRUE, NULL);
+  opt_reg_int(odb, "-cache:dl1vc",
+	      "l1 data cache victim cache entries, 0 for none",
+	      &cache_dl1_nvc, /* default */0, /* print */TRUE, NULL);
+  opt_reg_int(odb, "-cache:il2vc",
+	      "l2 inst cache victim cache entries, 0 for none",
+	      &cache_il2_nvc, /* default */0, /* print */TRUE, NULL);
+  opt_reg_int(odb, "-cache:dl2vc",
+	      "l2 data cache victim cache entries, 0 for none",
+	      &cache_dl2_nvc, /* default */0, /* print */TRUE, NULL);
+  opt_reg_string(odb, "-cache:inclusion",
+		 "l2 cache inclusion of the l1 caches, i.e., {n|i|e}",
+		 &cache_inclusion_opt, "n", /* print */TRUE, NULL);
+  opt_reg_note(odb,
+"  The l2 caches are non-inclusive (n) by default, an inclusive (i) l2\n"
+"  invalidates the blocks it evicts in the l1 caches, an exclusive (e) l2\n"
+"  hands the blocks the l1s read up to them, and takes in the blocks they\n"
+"  evict, it must have their block size and cannot use OPT replacement.\n"
+"  A victim cache holds the last blocks its cache replaced, fully\n"
+"  associative and LRU, and a miss to one of them swaps it back in and\n"
+"  counts as a hit.\n"
+	       );
   opt_reg_string(odb, "-tlb:itlb",
 		 "instruction TLB config, i.e., {<config>|none}",
 		 &itlb_opt, "itlb:16:4096:4:l", /* print */TRUE, NULL);
@@ -319,12 +509,66 @@ sim_reg_options(struct opt_odb_t *odb)	/* options database */
 	       "convert 64-bit inst addresses to 32-bit inst equivalents",
 	       &compress_icache_addrs, /* default */FALSE,
 	       /* print */TRUE, NULL);
+  opt_reg_string(odb, "-cache:trace",
+		 "file name prefix of recorded cache reference streams, "
+		 "i.e., {<prefix>|none}",
+		 &cache_trace_opt, "none", /* print */TRUE, NULL);
+  opt_reg_note(odb,
+"  OPT replacement needs the future references of its cache, so it takes two\n"
+"  runs of the same program and options: the first records the reference\n"
+"  stream of each cache to <prefix>.<name>, and the initial state and system\n"
+"  calls of the program to <prefix>.eio, the second, with 'o' in place of the\n"
+"  policy of the caches to study, runs from <prefix>.eio and replays the\n"
+"  streams (caches not using OPT record theirs again).  Everything upstream\n"
+"  of an OPT cache must stay the same between the runs, e.g.,\n"
+"\n"
+"    -cache:dl2 ul2:1024:64:8:l -cache:trace /tmp/run1\n"
+"    -cache:dl2 ul2:1024:64:8:o -cache:trace /tmp/run1\n"
+	       );
 
   opt_reg_string_list(odb, "-pcstat",
 		      "profile stat(s) against text addr's (mult uses ok)",
 		      pcstat_vars, MAX_PCSTAT_VARS, &pcstat_nelt, NULL,
 		      /* !print */FALSE, /* format */NULL, /* accrue */TRUE);
 
+  opt_reg_string_list(odb, "-cache:sweep",
+		      "extra data cache config(s) fed dl1's references, "
+		      "results in one table (mult uses ok)",
+		      sweep_opts, MAX_SWEEP_CACHES, &sweep_nelt, NULL,
+		      /* print */TRUE, /* format */NULL, /* accrue */TRUE);
+
+  opt_reg_string(odb, "-cache:stack",
+		 "LRU stack distance engine for dl1's references, i.e., "
+		 "{<bsize>:<max_nsets>:<max_assoc>|none}",
+		 &stack_opt, "none", /* print */TRUE, NULL);
+  opt_reg_note(odb,
+"  A single run can evaluate many data cache configurations at once, each\n"
+"  -cache:sweep <config> (same format as -cache:dl1) adds a stand-alone cache\n"
+"  that sees every data reference, and -cache:stack gives the misses of all\n"
+"  LRU caches of one block size with power-of-two sets up to <max_nsets> and\n"
+"  up to <max_assoc> ways from their stack distances.  Results are printed as\n"
+"  one table keyed by configuration, e.g.,\n"
+"\n"
+"    -cache:sweep s1:128:32:2:l -cache:sweep s2:256:32:2:f\n"
+"    -cache:stack 32:1024:8\n"
+	       );
+}
+
+/* give the WHICH cache CP a victim cache of NVC entries, if NVC */
+static void
+vc_config(struct cache_t *cp,		/* cache to add it to */
+	  int nvc,			/* victim cache entries */
+	  char *which)			/* which cache, for errors */
+{
+  if (!nvc)
+    return;
+
+  if (!cp)
+    fatal("the %s cache must be defined to have a victim cache", which);
+  if (cp->nvc)
+    fatal("the %s cache shares a cache that already has a victim cache",
+	  which);
+  cache_victims(cp, nvc);
 }
 
 /* check simulator-specific option values */
@@ -333,7 +577,8 @@ sim_check_options(struct opt_odb_t *odb,	/* options database */
 		  int argc, char **argv)	/* command line arguments */
 {
   char name[128], c;
-  int nsets, bsize, assoc;
+  int i, nsets, bsize, assoc;
+  enum cache_inclusion inclusion;
 
   /* use a level 1 D-cache? */
   if (!mystricmp(cache_dl1_opt, "none"))
@@ -458,6 +703,87 @@ sim_check_options(struct opt_odb_t *odb,	/* options database */
 			  cache_char2policy(c), dtlb_access_fn,
 			  /* hit latency */1);
     }
+
+  /* attach the victim caches, a cache shared by two levels gets one */
+  vc_config(cache_dl1, cache_dl1_nvc, "l1 data");
+  vc_config(cache_dl2, cache_dl2_nvc, "l2 data");
+  vc_config(cache_il1, cache_il1_nvc, "l1 inst");
+  vc_config(cache_il2, cache_il2_nvc, "l2 inst");
+
+  /* tie the l1 caches to their l2 caches */
+  if (!cache_inclusion_opt[0] || cache_inclusion_opt[1])
+    fatal("bad l2 cache inclusion policy, `%s'", cache_inclusion_opt);
+  inclusion = cache_char2inclusion(cache_inclusion_opt[0]);
+  if (inclusion != NonInclusive)
+    {
+      if (cache_dl2)
+	cache_inclusion(cache_dl2, inclusion, cache_dl1);
+      if (cache_il2 && cache_il1 != cache_dl1 && cache_il1 != cache_dl2)
+	cache_inclusion(cache_il2, inclusion, cache_il1);
+    }
+
+  /* sweep data caches */
+  for (i=0; i < sweep_nelt; i++)
+    {
+      if (sscanf(sweep_opts[i], "%[^:]:%d:%d:%d:%c",
+		 name, &nsets, &bsize, &assoc, &c) != 5)
+	fatal("bad sweep cache parms: <name>:<nsets>:<bsize>:<assoc>:<repl>");
+      sweep_caches[i] = cache_create(name, nsets, bsize, /* balloc */FALSE,
+				     /* usize */0, assoc, cache_char2policy(c),
+				     sweep_access_fn, /* hit latency */1);
+    }
+
+  /* use the stack distance engine? */
+  if (mystricmp(stack_opt, "none"))
+    {
+      if (sscanf(stack_opt, "%d:%d:%d",
+		 &stack_bsize, &stack_nsets, &stack_assoc) != 3)
+	fatal("bad stack engine parms: <bsize>:<max_nsets>:<max_assoc>");
+      if (stack_bsize <= 0 || (stack_bsize & (stack_bsize - 1)) != 0)
+	fatal("stack engine block size `%d' is not a power of two",
+	      stack_bsize);
+      if (stack_nsets <= 0 || (stack_nsets & (stack_nsets - 1)) != 0)
+	fatal("stack engine sets `%d' is not a power of two", stack_nsets);
+      if (stack_assoc <= 0)
+	fatal("stack engine associativity must be positive");
+      stack_create();
+    }
+
+  /* record the reference streams, or replay them to the OPT caches */
+  if (mystricmp(cache_trace_opt, "none"))
+    {
+      if (cache_il1)
+	cache_trace(cache_il1, cache_trace_opt);
+      if (cache_il2)
+	cache_trace(cache_il2, cache_trace_opt);
+      if (cache_dl1)
+	cache_trace(cache_dl1, cache_trace_opt);
+      if (cache_dl2)
+	cache_trace(cache_dl2, cache_trace_opt);
+      if (itlb)
+	cache_trace(itlb, cache_trace_opt);
+      if (dtlb)
+	cache_trace(dtlb, cache_trace_opt);
+      for (i=0; i < sweep_nelt; i++)
+	cache_trace(sweep_caches[i], cache_trace_opt);
+
+      /* the program makes the same references again only if it sees the
+	 same system call results, so the recording run keeps its initial
+	 state and system calls in <prefix>.eio, and a run replaying any
+	 stream runs from there rather than from the host */
+      trace_replay = (OPT_CACHE(cache_il1) || OPT_CACHE(cache_il2)
+		      || OPT_CACHE(cache_dl1) || OPT_CACHE(cache_dl2)
+		      || OPT_CACHE(itlb) || OPT_CACHE(dtlb));
+      for (i=0; i < sweep_nelt; i++)
+	trace_replay |= OPT_CACHE(sweep_caches[i]);
+
+      if (strlen(cache_trace_opt) + sizeof(".eio") > sizeof(trace_eio_fname))
+	fatal("EIO file name `%s.eio' is too long", cache_trace_opt);
+      sprintf(trace_eio_fname, "%s.eio", cache_trace_opt);
+      if (trace_replay && !eio_valid(trace_eio_fname))
+	fatal("cannot open EIO file `%s', record it with a run that does not "
+	      "use OPT replacement", trace_eio_fname);
+    }
 }
 
 /* initialize the simulator */
@@ -494,9 +820,27 @@ sim_load_prog(char *fname,		/* program to load */
 	      int argc, char **argv,	/* program arguments */
 	      char **envp)		/* program environment */
 {
+  /* replay the recording run, see -cache:trace */
+  if (trace_replay)
+    {
+      char *eio_argv[1];
+
+      fname = eio_argv[0] = trace_eio_fname;
+      argc = 1;
+      argv = eio_argv;
+    }
+
   /* load program text and data, set up environment, memory, and regs */
   ld_load_prog(fname, argc, argv, envp, &regs, mem, TRUE);
 
+  /* record the initial state of the run, see -cache:trace */
+  if (mystricmp(cache_trace_opt, "none") && !trace_replay)
+    {
+      trace_eio_fd = eio_create(trace_eio_fname);
+      if (eio_write_chkpt(&regs, mem, trace_eio_fd) != -1)
+	panic("checkpoint code is broken");
+    }
+
   /* initialize the DLite debugger */
   dlite_init(md_reg_obj, dlite_mem_obj, cache_mstate_obj);
 }
@@ -578,18 +922,66 @@ sim_reg_stats(struct stat_sdb_t *sdb)	/* stats database */
   mem_reg_stats(mem, sdb);
 }
 
+/* print one row of the sweep results table */
+static void
+sweep_print_row(FILE *stream,		/* output stream */
+		char *config,		/* cache configuration */
+		int size,		/* cache size in bytes */
+		counter_t accesses,	/* total accesses */
+		counter_t misses)	/* total misses */
+{
+  fprintf(stream, "%-32s %9d ", config, size);
+  myfprintf(stream, "%12n %12n %10.4f\n",
+	    accesses, misses, accesses ? (double)misses / accesses : 0.0);
+}
+
 /* dump simulator-specific auxiliary simulator statistics */
 void
 sim_aux_stats(FILE *stream)		/* output stream */
 {
-  /* nada */
+  int i, a;
+  counter_t hits;
+  char buf[128];
+  struct cache_t *cp;
+  struct stack_level_t *lv;
+
+  if (!SWEEP_ON)
+    return;
+
+  fprintf(stream, "\nsim: ** single-pass data cache results **\n");
+  fprintf(stream, "%-32s %9s %12s %12s %10s\n",
+	  "config", "bytes", "accesses", "misses", "miss_rate");
+
+  for (i=0; i < sweep_nelt; i++)
+    {
+      cp = sweep_caches[i];
+      sweep_print_row(stream, sweep_opts[i], cp->nsets * cp->bsize * cp->assoc,
+		      cp->hits + cp->misses, cp->misses);
+    }
+
+  /* LRU caches from the stack engine, power-of-two ways up to the most */
+  for (i=0; i < stack_nlevels; i++)
+    {
+      lv = &stack_levels[i];
+      for (a=1, hits=0; a <= stack_assoc; a++)
+	{
+	  hits += lv->hits[a-1];
+	  if ((a & (a - 1)) != 0 && a != stack_assoc)
+	    continue;
+
+	  sprintf(buf, "stack:%d:%d:%d:l", lv->nsets, stack_bsize, a);
+	  sweep_print_row(stream, buf, lv->nsets * stack_bsize * a,
+			  stack_refs, stack_refs - hits);
+	}
+    }
 }
 
 /* un-initialize the simulator */
 void
 sim_uninit(void)
 {
-  /* nada */
+  if (trace_eio_fd != NULL)
+    eio_close(trace_eio_fd);
 }
 
 /*
@@ -646,7 +1038,8 @@ sim_uninit(void)
 #error No ISA target defined...
 #endif
 
-/* precise architected memory state accessor macros */
+/* precise architected memory state accessor macros, the page permissions
+   are checked, see -mem:protect */
 #define __READ_CACHE(addr, SRC_T)					\
   ((dtlb								\
     ? cache_access(dtlb, Read, (addr), NULL,				\
@@ -655,20 +1048,21 @@ sim_uninit(void)
    (cache_dl1								\
     ? cache_access(cache_dl1, Read, (addr), NULL,			\
 		   sizeof(SRC_T), 0, NULL, NULL)			\
-    : 0))
+    : 0),								\
+   (SWEEP_ON ? sweep_access(Read, (addr), sizeof(SRC_T)) : (void)0))
 
 #define READ_BYTE(SRC, FAULT)						\
-  ((FAULT) = md_fault_none, addr = (SRC),				\
+  (addr = (SRC), (FAULT) = MEM_CHECK(mem, addr, MEM_PG_R),		\
    __READ_CACHE(addr, byte_t), MEM_READ_BYTE(mem, addr))
 #define READ_HALF(SRC, FAULT)						\
-  ((FAULT) = md_fault_none, addr = (SRC),				\
+  (addr = (SRC), (FAULT) = MEM_CHECK(mem, addr, MEM_PG_R),		\
    __READ_CACHE(addr, half_t), MEM_READ_HALF(mem, addr))
 #define READ_WORD(SRC, FAULT)						\
-  ((FAULT) = md_fault_none, addr = (SRC),				\
+  (addr = (SRC), (FAULT) = MEM_CHECK(mem, addr, MEM_PG_R),		\
    __READ_CACHE(addr, word_t), MEM_READ_WORD(mem, addr))
 #ifdef HOST_HAS_QWORD
 #define READ_QWORD(SRC, FAULT)						\
-  ((FAULT) = md_fault_none, addr = (SRC),				\
+  (addr = (SRC), (FAULT) = MEM_CHECK(mem, addr, MEM_PG_R),		\
    __READ_CACHE(addr, qword_t), MEM_READ_QWORD(mem, addr))
 #endif /* HOST_HAS_QWORD */
 
@@ -680,21 +1074,31 @@ sim_uninit(void)
    (cache_dl1								\
     ? cache_access(cache_dl1, Write, (addr), NULL,			\
 		   sizeof(DST_T), 0, NULL, NULL)			\
-    : 0))
+    : 0),								\
+   (SWEEP_ON ? sweep_access(Write, (addr), sizeof(DST_T)) : (void)0))
 
+/* a faulting write leaves memory untouched */
 #define WRITE_BYTE(SRC, DST, FAULT)					\
-  ((FAULT) = md_fault_none, addr = (DST),				\
-   __WRITE_CACHE(addr, byte_t), MEM_WRITE_BYTE(mem, addr, (SRC)))
+  (addr = (DST), (FAULT) = MEM_CHECK(mem, addr, MEM_PG_W),		\
+   __WRITE_CACHE(addr, byte_t),						\
+   (FAULT) == md_fault_none						\
+   ? (void)MEM_WRITE_BYTE(mem, addr, (SRC)) : (void)0)
 #define WRITE_HALF(SRC, DST, FAULT)					\
-  ((FAULT) = md_fault_none, addr = (DST),				\
-   __WRITE_CACHE(addr, half_t), MEM_WRITE_HALF(mem, addr, (SRC)))
+  (addr = (DST), (FAULT) = MEM_CHECK(mem, addr, MEM_PG_W),		\
+   __WRITE_CACHE(addr, half_t),						\
+   (FAULT) == md_fault_none						\
+   ? (void)MEM_WRITE_HALF(mem, addr, (SRC)) : (void)0)
 #define WRITE_WORD(SRC, DST, FAULT)					\
-  ((FAULT) = md_fault_none, addr = (DST),				\
-   __WRITE_CACHE(addr, word_t), MEM_WRITE_WORD(mem, addr, (SRC)))
+  (addr = (DST), (FAULT) = MEM_CHECK(mem, addr, MEM_PG_W),		\
+   __WRITE_CACHE(addr, word_t),						\
+   (FAULT) == md_fault_none						\
+   ? (void)MEM_WRITE_WORD(mem, addr, (SRC)) : (void)0)
 #ifdef HOST_HAS_QWORD
 #define WRITE_QWORD(SRC, DST, FAULT)					\
-  ((FAULT) = md_fault_none, addr = (DST),				\
-   __WRITE_CACHE(addr, qword_t), MEM_WRITE_QWORD(mem, addr, (SRC)))
+  (addr = (DST), (FAULT) = MEM_CHECK(mem, addr, MEM_PG_W),		\
+   __WRITE_CACHE(addr, qword_t),					\
+   (FAULT) == md_fault_none						\
+   ? (void)MEM_WRITE_QWORD(mem, addr, (SRC)) : (void)0)
 #endif /* HOST_HAS_QWORD */
 
 /* system call memory access function */
@@ -709,17 +1113,28 @@ dcache_access_fn(struct mem_t *mem,	/* memory space to access */
     cache_access(dtlb, cmd, addr, NULL, nbytes, 0, NULL, NULL);
   if (cache_dl1)
     cache_access(cache_dl1, cmd, addr, NULL, nbytes, 0, NULL, NULL);
+  if (SWEEP_ON)
+    sweep_access(cmd, addr, nbytes);
   return mem_access(mem, cmd, addr, p, nbytes);
 }
 
+/* system call through memory access function MEM_FN, recorded along with
+   the reference streams, see -cache:trace */
+#define __SYSCALL(MEM_FN, INST)						\
+  (trace_eio_fd != NULL							\
+   ? eio_write_trace(trace_eio_fd, sim_num_insn,			\
+		     &regs, (MEM_FN), mem, (INST))			\
+   : sys_syscall(&regs, (MEM_FN), mem, (INST), TRUE))
+
 /* system call handler macro */
 #define SYSCALL(INST)							\
   (flush_on_syscalls							\
    ? ((dtlb ? cache_flush(dtlb, 0) : 0),				\
       (cache_dl1 ? cache_flush(cache_dl1, 0) : 0),			\
       (cache_dl2 ? cache_flush(cache_dl2, 0) : 0),			\
-      sys_syscall(&regs, mem_access, mem, INST, TRUE))			\
-   : sys_syscall(&regs, dcache_access_fn, mem, INST, TRUE))
+      (SWEEP_ON ? sweep_flush() : (void)0),				\
+      __SYSCALL(mem_access, INST))					\
+   : __SYSCALL(dcache_access_fn, INST))
 
 /* start simulation, program loaded, processor precise state initialized */
 void
@@ -757,6 +1172,8 @@ sim_main(void)
       if (cache_il1)
 	cache_access(cache_il1, Read, IACOMPRESS(regs.regs_PC),
 		     NULL, ISCOMPRESS(sizeof(md_inst_t)), 0, NULL, NULL);
+      if (MEM_CHECK(mem, regs.regs_PC, MEM_PG_X) != md_fault_none)
+	fatal("fault (%d) detected @ 0x%08p", md_fault_access, regs.regs_PC);
       MD_FETCH_INST(inst, mem, regs.regs_PC);
 
       /* keep an instruction count */
@@ -61,6 +61,7 @@
 #include "regs.h"
 #include "memory.h"
 #include "cache.h"
+#include "dram.h"
 #include "loader.h"
 #include "syscall.h"
 #include "bpred.h"
@@ -169,6 +170,25 @@ static char *cache_dl2_opt;
 /* l2 data cache hit latency (in cycles) */
 static int cache_dl2_lat;
 
+/* l1 and l2 data cache MSHRs, 0 for unlimited outstanding misses */
+static int cache_dl1_mshrs;
+static int cache_dl2_mshrs;
+
+/* l1 inst, l1 data and l2 data cache prefetcher configs, i.e.,
+   {<config>|none} */
+static char *cache_il1_pf_opt;
+static char *cache_dl1_pf_opt;
+static char *cache_dl2_pf_opt;
+
+/* l1 and l2 cache victim cache entries, 0 for none */
+static int cache_il1_nvc;
+static int cache_dl1_nvc;
+static int cache_il2_nvc;
+static int cache_dl2_nvc;
+
+/* l2 cache inclusion policy, i.e., {n|i|e} */
+static char *cache_inclusion_opt;
+
 /* l1 instruction cache config, i.e., {<config>|dl1|dl2|none} */
 static char *cache_il1_opt;
 
@@ -195,6 +215,20 @@ static int mem_lat[2] =
 /* memory access bus width (in bytes) */
 static int mem_bus_width;
 
+/* DRAM config, i.e., {<config>|none} */
+static char *mem_dram_opt;
+
+/* DRAM timing (<tRCD> <tCAS> <tRP> <tRAS>) */
+static int dram_nelt = 4;
+static int dram_timing[4] =
+  { /* tRCD */9, /* tCAS */9, /* tRP */9, /* tRAS */24 };
+
+/* DRAM request queue entries per channel */
+static int dram_queue_size;
+
+/* DRAM behind the caches, if any */
+static struct dram_t *dram = NULL;
+
 /* instruction TLB config, i.e., {<config>|none} */
 static char *itlb_opt;
 
@@ -341,6 +375,10 @@ static counter_t LSQ_fcount;		/* cumulative LSQ full count */
 /* total non-speculative bogus addresses seen (debug var) */
 static counter_t sim_invalid_addrs;
 
+/* cycles loads waited to issue, or stores to commit, on full D-cache MSHRs,
+   one per held back access */
+static counter_t LSQ_mshr_stalls;
+
 /*
  * simulator state variables
  */
@@ -409,12 +447,18 @@ static struct stat_stat_t *pcstat_sdists[MAX_PCSTAT_VARS];
 
 /* memory access latency, assumed to not cross a page boundary */
 static unsigned int			/* total latency of access */
-mem_access_latency(int blk_sz)		/* block size accessed */
+mem_access_latency(enum mem_cmd cmd,	/* access cmd, Read or Write */
+		   md_addr_t baddr,	/* block address to access */
+		   int blk_sz,		/* block size accessed */
+		   tick_t now)		/* time of access */
 {
   int chunks = (blk_sz + (mem_bus_width - 1)) / mem_bus_width;
 
   assert(chunks > 0);
 
+  if (dram)
+    return dram_access(dram, cmd, baddr, blk_sz, now);
+
   return (/* first chunk latency */mem_lat[0] +
 	  (/* remainder chunk latency */mem_lat[1] * (chunks - 1)));
 }
@@ -437,6 +481,8 @@ dl1_access_fn(enum mem_cmd cmd,		/* access cmd, Read or Write */
   if (cache_dl2)
     {
       /* access next level of data cache hierarchy */
+      cache_dl2->pc = cache_dl1->pc;
+      cache_dl2->demand = cmd == Read && !cache_dl1->pf_reading;
       lat = cache_access(cache_dl2, cmd, baddr, NULL, bsize,
 			 /* now */now, /* pudata */NULL, /* repl addr */NULL);
       if (cmd == Read)
@@ -450,8 +496,9 @@ dl1_access_fn(enum mem_cmd cmd,		/* access cmd, Read or Write */
   else
     {
       /* access main memory */
-      if (cmd == Read)
-	return mem_access_latency(bsize);
+      lat = mem_access_latency(cmd, baddr, bsize, now);
+      if (cmd == Read || dram)
+	return lat;
       else
 	{
 	  /* FIXME: unlimited write buffers */
@@ -468,9 +515,12 @@ dl2_access_fn(enum mem_cmd cmd,		/* access cmd, Read or Write */
 	      struct cache_blk_t *blk,	/* ptr to block in upper level */
 	      tick_t now)		/* time of access */
 {
+  unsigned int lat;
+
   /* this is a miss to the lowest level, so access main memory */
-  if (cmd == Read)
-    return mem_access_latency(bsize);
+  lat = mem_access_latency(cmd, baddr, bsize, now);
+  if (cmd == Read || dram)
+    return lat;
   else
     {
       /* FIXME: unlimited write buffers */
@@ -491,6 +541,8 @@ il1_access_fn(enum mem_cmd cmd,		/* access cmd, Read or Write */
 if (cache_il2)
     {
       /* access next level of inst cache hierarchy */
+      cache_il2->pc = cache_il1->pc;
+      cache_il2->demand = !cache_il1->pf_reading;
       lat = cache_access(cache_il2, cmd, baddr, NULL, bsize,
 			 /* now */now, /* pudata */NULL, /* repl addr */NULL);
       if (cmd == Read)
@@ -502,7 +554,7 @@ if (cache_il2)
     {
       /* access main memory */
       if (cmd == Read)
-	return mem_access_latency(bsize);
+	return mem_access_latency(cmd, baddr, bsize, now);
       else
 	panic("writes to instruction memory not supported");
     }
@@ -518,7 +570,7 @@ il2_access_fn(enum mem_cmd cmd,		/* access cmd, Read or Write */
 {
   /* this is a miss to the lowest level, so access main memory */
   if (cmd == Read)
-    return mem_access_latency(bsize);
+    return mem_access_latency(cmd, baddr, bsize, now);
   else
     panic("writes to instruction memory not supported");
 }
@@ -586,6 +638,9 @@ sim_reg_options(struct opt_odb_t *odb)
 	       &max_insts, /* default */0,
 	       /* print */TRUE, /* format */NULL);
 
+  /* page permissions, checked on every access */
+  mem_reg_protect(odb);
+
   /* trace options */
 
   opt_reg_int(odb, "-fastfwd", "number of insts skipped before timing starts",
@@ -749,7 +804,8 @@ sim_reg_options(struct opt_odb_t *odb)
 "    <nsets>  - number of sets in the cache\n"
 "    <bsize>  - block size of the cache\n"
 "    <assoc>  - associativity of the cache\n"
-"    <repl>   - block replacement strategy, 'l'-LRU, 'f'-FIFO, 'r'-random\n"
+"    <repl>   - block replacement strategy, 'l'-LRU, 'f'-FIFO, 'r'-random,\n"
+"               'p'-tree PLRU, 's'-SRRIP, 'b'-BRRIP, 'd'-DRRIP\n"
 "\n"
 "    Examples:   -cache:dl1 dl1:4096:32:1:l\n"
 "                -dtlb dtlb:128:4096:32:r\n"
@@ -770,6 +826,24 @@ sim_reg_options(struct opt_odb_t *odb)
 	      &cache_dl2_lat, /* default */6,
 	      /* print */TRUE, /* format */NULL);
 
+  opt_reg_int(odb, "-cache:dl1mshr",
+	      "l1 data cache MSHRs (0 for unlimited outstanding misses)",
+	      &cache_dl1_mshrs, /* default */0,
+	      /* print */TRUE, /* format */NULL);
+
+  opt_reg_int(odb, "-cache:dl2mshr",
+	      "l2 data cache MSHRs (0 for unlimited outstanding misses)",
+	      &cache_dl2_mshrs, /* default */0,
+	      /* print */TRUE, /* format */NULL);
+
+  opt_reg_note(odb,
+"  With MSHRs, each l1 data cache miss holds one until its fill completes,\n"
+"  and misses to a block already being filled merge onto its MSHR.  A load\n"
+"  that misses with all of them busy is not issued, and a store that does is\n"
+"  not committed, until one frees up.  An l2 miss that finds all l2 MSHRs\n"
+"  busy waits for one as part of its latency.\n"
+	       );
+
   opt_reg_string(odb, "-cache:il1",
 		 "l1 inst cache config, i.e., {<config>|dl1|dl2|none}",
 		 &cache_il1_opt, "il1:512:32:1:l",
@@ -804,6 +878,78 @@ sim_reg_options(struct opt_odb_t *odb)
 	      &cache_il2_lat, /* default */6,
 	      /* print */TRUE, /* format */NULL);
 
+  opt_reg_string(odb, "-cache:il1pf",
+		 "l1 inst cache prefetcher, i.e., {<config>|none}",
+		 &cache_il1_pf_opt, "none", /* print */TRUE, NULL);
+
+  opt_reg_string(odb, "-cache:dl1pf",
+		 "l1 data cache prefetcher, i.e., {<config>|none}",
+		 &cache_dl1_pf_opt, "none", /* print */TRUE, NULL);
+
+  opt_reg_string(odb, "-cache:dl2pf",
+		 "l2 data cache prefetcher, i.e., {<config>|none}",
+		 &cache_dl2_pf_opt, "none", /* print */TRUE, NULL);
+
+  opt_reg_note(odb,
+"  The prefetcher config has the following format:\n"
+"\n"
+"      <type>:<entries>:<degree>:<buffer>\n"
+"\n"
+"      <type>    - n (next-line), p (PC stride), s (stream),\n"
+"                  g (global history buffer, address correlation)\n"
+"      <entries> - table entries: stride table, streams, or history\n"
+"                  buffer (ignored by next-line)\n"
+"      <degree>  - blocks prefetched per trigger, at most 16\n"
+"      <buffer>  - prefetch buffer entries, 0 to fill the cache directly\n"
+"\n"
+"    Examples:   -cache:dl1pf p:256:2:0\n"
+"                -cache:dl2pf s:16:4:16\n"
+"\n"
+"  Prefetches go to the next level like misses and take a free MSHR, if\n"
+"  the cache has any, or are dropped.  An l1 inst cache that is one of the\n"
+"  data caches shares its prefetcher.  An l2 prefetcher trains on the\n"
+"  demand reads of the l1 caches only, not on their writebacks or\n"
+"  prefetches.\n"
+	       );
+
+  opt_reg_int(odb, "-cache:il1vc",
+	      "l1 inst cache victim cache entries, 0 for none",
+	      &cache_il1_nvc, /* default */0,
+	      /* print */TRUE, /* format */NULL);
+
+  opt_reg_int(odb, "-cache:dl1vc",
+	      "l1 data cache victim cache entries, 0 for none",
+	      &cache_dl1_nvc, /* default */0,
+	      /* print */TRUE, /* format */NULL);
+
+  opt_reg_int(odb, "-cache:il2vc",
+	      "l2 inst cache victim cache entries, 0 for none",
+	      &cache_il2_nvc, /* default */0,
+	      /* print */TRUE, /* format */NULL);
+
+  opt_reg_int(odb, "-cache:dl2vc",
+	      "l2 data cache victim cache entries, 0 for none",
+	      &cache_dl2_nvc, /* default */0,
+	      /* print */TRUE, /* format */NULL);
+
+  opt_reg_string(odb, "-cache:inclusion",
+		 "l2 cache inclusion of the l1 caches, i.e., {n|i|e}",
+		 &cache_inclusion_opt, "n", /* print */TRUE, NULL);
+
+  opt_reg_note(odb,
+"  The l2 cache inclusion policy is one of:\n"
+"\n"
+"      n - non-inclusive, the l2 fills on its misses and evicts freely\n"
+"      i - inclusive, a block the l2 evicts is invalidated in the l1s\n"
+"      e - exclusive, the l2 hands the blocks the l1s read up to them and\n"
+"          takes in the blocks they evict, it must have their block size\n"
+"\n"
+"  A victim cache holds the blocks its cache replaces, fully associative\n"
+"  and LRU, and swaps one back in at a miss to it, one cycle slower than a\n"
+"  hit.  Invalidations by an inclusive l2 count in the invalidations of the\n"
+"  l1 caches.\n"
+	       );
+
   opt_reg_flag(odb, "-cache:flush", "flush caches on system calls",
 	       &flush_on_syscalls, /* default */FALSE, /* print */TRUE, NULL);
 
@@ -822,6 +968,42 @@ sim_reg_options(struct opt_odb_t *odb)
 	      &mem_bus_width, /* default */8,
 	      /* print */TRUE, /* format */NULL);
 
+  opt_reg_string(odb, "-mem:dram",
+		 "DRAM config, i.e., {<config>|none}",
+		 &mem_dram_opt, "none", /* print */TRUE, NULL);
+
+  opt_reg_int_list(odb, "-mem:dram_timing",
+		   "DRAM timing (<tRCD> <tCAS> <tRP> <tRAS>)",
+		   dram_timing, dram_nelt, &dram_nelt, dram_timing,
+		   /* print */TRUE, /* format */NULL, /* !accrue */FALSE);
+
+  opt_reg_int(odb, "-mem:dram_queue",
+	      "DRAM request queue entries per channel",
+	      &dram_queue_size, /* default */32,
+	      /* print */TRUE, /* format */NULL);
+
+  opt_reg_note(odb,
+"  The DRAM config, if not `none', replaces the fixed memory latency with a\n"
+"  model of the DRAM channels, their banks and row buffers, and an FR-FCFS\n"
+"  controller per channel.  The config has the following format:\n"
+"\n"
+"      <channels>:<ranks>:<banks>:<row_bytes>:<page>\n"
+"\n"
+"      <channels>  - number of channels, each with its own data bus\n"
+"      <ranks>     - ranks per channel\n"
+"      <banks>     - banks per rank\n"
+"      <row_bytes> - row (i.e., row buffer) size in bytes\n"
+"      <page>      - row buffer policy, i.e., o (open page), c (closed page)\n"
+"\n"
+"    Examples:   -mem:dram 2:1:8:2048:o\n"
+"                -mem:dram 1:2:8:1024:c\n"
+"\n"
+"  The DRAM timings are in CPU cycles.  The data bus of a channel is\n"
+"  -mem:width bytes wide and takes the <inter_chunk> latency of -mem:lat\n"
+"  per transfer.  Writes wait in the request queue, a write costs nothing\n"
+"  unless the queue of its channel is full.\n"
+	       );
+
   /* TLB options */
 
   opt_reg_string(odb, "-tlb:itlb",
@@ -874,6 +1056,62 @@ sim_reg_options(struct opt_odb_t *odb)
 	       &bugcompat_mode, /* default */FALSE, /* print */TRUE, NULL);
 }
 
+/* return the replacement policy of char C for cache NAME, OPT replays a
+   reference stream recorded by an earlier run, which only sim-cache does */
+static enum cache_policy
+repl_policy(char *name,			/* cache name, for errors */
+	    char c)			/* policy char */
+{
+  enum cache_policy policy = cache_char2policy(c);
+
+  if (policy == OPT)
+    fatal("cache `%s': OPT replacement needs a recorded reference stream, "
+	  "use sim-cache -cache:trace", name);
+  return policy;
+}
+
+/* attach the prefetcher of config PF_OPT, i.e., {<config>|none}, to the
+   WHICH cache CP */
+static void
+pf_config(struct cache_t *cp,		/* cache to prefetch for */
+	  char *pf_opt,			/* prefetcher config */
+	  char *which)			/* which cache, for errors */
+{
+  int entries, degree, nbuf;
+  char c;
+
+  if (!mystricmp(pf_opt, "none"))
+    return;
+
+  if (!cp)
+    fatal("the %s cache must be defined to have a prefetcher", which);
+  if (cp->pf)
+    fatal("the %s cache shares a cache that already has a prefetcher",
+	  which);
+  if (sscanf(pf_opt, "%c:%d:%d:%d", &c, &entries, &degree, &nbuf) != 4)
+    fatal("bad %s cache prefetcher parms: "
+	  "<type>:<entries>:<degree>:<buffer>", which);
+  cache_prefetcher(cp, prefetch_create(prefetch_char2kind(c), entries,
+				       degree, cp->bsize), nbuf);
+}
+
+/* give the WHICH cache CP a victim cache of NVC entries, if NVC */
+static void
+vc_config(struct cache_t *cp,		/* cache to add it to */
+	  int nvc,			/* victim cache entries */
+	  char *which)			/* which cache, for errors */
+{
+  if (!nvc)
+    return;
+
+  if (!cp)
+    fatal("the %s cache must be defined to have a victim cache", which);
+  if (cp->nvc)
+    fatal("the %s cache shares a cache that already has a victim cache",
+	  which);
+  cache_victims(cp, nvc);
+}
+
 /* check simulator-specific option values */
 void
 sim_check_options(struct opt_odb_t *odb,        /* options database */
@@ -881,6 +1119,7 @@ sim_check_options(struct opt_odb_t *odb,        /* options database */
 {
   char name[128], c;
   int nsets, bsize, assoc;
+  enum cache_inclusion inclusion;
 
   if (fastfwd_count < 0 || fastfwd_count >= 2147483647)
     fatal("bad fast forward count: %d", fastfwd_count);
@@ -1015,7 +1254,7 @@ sim_check_options(struct opt_odb_t *odb,        /* options database */
 		 name, &nsets, &bsize, &assoc, &c) != 5)
 	fatal("bad l1 D-cache parms: <name>:<nsets>:<bsize>:<assoc>:<repl>");
       cache_dl1 = cache_create(name, nsets, bsize, /* balloc */FALSE,
-			       /* usize */0, assoc, cache_char2policy(c),
+			       /* usize */0, assoc, repl_policy(name, c),
 			       dl1_access_fn, /* hit lat */cache_dl1_lat);
 
       /* is the level 2 D-cache defined? */
@@ -1028,7 +1267,7 @@ sim_check_options(struct opt_odb_t *odb,        /* options database */
 	    fatal("bad l2 D-cache parms: "
 		  "<name>:<nsets>:<bsize>:<assoc>:<repl>");
 	  cache_dl2 = cache_create(name, nsets, bsize, /* balloc */FALSE,
-				   /* usize */0, assoc, cache_char2policy(c),
+				   /* usize */0, assoc, repl_policy(name, c),
 				   dl2_access_fn, /* hit lat */cache_dl2_lat);
 	}
     }
@@ -1071,7 +1310,7 @@ sim_check_options(struct opt_odb_t *odb,        /* options database */
 		 name, &nsets, &bsize, &assoc, &c) != 5)
 	fatal("bad l1 I-cache parms: <name>:<nsets>:<bsize>:<assoc>:<repl>");
       cache_il1 = cache_create(name, nsets, bsize, /* balloc */FALSE,
-			       /* usize */0, assoc, cache_char2policy(c),
+			       /* usize */0, assoc, repl_policy(name, c),
 			       il1_access_fn, /* hit lat */cache_il1_lat);
 
       /* is the level 2 D-cache defined? */
@@ -1090,7 +1329,7 @@ sim_check_options(struct opt_odb_t *odb,        /* options database */
 	    fatal("bad l2 I-cache parms: "
 		  "<name>:<nsets>:<bsize>:<assoc>:<repl>");
 	  cache_il2 = cache_create(name, nsets, bsize, /* balloc */FALSE,
-				   /* usize */0, assoc, cache_char2policy(c),
+				   /* usize */0, assoc, repl_policy(name, c),
 				   il2_access_fn, /* hit lat */cache_il2_lat);
 	}
     }
@@ -1105,7 +1344,7 @@ sim_check_options(struct opt_odb_t *odb,        /* options database */
 	fatal("bad TLB parms: <name>:<nsets>:<page_size>:<assoc>:<repl>");
       itlb = cache_create(name, nsets, bsize, /* balloc */FALSE,
 			  /* usize */sizeof(md_addr_t), assoc,
-			  cache_char2policy(c), itlb_access_fn,
+			  repl_policy(name, c), itlb_access_fn,
 			  /* hit latency */1);
     }
 
@@ -1119,7 +1358,7 @@ sim_check_options(struct opt_odb_t *odb,        /* options database */
 	fatal("bad TLB parms: <name>:<nsets>:<page_size>:<assoc>:<repl>");
       dtlb = cache_create(name, nsets, bsize, /* balloc */FALSE,
 			  /* usize */sizeof(md_addr_t), assoc,
-			  cache_char2policy(c), dtlb_access_fn,
+			  repl_policy(name, c), dtlb_access_fn,
 			  /* hit latency */1);
     }
 
@@ -1129,6 +1368,36 @@ sim_check_options(struct opt_odb_t *odb,        /* options database */
   if (cache_dl2_lat < 1)
     fatal("l2 data cache latency must be greater than zero");
 
+  if (cache_dl1_mshrs < 0 || cache_dl2_mshrs < 0)
+    fatal("the number of data cache MSHRs must not be negative");
+  if (cache_dl1 && cache_dl1_mshrs)
+    cache_mshrs(cache_dl1, cache_dl1_mshrs);
+  if (cache_dl2 && cache_dl2_mshrs)
+    cache_mshrs(cache_dl2, cache_dl2_mshrs);
+
+  /* attach the prefetchers, an l1 inst cache shared with a data cache
+     gets that one's */
+  pf_config(cache_dl1, cache_dl1_pf_opt, "l1 data");
+  pf_config(cache_dl2, cache_dl2_pf_opt, "l2 data");
+  pf_config(cache_il1, cache_il1_pf_opt, "l1 inst");
+
+  /* attach the victim caches, and tie the l1 caches to their l2 caches */
+  vc_config(cache_dl1, cache_dl1_nvc, "l1 data");
+  vc_config(cache_dl2, cache_dl2_nvc, "l2 data");
+  vc_config(cache_il1, cache_il1_nvc, "l1 inst");
+  vc_config(cache_il2, cache_il2_nvc, "l2 inst");
+
+  if (!cache_inclusion_opt[0] || cache_inclusion_opt[1])
+    fatal("bad l2 cache inclusion policy, `%s'", cache_inclusion_opt);
+  inclusion = cache_char2inclusion(cache_inclusion_opt[0]);
+  if (inclusion != NonInclusive)
+    {
+      if (cache_dl2)
+	cache_inclusion(cache_dl2, inclusion, cache_dl1);
+      if (cache_il2 && cache_il1 != cache_dl1 && cache_il1 != cache_dl2)
+	cache_inclusion(cache_il2, inclusion, cache_il1);
+    }
+
   if (cache_il1_lat < 1)
     fatal("l1 instruction cache latency must be greater than zero");
 
@@ -1144,6 +1413,28 @@ sim_check_options(struct opt_odb_t *odb,        /* options database */
   if (mem_bus_width < 1 || (mem_bus_width & (mem_bus_width-1)) != 0)
     fatal("memory bus width must be positive non-zero and a power of two");
 
+  /* use a DRAM model? */
+  if (!mystricmp(mem_dram_opt, "none"))
+    dram = NULL;
+  else
+    {
+      int nchannels, nranks, nbanks, row_size;
+
+      if (sscanf(mem_dram_opt, "%d:%d:%d:%d:%c",
+		 &nchannels, &nranks, &nbanks, &row_size, &c) != 5)
+	fatal("bad DRAM parms: "
+	      "<channels>:<ranks>:<banks>:<row_bytes>:<page>");
+      if (c != 'o' && c != 'c')
+	fatal("bad DRAM page policy `%c', must be o or c", c);
+      if (dram_nelt != 4)
+	fatal("bad DRAM timing (<tRCD> <tCAS> <tRP> <tRAS>)");
+      dram = dram_create(nchannels, nranks, nbanks, row_size,
+			 c == 'o' ? OpenPage : ClosedPage,
+			 dram_timing[0], dram_timing[1], dram_timing[2],
+			 dram_timing[3], mem_bus_width, /* xfer lat */mem_lat[1],
+			 dram_queue_size);
+    }
+
   if (tlb_miss_lat < 1)
     fatal("TLB miss latency must be greater than zero");
 
@@ -1182,7 +1473,8 @@ sim_check_options(struct opt_odb_t *odb,        /* options database */
 void
 sim_aux_config(FILE *stream)            /* output stream */
 {
-  /* nada */
+  if (dram)
+    dram_config(dram, stream);
 }
 
 /* register simulator-specific statistics */
@@ -1285,6 +1577,11 @@ sim_reg_stats(struct stat_sdb_t *sdb)   /* stats database */
   stat_reg_formula(sdb, "lsq_full", "fraction of time (cycle's) LSQ was full",
                    "LSQ_fcount / sim_cycle", /* format */NULL);
 
+  if (cache_dl1 && cache_dl1->nmshrs)
+    stat_reg_counter(sdb, "LSQ_mshr_stalls",
+		     "loads/stores held back a cycle by full dl1 MSHRs",
+		     &LSQ_mshr_stalls, /* initial value */0, /* format */NULL);
+
   stat_reg_counter(sdb, "sim_slip",
                    "total number of slip cycles",
                    &sim_slip, 0, NULL);
@@ -1312,6 +1609,8 @@ sim_reg_stats(struct stat_sdb_t *sdb)   /* stats database */
     cache_reg_stats(itlb, sdb);
   if (dtlb)
     cache_reg_stats(dtlb, sdb);
+  if (dram)
+    dram_reg_stats(dram, sdb);
 
   /* debug variable(s) */
   stat_reg_counter(sdb, "sim_invalid_addrs",
@@ -2169,6 +2468,16 @@ ruu_commit(void)
 	      struct res_template *fu;
 
 
+	      /* a store that misses with all D-cache MSHRs busy cannot
+		 commit until one frees up */
+	      if (cache_dl1
+		  && cache_mshr_busy(cache_dl1, (LSQ[LSQ_head].addr&~3),
+				     sim_cycle))
+		{
+		  LSQ_mshr_stalls++;
+		  break;
+		}
+
 	      /* stores must retire their store value to the cache at commit,
 		 try to get a store port (functional unit allocation) */
 	      fu = res_get(fu_pool, MD_OP_FUCLASS(LSQ[LSQ_head].op));
@@ -2185,6 +2494,7 @@ ruu_commit(void)
 		  if (cache_dl1)
 		    {
 		      /* commit store value to D-cache */
+		      cache_dl1->pc = LSQ[LSQ_head].PC;
 		      lat =
 			cache_access(cache_dl1, Write, (LSQ[LSQ_head].addr&~3),
 				     NULL, 4, sim_cycle, NULL, NULL);
@@ -2600,6 +2910,30 @@ lsq_refresh(void)
  *  RUU_ISSUE() - issue instructions to functional units
  */
 
+/* non-zero if load RS would miss in the D-cache with all of its MSHRs busy,
+   a load forwarded from a store in the LSQ does not go to the cache */
+static int
+load_mshr_busy(struct RUU_station *rs)	/* load to check */
+{
+  int i;
+
+  if (!cache_dl1 || !MD_VALID_ADDR(rs->addr)
+      || !cache_mshr_busy(cache_dl1, (rs->addr & ~3), sim_cycle))
+    return FALSE;
+
+  /* scan the LSQ for a store to forward from, as ruu_issue() does */
+  i = (rs - LSQ);
+  while (i != LSQ_head)
+    {
+      /* go to next earlier LSQ entry */
+      i = (i + (LSQ_size-1)) % LSQ_size;
+
+      if ((MD_OP_FLAGS(LSQ[i].op) & F_STORE) && (LSQ[i].addr == rs->addr))
+	return FALSE;
+    }
+  return TRUE;
+}
+
 /* attempt to issue all operations in the ready queue; insts in the ready
    instruction queue have all register dependencies satisfied, this function
    must then 1) ensure the instructions memory dependencies have been satisfied
@@ -2673,6 +3007,18 @@ ruu_issue(void)
 	      if (MD_OP_FUCLASS(rs->op) != NA)
 		{
 		  fu = res_get(fu_pool, MD_OP_FUCLASS(rs->op));
+
+		  /* a load that misses with all D-cache MSHRs busy waits
+		     like one without a functional unit */
+		  if (fu && rs->in_LSQ
+		      && ((MD_OP_FLAGS(rs->op) & (F_MEM|F_LOAD))
+			  == (F_MEM|F_LOAD))
+		      && load_mshr_busy(rs))
+		    {
+		      LSQ_mshr_stalls++;
+		      fu = NULL;
+		    }
+
 		  if (fu)
 		    {
 		      /* got one! issue inst to functional unit */
@@ -2730,6 +3076,7 @@ ruu_issue(void)
 			      if (cache_dl1 && valid_addr)
 				{
 				  /* access the cache if non-faulting */
+				  cache_dl1->pc = rs->PC;
 				  load_lat =
 				    cache_access(cache_dl1, Read,
 						 (rs->addr & ~3), NULL, 4,
@@ -2944,6 +3291,7 @@ struct fetch_rec {
   struct bpred_update_t dir_update;	/* bpred direction update info */
   int stack_recover_idx;		/* branch predictor RSB index */
   unsigned int ptrace_seq;		/* print trace sequence id */
+  enum md_fault_type fault;		/* fetch fault, see -mem:protect */
 };
 static struct fetch_rec *fetch_data;	/* IFETCH -> DISPATCH inst queue */
 static int fetch_num;			/* num entries in IF -> DIS queue */
@@ -3752,6 +4100,12 @@ ruu_dispatch(void)
       stack_recover_idx = fetch_data[fetch_head].stack_recover_idx;
       pseq = fetch_data[fetch_head].ptrace_seq;
 
+      /* an instruction fetched from a page without execute permission
+	 faults once it is known to be on the correct path */
+      if (!spec_mode && fetch_data[fetch_head].fault != md_fault_none)
+	fatal("non-speculative fault (%d) detected @ 0x%08p",
+	      fetch_data[fetch_head].fault, regs.regs_PC);
+
       /* decode the inst */
       MD_SET_OPCODE(op, inst);
 
@@ -4204,6 +4558,7 @@ ruu_fetch(void)
   md_inst_t inst;
   int stack_recover_idx;
   int branch_cnt;
+  enum md_fault_type fault;
 
   for (i=0, branch_cnt=0;
        /* fetch up to as many instruction as the DISPATCH stage can decode */
@@ -4217,6 +4572,10 @@ ruu_fetch(void)
       /* fetch an instruction at the next predicted fetch address */
       fetch_regs_PC = fetch_pred_PC;
 
+      /* check execute permission, see -mem:protect, a fetch down a
+	 mis-speculated path must not fault, so the fault waits for dispatch */
+      fault = MEM_CHECK(mem, fetch_regs_PC, MEM_PG_X);
+
       /* is this a bogus text address? (can happen on mis-spec path) */
       if (ld_text_base <= fetch_regs_PC
 	  && fetch_regs_PC < (ld_text_base+ld_text_size)
@@ -4230,6 +4589,7 @@ ruu_fetch(void)
 	  if (cache_il1)
 	    {
 	      /* access the I-cache */
+	      cache_il1->pc = fetch_regs_PC;
 	      lat =
 		cache_access(cache_il1, Read, IACOMPRESS(fetch_regs_PC),
 			     NULL, ISCOMPRESS(sizeof(md_inst_t)), sim_cycle,
@@ -4321,6 +4681,7 @@ ruu_fetch(void)
       fetch_data[fetch_tail].pred_PC = fetch_pred_PC;
       fetch_data[fetch_tail].stack_recover_idx = stack_recover_idx;
       fetch_data[fetch_tail].ptrace_seq = ptrace_seq++;
+      fetch_data[fetch_tail].fault = fault;
 
       /* for pipe trace */
       ptrace_newinst(fetch_data[fetch_tail].ptrace_seq,
@@ -4467,6 +4828,9 @@ sim_main(void)
 #endif /* TARGET_ALPHA */
 
 	  /* get the next instruction to execute */
+	  if (MEM_CHECK(mem, regs.regs_PC, MEM_PG_X) != md_fault_none)
+	    fatal("fault (%d) detected @ 0x%08p", md_fault_access,
+		  regs.regs_PC);
 	  MD_FETCH_INST(inst, mem, regs.regs_PC);
 
 	  /* set default reference address */
@@ -7,6 +7,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
+#include <assert.h>
 
 /* An implementation of 5-stage classic pipeline simulation */
 
@@ -22,7 +23,9 @@
 #include "syscall.h"
 #include "dlite.h"
 #include "sim.h"
+#include "bpred.h"
 #include "sim-pipe.h"
+#include "cache.h"
 #include "ucache.h"
 
 /* simulated registers */
@@ -31,6 +34,102 @@ static struct regs_t regs;
 /* simulated memory */
 static struct mem_t *mem = NULL;
 
+/* cache options */
+static int cache_enable;
+static int cache_nsets;
+static int cache_assoc;
+static int cache_bsize;
+static int cache_hit_lat;
+static int cache_miss_lat;
+static char *cache_repl_opt;
+static repl_policy_t cache_repl;
+static int cache_nmshrs;
+static char *cache_write_opt;
+static int cache_write_through;
+static int cache_write_alloc;
+static int cache_wbuf_size;
+static char *cache_pf_opt;
+static pf_kind_t cache_pf;
+static int cache_pf_degree;
+static int cache_pf_table;
+static int cache_pf_streams;
+
+/* l1 instruction cache config, i.e., {<nsets>:<bsize>:<assoc>:<repl>|dl1} */
+static char *cache_il1_opt;
+
+/* l1 instruction cache hit latency (in cycles) */
+static int cache_il1_lat;
+
+/* unified l2 cache config, i.e., {<config>|none} */
+static char *cache_l2_opt;
+
+/* l2 cache hit latency (in cycles) */
+static int cache_l2_lat;
+
+/* memory access latency (<first_chunk> <inter_chunk>) */
+static int mem_nelt = 2;
+static int mem_lat[2] =
+  { /* lat to first chunk */18, /* lat between remaining chunks */2 };
+
+/* memory access bus width (in bytes) */
+static int mem_bus_width;
+
+/* split l1 instruction cache, fetches go through the data cache otherwise */
+static int il1_split = FALSE;
+static int il1_nsets, il1_bsize, il1_assoc;
+static repl_policy_t il1_repl;
+
+/* unified l2 cache, NULL if l1 misses cost a flat -cache:misslat */
+static struct cache_t *cache_l2 = NULL;
+
+/* outstanding data cache misses, -cache:mshrs entries */
+static struct mshr_buf *mshrs = NULL;
+static counter_t mshr_misses = 0;
+static counter_t mshr_merges = 0;
+static counter_t mshr_full_cycles = 0;
+static counter_t mshr_wait_cycles = 0;
+
+/* branch predictor type {nottaken|taken|bimod|2lev|comb} */
+static char *pred_type;
+
+/* bimodal predictor config (<table_size>) */
+static int bimod_nelt = 1;
+static int bimod_config[1] =
+  { /* bimod tbl size */2048 };
+
+/* 2-level predictor config (<l1size> <l2size> <hist_size> <xor>) */
+static int twolev_nelt = 4;
+static int twolev_config[4] =
+  { /* l1size */1, /* l2size */1024, /* hist */8, /* xor */FALSE};
+
+/* combining predictor config (<meta_table_size> */
+static int comb_nelt = 1;
+static int comb_config[1] =
+  { /* meta_table_size */1024 };
+
+/* return address stack (RAS) size */
+static int ras_size = 8;
+
+/* BTB predictor config (<num_sets> <associativity>) */
+static int btb_nelt = 2;
+static int btb_config[2] =
+  { /* nsets */512, /* assoc */4 };
+
+/* branch predictor, consulted in IF for conditional branches */
+static struct bpred_t *pred = NULL;
+
+/* pipeline cycles and the cycles lost to each kind of stall */
+counter_t sim_num_clk;
+static counter_t stall_load_use = 0;
+static counter_t stall_branch = 0;
+static counter_t stall_cache = 0;
+
+/* decoded instructions by PC, -decode:cache entries (0 decodes every time) */
+static int predecode_size;
+static struct predecode_buf *predecode_cache = NULL;
+static counter_t predecode_hits = 0;
+static counter_t predecode_misses = 0;
+
 /* register simulator-specific options */
 void
 sim_reg_options(struct opt_odb_t *odb)
@@ -38,6 +137,173 @@ sim_reg_options(struct opt_odb_t *odb)
   opt_reg_header(odb, 
 "sim-pipe: This simulator implements based on sim-fast.\n"
      );
+
+  opt_reg_flag(odb, "-cache:enable", "route fetches, loads and stores through the cache",
+	       &cache_enable, /* default */TRUE, /* print */TRUE, NULL);
+#ifdef UCACHE_FIXED
+  /* geometry is compiled in, see ucache.h */
+  cache_nsets = CACHE_SETS;
+  cache_assoc = SET_NUM;
+  cache_bsize = LINE_WORDS * sizeof(word_t);
+#else
+  opt_reg_int(odb, "-cache:sets", "cache size in sets (power of two)",
+	      &cache_nsets, /* default */16, /* print */TRUE, NULL);
+  opt_reg_int(odb, "-cache:assoc", "cache associativity (power of two)",
+	      &cache_assoc, /* default */4, /* print */TRUE, NULL);
+  opt_reg_int(odb, "-cache:bsize", "cache block size in bytes (power of two)",
+	      &cache_bsize, /* default */16, /* print */TRUE, NULL);
+#endif
+  opt_reg_int(odb, "-cache:hitlat", "cache hit latency (in cycles)",
+	      &cache_hit_lat, /* default */1, /* print */TRUE, NULL);
+  opt_reg_int(odb, "-cache:misslat", "cache miss latency (in cycles)",
+	      &cache_miss_lat, /* default */10, /* print */TRUE, NULL);
+  opt_reg_string(odb, "-cache:repl",
+		 "cache replacement policy {fifo|lru|random|plru}",
+		 &cache_repl_opt, /* default */"fifo", /* print */TRUE, NULL);
+  opt_reg_int(odb, "-cache:mshrs",
+	      "outstanding data cache load misses (0 for a blocking cache)",
+	      &cache_nmshrs, /* default */0, /* print */TRUE, NULL);
+  opt_reg_string(odb, "-cache:write",
+		 "data cache write policy {wb|wt} (write-back or write-through)",
+		 &cache_write_opt, /* default */"wb", /* print */TRUE, NULL);
+  opt_reg_flag(odb, "-cache:walloc", "allocate a data cache line on a store miss",
+	       &cache_write_alloc, /* default */TRUE, /* print */TRUE, NULL);
+  opt_reg_int(odb, "-cache:wbuf",
+	      "data cache write buffer size in blocks (0 for synchronous writes)",
+	      &cache_wbuf_size, /* default */0, /* print */TRUE, NULL);
+  opt_reg_string(odb, "-cache:pf",
+		 "data cache prefetcher {none|nextline|stride|stream}",
+		 &cache_pf_opt, /* default */"none", /* print */TRUE, NULL);
+  opt_reg_int(odb, "-cache:pfdegree",
+	      "blocks prefetched ahead (stream buffer depth for stream)",
+	      &cache_pf_degree, /* default */1, /* print */TRUE, NULL);
+  opt_reg_int(odb, "-cache:pftable",
+	      "stride prefetcher table entries, indexed by load/store PC",
+	      &cache_pf_table, /* default */64, /* print */TRUE, NULL);
+  opt_reg_int(odb, "-cache:pfstreams", "number of stream buffers",
+	      &cache_pf_streams, /* default */4, /* print */TRUE, NULL);
+
+  opt_reg_string(odb, "-cache:il1",
+		 "l1 inst cache config, i.e., {<config>|dl1}",
+		 &cache_il1_opt, "dl1", /* print */TRUE, NULL);
+  opt_reg_note(odb,
+"  The -cache:sets, -cache:assoc, -cache:bsize, -cache:hitlat and -cache:repl\n"
+"  options configure the l1 data cache.  By default instruction fetches go\n"
+"  through it as well (-cache:il1 dl1); a split l1 instruction cache is\n"
+"  given as:\n"
+"\n"
+"    <nsets>:<bsize>:<assoc>:<repl>\n"
+"\n"
+"    <nsets>  - number of sets in the cache\n"
+"    <bsize>  - block size of the cache\n"
+"    <assoc>  - associativity of the cache\n"
+"    <repl>   - block replacement strategy, {fifo|lru|random|plru}\n"
+"\n"
+"    Examples:   -cache:il1 64:16:2:lru\n"
+"\n"
+"  The unified l2 cache behind both l1 caches uses the cache.c format,\n"
+"  <name>:<nsets>:<bsize>:<assoc>:<repl> with <repl> one of {l|f|r|p|s|b|d}:\n"
+"\n"
+"    Examples:   -cache:l2 ul2:256:64:4:l\n"
+"\n"
+"  Without an l2 cache an l1 miss costs -cache:misslat cycles, with one it\n"
+"  costs the l1 hit latency plus the l2 access, and l2 misses go to memory\n"
+"  (-mem:lat, -mem:width).\n"
+	       );
+  opt_reg_int(odb, "-cache:il1lat",
+	      "l1 instruction cache hit latency (in cycles)",
+	      &cache_il1_lat, /* default */1, /* print */TRUE, NULL);
+  opt_reg_string(odb, "-cache:l2",
+		 "unified l2 cache config, i.e., {<config>|none}",
+		 &cache_l2_opt, "none", /* print */TRUE, NULL);
+  opt_reg_int(odb, "-cache:l2lat",
+	      "l2 cache hit latency (in cycles)",
+	      &cache_l2_lat, /* default */6, /* print */TRUE, NULL);
+
+  opt_reg_string(odb, "-bpred",
+		 "branch predictor type {nottaken|taken|bimod|2lev|comb}",
+                 &pred_type, /* default */"nottaken",
+                 /* print */TRUE, /* format */NULL);
+  opt_reg_int_list(odb, "-bpred:bimod",
+		   "bimodal predictor config (<table size>)",
+		   bimod_config, bimod_nelt, &bimod_nelt,
+		   /* default */bimod_config,
+		   /* print */TRUE, /* format */NULL, /* !accrue */FALSE);
+  opt_reg_int_list(odb, "-bpred:2lev",
+                   "2-level predictor config "
+		   "(<l1size> <l2size> <hist_size> <xor>)",
+                   twolev_config, twolev_nelt, &twolev_nelt,
+		   /* default */twolev_config,
+                   /* print */TRUE, /* format */NULL, /* !accrue */FALSE);
+  opt_reg_int_list(odb, "-bpred:comb",
+		   "combining predictor config (<meta_table_size>)",
+		   comb_config, comb_nelt, &comb_nelt,
+		   /* default */comb_config,
+		   /* print */TRUE, /* format */NULL, /* !accrue */FALSE);
+  opt_reg_int(odb, "-bpred:ras",
+              "return address stack size (0 for no return stack)",
+              &ras_size, /* default */ras_size,
+              /* print */TRUE, /* format */NULL);
+  opt_reg_int_list(odb, "-bpred:btb",
+		   "BTB config (<num_sets> <associativity>)",
+		   btb_config, btb_nelt, &btb_nelt,
+		   /* default */btb_config,
+		   /* print */TRUE, /* format */NULL, /* !accrue */FALSE);
+  opt_reg_note(odb,
+"  Conditional branches are predicted in IF and resolved in EX, where a\n"
+"  misprediction squashes the instruction fetched behind the branch.  The\n"
+"  default `nottaken' is the pipeline without a predictor.  `taken' uses\n"
+"  the target decoded from the fetched instruction, the dynamic predictors\n"
+"  take it from the BTB and fall back to not taken on a BTB miss.  See\n"
+"  sim-outorder for the predictor configurations.\n"
+	       );
+
+  opt_reg_int(odb, "-decode:cache",
+	      "decoded instructions kept by PC (power of two, 0 to decode every time)",
+	      &predecode_size, /* default */1024, /* print */TRUE, NULL);
+
+  opt_reg_int_list(odb, "-mem:lat",
+		   "memory access latency (<first_chunk> <inter_chunk>)",
+		   mem_lat, mem_nelt, &mem_nelt, mem_lat,
+		   /* print */TRUE, /* format */NULL, /* !accrue */FALSE);
+  opt_reg_int(odb, "-mem:width", "memory access bus width (in bytes)",
+	      &mem_bus_width, /* default */8, /* print */TRUE, NULL);
+}
+
+/* memory access latency, assumed to not cross a page boundary */
+static unsigned int			/* total latency of access */
+mem_access_latency(int blk_sz)		/* block size accessed */
+{
+  int chunks = (blk_sz + (mem_bus_width - 1)) / mem_bus_width;
+
+  assert(chunks > 0);
+
+  return (/* first chunk latency */mem_lat[0] +
+	  (/* remainder chunk latency */mem_lat[1] * (chunks - 1)));
+}
+
+/* l1 cache miss handler, both l1 caches share the l2 cache */
+static unsigned int			/* latency of block access */
+l1_access_fn(enum mem_cmd cmd,		/* access cmd, Read or Write */
+	     md_addr_t baddr,		/* block address to access */
+	     int bsize,			/* size of block to access */
+	     tick_t now)		/* time of access */
+{
+  /* access next level of data cache hierarchy */
+  return cache_access(cache_l2, cmd, baddr, NULL, bsize,
+		      /* now */now, /* pudata */NULL, /* repl addr */NULL);
+}
+
+/* l2 cache block miss handler function */
+static unsigned int			/* latency of block access */
+l2_access_fn(enum mem_cmd cmd,		/* access cmd, Read or Write */
+	     md_addr_t baddr,		/* block address to access */
+	     int bsize,			/* size of block to access */
+	     struct cache_blk_t *blk,	/* ptr to block in upper level */
+	     tick_t now)		/* time of access */
+{
+  /* this is a miss to the lowest level, so access main memory */
+  return mem_access_latency(bsize);
 }
 
 /* check simulator-specific option values */
@@ -46,6 +312,137 @@ sim_check_options(struct opt_odb_t *odb, int argc, char **argv)
 {
   if (dlite_active)
     fatal("sim-pipe does not support DLite debugging");
+
+  char name[128], c, repl[128];
+  int nsets, bsize, assoc;
+
+  /* geometry and latencies are checked by ucache_init() */
+  cache_repl = ucache_str2policy(cache_repl_opt);
+  if (cache_nmshrs < 0)
+    fatal("number of MSHRs must be zero or more");
+  if (!mystricmp(cache_write_opt, "wb"))
+    cache_write_through = FALSE;
+  else if (!mystricmp(cache_write_opt, "wt"))
+    cache_write_through = TRUE;
+  else
+    fatal("bogus write policy `%s', use {wb|wt}", cache_write_opt);
+  if (cache_wbuf_size < 0)
+    fatal("write buffer size must be zero or more");
+  if (predecode_size < 0 || (predecode_size & (predecode_size - 1)) != 0)
+    fatal("decode cache size must be zero or a power of two");
+  if (!mystricmp(pred_type, "nottaken"))
+    {
+      /* static predictor, not taken */
+      pred = bpred_create(BPredNotTaken, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+    }
+  else if (!mystricmp(pred_type, "taken"))
+    {
+      /* static predictor, taken */
+      pred = bpred_create(BPredTaken, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+    }
+  else if (!mystricmp(pred_type, "bimod"))
+    {
+      if (bimod_nelt != 1)
+	fatal("bad bimod predictor config (<table_size>)");
+      if (btb_nelt != 2)
+	fatal("bad btb config (<num_sets> <associativity>)");
+
+      /* bimodal predictor, bpred_create() checks BTB_SIZE */
+      pred = bpred_create(BPred2bit,
+			  /* bimod table size */bimod_config[0],
+			  /* 2lev l1 size */0,
+			  /* 2lev l2 size */0,
+			  /* meta table size */0,
+			  /* history reg size */0,
+			  /* history xor address */0,
+			  /* btb sets */btb_config[0],
+			  /* btb assoc */btb_config[1],
+			  /* ret-addr stack size */ras_size);
+    }
+  else if (!mystricmp(pred_type, "2lev"))
+    {
+      /* 2-level adaptive predictor, bpred_create() checks args */
+      if (twolev_nelt != 4)
+	fatal("bad 2-level pred config (<l1size> <l2size> <hist_size> <xor>)");
+      if (btb_nelt != 2)
+	fatal("bad btb config (<num_sets> <associativity>)");
+
+      pred = bpred_create(BPred2Level,
+			  /* bimod table size */0,
+			  /* 2lev l1 size */twolev_config[0],
+			  /* 2lev l2 size */twolev_config[1],
+			  /* meta table size */0,
+			  /* history reg size */twolev_config[2],
+			  /* history xor address */twolev_config[3],
+			  /* btb sets */btb_config[0],
+			  /* btb assoc */btb_config[1],
+			  /* ret-addr stack size */ras_size);
+    }
+  else if (!mystricmp(pred_type, "comb"))
+    {
+      /* combining predictor, bpred_create() checks args */
+      if (twolev_nelt != 4)
+	fatal("bad 2-level pred config (<l1size> <l2size> <hist_size> <xor>)");
+      if (bimod_nelt != 1)
+	fatal("bad bimod predictor config (<table_size>)");
+      if (comb_nelt != 1)
+	fatal("bad combining predictor config (<meta_table_size>)");
+      if (btb_nelt != 2)
+	fatal("bad btb config (<num_sets> <associativity>)");
+
+      pred = bpred_create(BPredComb,
+			  /* bimod table size */bimod_config[0],
+			  /* l1 size */twolev_config[0],
+			  /* l2 size */twolev_config[1],
+			  /* meta table size */comb_config[0],
+			  /* history reg size */twolev_config[2],
+			  /* history xor address */twolev_config[3],
+			  /* btb sets */btb_config[0],
+			  /* btb assoc */btb_config[1],
+			  /* ret-addr stack size */ras_size);
+    }
+  else
+    fatal("cannot parse predictor type `%s'", pred_type);
+
+  /* degree, table size and streams are checked by ucache_prefetch() */
+  cache_pf = ucache_str2pf(cache_pf_opt);
+
+  if (!mystricmp(cache_il1_opt, "dl1"))
+    il1_split = FALSE;
+  else
+    {
+      if (sscanf(cache_il1_opt, "%d:%d:%d:%127s",
+		 &il1_nsets, &il1_bsize, &il1_assoc, repl) != 4)
+	fatal("bad l1 I-cache parms: <nsets>:<bsize>:<assoc>:<repl>");
+      il1_repl = ucache_str2policy(repl);
+      il1_split = TRUE;
+    }
+
+  if (mem_nelt != 2)
+    fatal("bad memory access latency (<first_chunk> <inter_chunk>)");
+  if (mem_lat[0] < 1 || mem_lat[1] < 1)
+    fatal("all memory access latencies must be greater than zero");
+  if (mem_bus_width < 1 || (mem_bus_width & (mem_bus_width-1)) != 0)
+    fatal("memory bus width must be positive non-zero and a power of two");
+
+  if (!mystricmp(cache_l2_opt, "none"))
+    cache_l2 = NULL;
+  else
+    {
+      if (sscanf(cache_l2_opt, "%[^:]:%d:%d:%d:%c",
+		 name, &nsets, &bsize, &assoc, &c) != 5)
+	fatal("bad l2 cache parms: <name>:<nsets>:<bsize>:<assoc>:<repl>");
+      if (cache_l2_lat < 1)
+	fatal("l2 cache latency must be greater than zero");
+      if (bsize < cache_bsize || (il1_split && bsize < il1_bsize))
+	fatal("l2 cache block size must be at least the l1 block size");
+      if (cache_char2policy(c) == OPT)
+	fatal("OPT replacement needs a recorded reference stream, use "
+	      "sim-cache -cache:trace");
+      cache_l2 = cache_create(name, nsets, bsize, /* balloc */FALSE,
+			      /* usize */0, assoc, cache_char2policy(c),
+			      l2_access_fn, /* hit lat */cache_l2_lat);
+    }
 }
 
 /* register simulator-specific statistics */
@@ -54,9 +451,21 @@ sim_reg_stats(struct stat_sdb_t *sdb)
 {
 #ifndef NO_INSN_COUNT
   stat_reg_counter(sdb, "sim_num_insn",
-       "total number of instructions executed",
+       "total number of instructions retired",
        &sim_num_insn, sim_num_insn, NULL);
 #endif /* !NO_INSN_COUNT */
+  stat_reg_counter(sdb, "sim_cycle",
+       "total simulation time in cycles",
+       &sim_num_clk, 0, NULL);
+  stat_reg_counter(sdb, "stall_load_use",
+       "cycles lost to load-use bubbles",
+       &stall_load_use, 0, NULL);
+  stat_reg_counter(sdb, "stall_branch",
+       "cycles lost to mispredicted branches",
+       &stall_branch, 0, NULL);
+  stat_reg_counter(sdb, "stall_cache",
+       "cycles lost to cache misses, beyond the hit latency",
+       &stall_cache, 0, NULL);
   stat_reg_int(sdb, "sim_elapsed_time",
          "total simulation time in seconds",
          &sim_elapsed_time, 0, NULL);
@@ -64,12 +473,57 @@ sim_reg_stats(struct stat_sdb_t *sdb)
   stat_reg_formula(sdb, "sim_inst_rate",
        "simulation speed (in insts/sec)",
        "sim_num_insn / sim_elapsed_time", NULL);
+  stat_reg_formula(sdb, "sim_IPC",
+       "instructions per cycle",
+       "sim_num_insn / sim_cycle", NULL);
+  stat_reg_formula(sdb, "sim_CPI",
+       "cycles per instruction",
+       "sim_cycle / sim_num_insn", NULL);
+  stat_reg_formula(sdb, "sim_CPI_load_use",
+       "cycles per instruction lost to load-use bubbles",
+       "stall_load_use / sim_num_insn", NULL);
+  stat_reg_formula(sdb, "sim_CPI_branch",
+       "cycles per instruction lost to mispredicted branches",
+       "stall_branch / sim_num_insn", NULL);
+  stat_reg_formula(sdb, "sim_CPI_cache",
+       "cycles per instruction lost to cache misses",
+       "stall_cache / sim_num_insn", NULL);
 #endif /* !NO_INSN_COUNT */
+  if (cache_nmshrs)
+    {
+      stat_reg_counter(sdb, "mshr_misses",
+		       "load misses overlapped through an MSHR",
+		       &mshr_misses, 0, NULL);
+      stat_reg_counter(sdb, "mshr_merges",
+		       "loads to a block still being filled",
+		       &mshr_merges, 0, NULL);
+      stat_reg_counter(sdb, "mshr_full_cycles",
+		       "cycles stalled with every MSHR busy",
+		       &mshr_full_cycles, 0, NULL);
+      stat_reg_counter(sdb, "mshr_wait_cycles",
+		       "cycles stalled waiting for an outstanding miss",
+		       &mshr_wait_cycles, 0, NULL);
+    }
+  if (predecode_size)
+    {
+      stat_reg_counter(sdb, "predecode_hits",
+		       "instructions decoded from the decode cache",
+		       &predecode_hits, 0, NULL);
+      stat_reg_counter(sdb, "predecode_misses",
+		       "instructions decoded from the instruction word",
+		       &predecode_misses, 0, NULL);
+      stat_reg_formula(sdb, "predecode_hit_rate",
+		       "decode cache hit rate",
+		       "predecode_hits / (predecode_hits + predecode_misses)",
+		       NULL);
+    }
+  bpred_reg_stats(pred, sdb);
+  if (cache_l2)
+    cache_reg_stats(cache_l2, sdb);
   ld_reg_stats(sdb);
   mem_reg_stats(mem, sdb);
 }
 
-counter_t sim_num_clk;
 FILE *stream;
 
 struct ifid_buf fd;
@@ -80,6 +534,9 @@ struct wb_buf wb;
 
 struct control_buf ctl;
 cache_t cache;
+cache_t icache_split;
+/* l1 instruction cache, &cache unless -cache:il1 gives a split one */
+cache_t *icache = &cache;
 
 #define DNA			(-1)
 
@@ -128,12 +585,31 @@ sim_init(void)
   ctl.regs = 0;
   ctl.stall = 0;
 
-  cache.enable = 1;
-  cache.access = 0;
-  cache.hit = 0;
-  cache.miss = 0;
-  cache.replace = 0;
-  cache.wb = 0;
+  ucache_init(&cache, mem, cache_nsets, cache_bsize, cache_assoc,
+             cache_repl, cache_hit_lat, cache_miss_lat,
+             cache_l2 ? l1_access_fn : NULL);
+  cache.enable = cache_enable;
+  ucache_write_policy(&cache, cache_write_through, cache_write_alloc,
+                      cache_wbuf_size);
+  ucache_prefetch(&cache, cache_pf, cache_pf_degree, cache_pf_table,
+                  cache_pf_streams);
+  if (il1_split) {
+    ucache_init(&icache_split, mem, il1_nsets, il1_bsize, il1_assoc,
+                il1_repl, cache_il1_lat, cache_miss_lat,
+                cache_l2 ? l1_access_fn : NULL);
+    icache_split.enable = cache_enable;
+    icache = &icache_split;
+  }
+  if (cache_nmshrs) {
+    mshrs = calloc(cache_nmshrs, sizeof(struct mshr_buf));
+    if (!mshrs)
+      fatal("out of virtual memory");
+  }
+  if (predecode_size) {
+    predecode_cache = calloc(predecode_size, sizeof(struct predecode_buf));
+    if (!predecode_cache)
+      fatal("out of virtual memory");
+  }
 
   stream = stdout;
 }
@@ -152,7 +628,11 @@ sim_load_prog(char *fname,		/* program to load */
 void
 sim_aux_config(FILE *stream)
 {  
-  /* nothing currently */
+  ucache_print_config(&cache, il1_split ? "dl1" : "l1", stream);
+  if (il1_split)
+    ucache_print_config(icache, "il1", stream);
+  if (cache_l2)
+    cache_config(cache_l2, stream);
 }
 
 /* dump simulator-specific auxiliary simulator statistics */
@@ -250,8 +730,11 @@ sim_main(void)
   regs.regs_R[MD_REG_ZERO] = 0;
  
   fd.PC = regs.regs_PC - sizeof(md_inst_t);
+  fd.predPC = regs.regs_PC;
   
   while (TRUE){
+    if (cache_nmshrs)
+      mshr_retire();
     pipeline_control();
     do_wb();
     do_mem();
@@ -259,11 +742,99 @@ sim_main(void)
     do_id();
     do_forward();    
     do_if();
-    INC_INSN_CTR();
     INC_CYCLE(1);
   }
 }
 
+/**
+ * MSHR Part
+ *
+ * With -cache:mshrs the data cache keeps going under a load miss: the line
+ * is filled functionally at once, but the destination register keeps its
+ * ctl.regs bit until the fill completes, so only a consumer of the load
+ * (or a store or fetch to the same block) waits for it.
+ */
+
+/* free the MSHRs whose fill is done, their registers become readable */
+void mshr_retire() {
+  int i;
+  for(i = 0; i < cache_nmshrs; i++) {
+    if(mshrs[i].valid && mshrs[i].ready <= sim_num_clk) {
+      ctl.regs &= ~mshrs[i].regs;
+      mshrs[i].valid = FALSE;
+    }
+  }
+}
+
+/* the MSHR filling block BADDR, or NULL */
+struct mshr_buf *mshr_lookup(md_addr_t baddr) {
+  int i;
+  for(i = 0; i < cache_nmshrs; i++) {
+    if(mshrs[i].valid && mshrs[i].baddr == baddr) {
+      return &mshrs[i];
+    }
+  }
+  return NULL;
+}
+
+/* a free MSHR, stalls until the oldest fill completes if none is free */
+struct mshr_buf *mshr_alloc() {
+  struct mshr_buf *m = NULL;
+  int i;
+  for(i = 0; i < cache_nmshrs; i++) {
+    if(!mshrs[i].valid) {
+      return &mshrs[i];
+    }
+    if(!m || mshrs[i].ready < m->ready) {
+      m = &mshrs[i];
+    }
+  }
+  mshr_full_cycles += m->ready - sim_num_clk;
+  stall_cache += m->ready - sim_num_clk;
+  INC_CYCLE(m->ready - sim_num_clk);
+  mshr_retire();
+  return m;
+}
+
+/* a newer load writes REG, older fills must not release it */
+void mshr_release_reg(int reg) {
+  int i;
+  for(i = 0; i < cache_nmshrs; i++) {
+    mshrs[i].regs &= ~(1 << reg);
+  }
+}
+
+/* stall until the fill of M completes */
+void mshr_wait(struct mshr_buf *m) {
+  if(m->ready > sim_num_clk) {
+    mshr_wait_cycles += m->ready - sim_num_clk;
+    stall_cache += m->ready - sim_num_clk;
+    INC_CYCLE(m->ready - sim_num_clk);
+  }
+  mshr_retire();
+}
+
+/* stall until REG is written, if a fill is holding it */
+void mshr_wait_reg(int reg) {
+  int i;
+  for(i = 0; i < cache_nmshrs; i++) {
+    if(mshrs[i].valid && (mshrs[i].regs & (1 << reg))) {
+      mshr_wait(&mshrs[i]);
+      return;
+    }
+  }
+}
+
+/* wait for every outstanding miss */
+void mshr_drain() {
+  int i;
+  for(i = 0; i < cache_nmshrs; i++) {
+    if(mshrs[i].valid) {
+      mshr_wait(&mshrs[i]);
+    }
+  }
+}
+
 void forward(int *val, int *src) {
   if(*src != DNA) {
     if(*src == em.dstE) {
@@ -296,6 +867,7 @@ void pipeline_control() {
     /* predict wrong */    
     if(ctl.cond&2){
       de.inst.a = NOP;
+      stall_branch++;
     }
     ctl.flag = FALSE;
     ctl.cond = FALSE;
@@ -304,6 +876,8 @@ void pipeline_control() {
   if(ctl.stall) {
     fd.PC = de.PC;
     fd.inst = de.inst;
+    fd.predPC = de.predPC;
+    fd.dir_update = de.dir_update;
     de.inst.a = NOP;
   }
 }
@@ -314,22 +888,145 @@ void do_if() {
   } else if(ctl.cond&1) {
     fd.NPC = de.target;
   } else {
-    fd.NPC = fd.PC + sizeof(md_inst_t);
+    fd.NPC = fd.predPC;
   }
   md_inst_t instruction;
   fd.PC = fd.NPC;
   int cycles = 10;
-  if(cache.enable) {
-      cycles = cache_read(&cache, fd.PC, &(instruction.a));
-      cycles += cache_read(&cache, fd.PC+4, &(instruction.b));
+  if(icache->enable) {
+      struct mshr_buf *m;
+      if(cache_nmshrs && icache == &cache
+         && (m = mshr_lookup(UCACHE_TAGSET(&cache, fd.PC))) != NULL) {
+        mshr_wait(m);
+      }
+      cycles = ucache_read(icache, fd.PC, &(instruction.a), 0, sim_num_clk);
+      cycles += ucache_read(icache, fd.PC+4, &(instruction.b), 0, sim_num_clk);
+      stall_cache += cycles - 2 * icache->hit_lat;
   } else {
       MD_FETCH_INSTI(instruction, mem, fd.PC);
   }
   fd.inst = instruction;
+  fd.predPC = fd.PC + sizeof(md_inst_t);
+  if(pred) {
+    enum md_opcode op;
+    md_addr_t target;
+    int stack_idx;
+    MD_SET_OPCODE(op, instruction);
+    if(MD_OP_FLAGS(op) & F_COND) {
+      /* the target do_id decodes, for the static taken predictor */
+      target = fd.PC + 8 + ((instruction.b & 0xffff) << 2);
+      target = bpred_lookup(pred, fd.PC, target, op, FALSE, FALSE,
+                            &fd.dir_update, &stack_idx);
+      /* 0 and 1 are not taken and taken with a BTB miss, neither has a target */
+      if(target > 1) {
+        fd.predPC = target;
+      }
+    }
+  }
   INC_CYCLE(cycles);
 }
 
+/**
+ * Decode Part
+ *
+ * Everything do_id derives from the instruction word alone is decoded
+ * once into a predecode_buf and kept by PC, so a loop body is decoded on
+ * its first iteration only.  A store into the text segment drops the
+ * entry of the instruction it overwrites.
+ */
+
+/* decode INST at PC into P */
+void predecode(struct predecode_buf *p, md_inst_t inst, md_addr_t PC) {
+  p->PC = PC;
+  MD_SET_OPCODE(p->opcode, inst);
+  switch(p->opcode) {
+#define DEFINST(OP,MSK,NAME,OPFORM,RES,FLAGS,O1,O2,I1,I2,I3)\
+  case OP:\
+    p->instFlags = FLAGS;\
+    p->oprand.out1 = O1;\
+    p->oprand.out2 = O2;\
+    p->oprand.in1 = I1;\
+    p->oprand.in2 = I2;\
+    p->oprand.in3 = I3;\
+    break;
+#define DEFLINK(OP,MSK,NAME,MASK,SHIFT)
+#define CONNECT(OP)
+#include "machine.def"
+    default:
+      p->instFlags = 0;
+      p->oprand.out1 = p->oprand.out2 = DNA;
+      p->oprand.in1 = p->oprand.in2 = p->oprand.in3 = DNA;
+      break;
+  }
+  p->target = 0;
+  switch(p->opcode){
+    case LUI:
+      p->instFlags |= F_IMM;
+    case LW:
+    case SW:
+    case ADD:
+    case ADDI:
+    case ADDU:
+    case ADDIU:
+      p->func = ALU_ADD;
+      break;
+    case BNE:
+    case BEQ:
+      p->target = PC + 8 + ((inst.b & 0xffff) << 2);
+      p->func = ALU_SUB;
+      break;
+    case ANDI:
+      p->func = ALU_AND;
+      break;
+    case SLL:
+      p->func = ALU_SHTL;
+      break;
+    case SLTI:
+      p->func = ALU_SLT;
+      break;
+    case JUMP:
+      p->target = (PC & 0xf0000000) | ((inst.b & 0x3ffffff) << 2);
+      p->func = ALU_NOP;
+      break;
+    default:
+      p->func = ALU_NOP;
+      break;
+  }
+  /* src A*/
+  if(p->instFlags & F_DISP) {
+    p->srcA = p->oprand.in2;
+  } else {
+    p->srcA = p->oprand.in1;
+  }
+  /* src B */
+  p->srcB = p->oprand.in2;
+  /* store */
+  p->rw = 0;
+  if(p->instFlags&F_STORE) {
+    p->rw |= 2;
+  }
+  /* dst/read */
+  if(p->instFlags&F_LOAD) {
+    p->rw |= 4;
+    p->dstM = p->oprand.out1;
+    p->dstE = DNA;
+  } else {
+    p->dstE = p->oprand.out1;
+    p->dstM = DNA;
+  }
+}
+
+/* drop the decoded instruction ADDR writes into */
+void predecode_invalidate(md_addr_t addr) {
+  md_addr_t PC = addr & ~(md_addr_t)(sizeof(md_inst_t) - 1);
+  struct predecode_buf *p = &predecode_cache[(PC >> 3) & (predecode_size - 1)];
+  if(p->PC == PC) {
+    p->PC = 0;
+  }
+}
+
 void do_id() {
+    struct predecode_buf *p, tmp;
     de.inst = fd.inst;
     de.PC = fd.PC;
     de.rw = 0;
@@ -337,96 +1034,70 @@ void do_id() {
     if(de.inst.a == NOP) {
       return;
     }
-    MD_SET_OPCODE(de.opcode, de.inst);
-    md_inst_t inst = de.inst;
-#define DEFINST(OP,MSK,NAME,OPFORM,RES,FLAGS,O1,O2,I1,I2,I3)\
-  if (OP==de.opcode){\
-    de.instFlags = FLAGS;\
-    de.oprand.out1 = O1;\
-    de.oprand.out2 = O2;\
-    de.oprand.in1 = I1;\
-    de.oprand.in2 = I2;\
-    de.oprand.in3 = I3;\
-    goto READ_OPRAND_VALUE;\
+    if(predecode_size) {
+      p = &predecode_cache[(fd.PC >> 3) & (predecode_size - 1)];
+      if(p->PC == fd.PC) {
+        predecode_hits++;
+      } else {
+        predecode(p, fd.inst, fd.PC);
+        predecode_misses++;
+      }
+    } else {
+      p = &tmp;
+      predecode(p, fd.inst, fd.PC);
+    }
+    de.opcode = p->opcode;
+    de.instFlags = p->instFlags;
+    de.oprand = p->oprand;
+    de.predPC = fd.predPC;
+    de.dir_update = fd.dir_update;
+  /* a source still being filled by a data cache miss */
+  if(cache_nmshrs) {
+    if(de.oprand.in1 >= 0 && (ctl.regs&1<<de.oprand.in1)) {
+      mshr_wait_reg(de.oprand.in1);
+    }
+    if(de.oprand.in2 >= 0 && (ctl.regs&1<<de.oprand.in2)) {
+      mshr_wait_reg(de.oprand.in2);
+    }
   }
-#define DEFLINK(OP,MSK,NAME,MASK,SHIFT)
-#define CONNECT(OP)
-#include "machine.def"
-READ_OPRAND_VALUE:
   /* check for stall */    
   if((de.oprand.in1 >= 0 && (ctl.regs&1<<de.oprand.in1)) || (de.oprand.in2 >= 0 && (ctl.regs&1<<de.oprand.in2))) {
     ctl.stall = TRUE;
+    stall_load_use++;
     return;
   } else {
     ctl.stall = FALSE;
   }
-  
+
+  de.func = p->func;
+  de.target = p->target;
+  de.srcA = p->srcA;
+  de.srcB = p->srcB;
+  de.rw = p->rw;
+  de.dstE = p->dstE;
+  de.dstM = p->dstM;
   switch(de.opcode){
-    case LUI:
-      de.instFlags |= F_IMM;
-    case LW:
-    case SW:
-    case ADD:
-    case ADDI:
-    case ADDU:
-    case ADDIU:    
-      de.func = ALU_ADD;
-      break;
     case BNE:
       ctl.flag = TRUE;
       ctl.cmp = 1;
-      de.target = fd.PC + 8 + ((de.inst.b & 0xffff) << 2);
-      de.func = ALU_SUB;
       break;
     case BEQ:
       ctl.flag = TRUE;
       ctl.cmp = 0;
-      de.target = fd.PC + 8 + ((de.inst.b & 0xffff) << 2);
-      de.func = ALU_SUB;
-      break;
-    case ANDI:
-      de.func = ALU_AND;
-      break;
-    case SLL:
-      de.func = ALU_SHTL;
-      break;
-    case SLTI:
-      de.func = ALU_SLT;
       break;
     case JUMP:
       ctl.flag = TRUE;
       ctl.cond |= 1;
-      de.target = (fd.PC & 0xf0000000) | ((de.inst.b & 0x3ffffff) << 2);
-      de.func = ALU_NOP;      
       break;
     case MFLO:
       SET_GPR(de.oprand.out1, LO);
-    case MULTU:
-    default:
-      de.func = ALU_NOP;
-      break;        
-  }
-  /* src A*/
-  if(de.instFlags & F_DISP) {
-    de.srcA = de.oprand.in2; 
-  } else {
-    de.srcA = de.oprand.in1; 
+      break;
   }
-  /* src B */
-  de.srcB = de.oprand.in2; 
-  /* load */
-  if(de.instFlags&F_STORE) {
-    de.rw |= 2;    
-  }
-  /* dst/read */ 
-  if(de.instFlags&F_LOAD) {
-    de.rw |= 4;
-    de.dstM = de.oprand.out1;
-    de.dstE = DNA;
+  if(de.rw&4) {
     ctl.regs |= 1 << de.dstM;
-  } else {
-    de.dstE = de.oprand.out1;
-    de.dstM = DNA;
+    if(cache_nmshrs) {
+      mshr_release_reg(de.dstM);
+    }
   }
 }
 
@@ -497,7 +1168,17 @@ void do_ex() {
       break;
   }
   if(ctl.flag) {
-    if((ctl.cmp && em.valE) || (!ctl.cmp && !em.valE)) {    
+    int taken = (ctl.cmp && em.valE) || (!ctl.cmp && !em.valE);
+    md_addr_t NPC = taken ? de.target : de.PC + sizeof(md_inst_t);
+    if(pred) {
+      bpred_update(pred, de.PC, NPC, taken,
+                   /* pred taken? */de.predPC != de.PC + sizeof(md_inst_t),
+                   /* correct pred? */de.predPC == NPC,
+                   de.opcode, &de.dir_update);
+    }
+    if(de.predPC != NPC) {
+      /* mispredicted, IF refetches from the resolved next PC */
+      em.target = NPC;
       ctl.cond |= 2;
     } else {
       ctl.flag = FALSE;
@@ -518,8 +1199,32 @@ void do_mem() {
   mw.rw = em.rw;
   int cycles = 0;    
   if(mw.rw&4) { /* load */
-    if(cache.enable){
-      cycles = cache_read(&cache, mw.valE, (word_t *)&mw.valM);
+    if(cache.enable && cache_nmshrs) {
+      struct mshr_buf *m = mshr_lookup(UCACHE_TAGSET(&cache, mw.valE));
+      unsigned int misses = cache.miss;
+      cycles = ucache_read(&cache, mw.valE, (word_t *)&mw.valM, mw.PC, sim_num_clk);
+      if(cache.miss != misses) {
+        /* primary miss, the pipeline only pays for the lookup */
+        m = mshr_alloc();
+        m->valid = TRUE;
+        m->baddr = UCACHE_TAGSET(&cache, mw.valE);
+        m->ready = sim_num_clk + cycles;
+        m->regs = 0;
+        cycles = cache.hit_lat;
+        mshr_misses++;
+      } else if(m) {
+        /* secondary miss, waits for the same fill */
+        mshr_merges++;
+      }
+      stall_cache += cycles - cache.hit_lat;
+      if(m) {
+        m->regs |= 1 << mw.dstM;
+        INC_CYCLE(cycles);
+        return;
+      }
+    } else if(cache.enable){
+      cycles = ucache_read(&cache, mw.valE, (word_t *)&mw.valM, mw.PC, sim_num_clk);
+      stall_cache += cycles - cache.hit_lat;
     } else {
       mw.valM = READ_WORD(mw.valE, _fault);
       if(_fault != md_fault_none){
@@ -529,8 +1234,16 @@ void do_mem() {
     }
     ctl.regs &= ~(1 << mw.dstM);
   } else if(mw.rw&2) { /* save */
+    if(predecode_size && mw.valE - ld_text_base < ld_text_size) {
+      predecode_invalidate(mw.valE);
+    }
     if(cache.enable){
-      cycles = cache_write(&cache, mw.valE, (word_t *)&em.valA);
+      struct mshr_buf *m;
+      if(cache_nmshrs && (m = mshr_lookup(UCACHE_TAGSET(&cache, mw.valE))) != NULL) {
+        mshr_wait(m);
+      }
+      cycles = ucache_write(&cache, mw.valE, (word_t *)&em.valA, mw.PC, sim_num_clk);
+      stall_cache += cycles - cache.hit_lat;
     } else {
       WRITE_WORD(em.valA, mw.valE, _fault);
       if(_fault != md_fault_none){
@@ -558,8 +1271,15 @@ void do_wb() {
   if(mw.dstE != DNA) {
     SET_GPR(mw.dstE, mw.valE);
   }
+  INC_INSN_CTR();
   if(wb.inst.a == SYSCALL){
-    cache_flush(&cache);
+    if(cache_nmshrs) {
+      mshr_drain();
+    }
+    ucache_flush(&cache, sim_num_clk);
+    if(il1_split) {
+      ucache_flush(icache, sim_num_clk);
+    }
     cache_log();
     SYSCALL(wb.inst);
   }
@@ -571,7 +1291,7 @@ void do_wb() {
 
 void do_log() {
     enum md_fault_type _fault;
-    fprintf(stream, "[Cycle %4lld]---------------------------------------", sim_num_insn);
+    fprintf(stream, "[Cycle %4lld]---------------------------------------", sim_num_clk);
     fprintf(stream, "\n[IF]\t");
     md_print_insn(fd.inst, fd.PC, stream);
     fprintf(stream, "\n[ID]\t");
@@ -605,6 +1325,36 @@ void cache_log() {
   fprintf(stream, "Memory Misses: %d\n", cache.miss);
   fprintf(stream, "Line Replacements: %d\n", cache.replace);
   fprintf(stream, "Line Write-backs: %d\n", cache.wb);
+  if(cache.write_through) {
+    fprintf(stream, "Store Write-throughs: %u\n", cache.write_thru);
+  }
+  if(!cache.write_alloc) {
+    fprintf(stream, "Store Write-arounds: %u\n", cache.write_around);
+  }
+  if(cache.wbuf_size) {
+    fprintf(stream, "Write Buffer Merges: %u\n", cache.wbuf_merge);
+    fprintf(stream, "Write Buffer Full Cycles: %lld\n", cache.wbuf_full);
+  }
+  if(cache.pf_kind != PF_NONE) {
+    unsigned int useful = cache.pf_useful;
+    fprintf(stream, "Prefetches Issued: %u\n", cache.pf_issued);
+    fprintf(stream, "Prefetches Useful: %u\n", useful);
+    fprintf(stream, "Prefetches Late: %u\n", cache.pf_late);
+    fprintf(stream, "Prefetches Useless: %u\n", cache.pf_useless);
+    /* useful/issued, covered share of the would-be misses, useful ones on time */
+    fprintf(stream, "Prefetch Accuracy: %.4f\n",
+            cache.pf_issued ? (double)useful / cache.pf_issued : 0.0);
+    fprintf(stream, "Prefetch Coverage: %.4f\n",
+            useful + cache.miss ? (double)useful / (useful + cache.miss) : 0.0);
+    fprintf(stream, "Prefetch Timeliness: %.4f\n",
+            useful ? (double)(useful - cache.pf_late) / useful : 0.0);
+  }
+  if(il1_split) {
+    fprintf(stream, "Inst Accesses: %d\n", icache->access);
+    fprintf(stream, "Inst Hits: %d\n", icache->hit);
+    fprintf(stream, "Inst Misses: %d\n", icache->miss);
+    fprintf(stream, "Inst Replacements: %d\n", icache->replace);
+  }
   if(_fault != md_fault_none){
     DECLARE_FAULT(_fault);
   }
@@ -659,136 +1409,3 @@ void init_wb() {
   wb.dstE = DNA;
   wb.dstM = DNA;
 }
-
-/**
- * Cache Part  
- * Update time: Thu May 17 2018 09:59:35 GMT+0800
- */
-
-void en_cache_set(cache_set_t *set, cache_line_t *line) {
-    if (set->tail != NULL) {
-        set->tail->next = line;
-    }
-    set->tail = line;
-    if (set->head == NULL) {
-        set->head = line;
-    }
-    set->n += 1;
-}
-
-void de_cache_set(cache_set_t *set) {
-    if (set->n == 0) {
-        return;
-    }
-    cache_line_t *head = set->head;
-    set->head = head->next;
-    set->n -= 1;
-    if (set->n == 0) {
-        set->tail = NULL;
-    }
-    free(head);
-}
-
-void cache_word_read(cache_line_t *line, word_t *dst, int offset) {
-    memcpy(dst, (void *)(&line->data)+offset, sizeof(word_t));   
-}
-
-void cache_word_write(cache_line_t *line, word_t *src, int offset) {
-    memcpy((void *)(&line->data)+offset, src, sizeof(word_t));
-    line->dirty = 1;
-}
-
-int cache_access(cache_t *cache, md_addr_t addr, word_t *word, cache_word_func func) {
-  unsigned int tag = ADDR_TAG(addr);
-  unsigned int index = ADDR_INDEX(addr);
-  unsigned int offset = ADDR_OFFSET(addr);
-
-  cache_set_t *set = &cache->sets[index];
-  cache_line_t *line = NULL;
-  md_addr_t align_addr = addr & (~0xF);
-  int cycles = 1;
-  int miss = 1;
-  cache->access++;
-  for(line = set->head; line != NULL; line = line->next) {
-    if(line->valid && tag == line->tag) {
-      miss = 0;
-      line->ref_count++;
-      cache->hit++;
-      func(line, word, offset);
-    }
-  }
-  // miss here
-  if(miss) {
-    cycles = 10;
-    cache->miss++;
-    line = malloc_cache_line(align_addr);
-    add_into_cache_set(set, line, index);
-    func(line, word, offset);
-  }
-  return cycles;
-}
-
-int cache_read(cache_t *cache, md_addr_t addr, word_t *word) {
-  return cache_access(cache, addr, word, cache_word_read);
-}
-
-int cache_write(cache_t *cache, md_addr_t addr, word_t *word) {
-  return cache_access(cache, addr, word, cache_word_write);
-}
-
-void cache_flush(cache_t* cache) {
-  cache_set_t *set;
-  cache_line_t *line;
-  int i;
-  for(i = 0; i < 16; i++) {
-    set = &cache->sets[i];
-    for(line = set->head; line != NULL; line = line->next) {
-      if(line->dirty) {
-        cache_write_back(line, i);
-      }
-    }
-  }
-}
-
-cache_line_t *malloc_cache_line(md_addr_t addr) {
-  cache_line_t *line = malloc(sizeof(cache_line_t));
-  int i;
-  enum md_fault_type _fault;    
-  for(i = 0; i < 4; i++) {
-    line->data[i] = READ_WORD(addr+(i*4), _fault);
-  }
-  if(_fault != md_fault_none) {
-    panic("Memory Write Error!");
-  }
-  line->ref_count = 0;
-  line->tag = ADDR_TAG(addr);
-  line->dirty = 0;
-  line->valid = 1;
-  line->next = NULL;
-  return line;
-}
-
-void cache_write_back(cache_line_t *line, int index) {
-  md_addr_t addr = (line->tag<<8) | (index<<4);
-  int i;
-  enum md_fault_type _fault;
-  for(i = 0; i < 4; i++) {
-    WRITE_WORD(line->data[i], addr+(i*4), _fault);
-  }
-  line->dirty = 0;    
-  if(_fault != md_fault_none) {
-    panic("MEMORY ERROR!");
-  }
-}
-
-void add_into_cache_set(cache_set_t *set, cache_line_t *line, int index) {
-  if(set->n >= SET_NUM) {
-    if(set->head->dirty) {
-      cache.wb++;
-      cache_write_back(set->head, index);
-    }
-    cache.replace++;
-    de_cache_set(set);
-  }
-  en_cache_set(set, line);
-}
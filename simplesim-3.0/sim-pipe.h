@@ -15,6 +15,8 @@ struct ifid_buf {
   md_inst_t inst;	    /* instruction that has been fetched */
   md_addr_t PC;	        /* pc value of current instruction */
   md_addr_t NPC;		/* the next instruction to fetch */
+  md_addr_t predPC;     /* predicted next PC of inst */
+  struct bpred_update_t dir_update;  /* predictor state for the update in EX */
 };
 
 
@@ -35,6 +37,8 @@ struct idex_buf {
   int dstM;
   int rw;
   int target;
+  md_addr_t predPC;
+  struct bpred_update_t dir_update;
 };
 
 /*define buffer between execute and memory stage*/
@@ -78,6 +82,29 @@ struct control_buf {
   int stall;
 };
 
+/*miss status holding register, one outstanding data cache miss*/
+struct mshr_buf {
+  int valid;
+  md_addr_t baddr;    /* block being filled */
+  tick_t ready;       /* cycle the fill completes */
+  int regs;           /* load destinations waiting for the fill */
+};
+
+/*predecoded instruction, the decode-time fields of idex_buf*/
+struct predecode_buf {
+  md_addr_t PC;         /* instruction address, 0 for an empty entry */
+  int opcode;
+  oprand_t oprand;
+  int instFlags;
+  int func;
+  int srcA;
+  int srcB;
+  int dstE;
+  int dstM;
+  int rw;
+  int target;
+};
+
 typedef enum {
   ALU_NOP = 0,
   ALU_ADD,
@@ -107,6 +134,19 @@ void do_wb();
 /*pipeline control*/
 void pipeline_control();
 
+/*mshr*/
+void mshr_retire();
+struct mshr_buf *mshr_lookup(md_addr_t baddr);
+struct mshr_buf *mshr_alloc();
+void mshr_release_reg(int reg);
+void mshr_wait(struct mshr_buf *m);
+void mshr_wait_reg(int reg);
+void mshr_drain();
+
+/*predecode*/
+void predecode(struct predecode_buf *p, md_inst_t inst, md_addr_t PC);
+void predecode_invalidate(md_addr_t addr);
+
 /*do forward*/
 void do_forward();
 void forward();
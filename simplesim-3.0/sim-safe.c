@@ -101,6 +101,9 @@ sim_reg_options(struct opt_odb_t *odb)
 	       &max_insts, /* default */0,
 	       /* print */TRUE, /* format */NULL);
 
+  /* page permissions, checked on every access */
+  mem_reg_protect(odb);
+
 }
 
 /* check simulator-specific option values */
@@ -233,27 +236,41 @@ sim_uninit(void)
 #error No ISA target defined...
 #endif
 
-/* precise architected memory state accessor macros */
+/* precise architected memory state accessor macros, the page permissions
+   are checked, see -mem:protect */
 #define READ_BYTE(SRC, FAULT)						\
-  ((FAULT) = md_fault_none, addr = (SRC), MEM_READ_BYTE(mem, addr))
+  (addr = (SRC), (FAULT) = MEM_CHECK(mem, addr, MEM_PG_R),		\
+   MEM_READ_BYTE(mem, addr))
 #define READ_HALF(SRC, FAULT)						\
-  ((FAULT) = md_fault_none, addr = (SRC), MEM_READ_HALF(mem, addr))
+  (addr = (SRC), (FAULT) = MEM_CHECK(mem, addr, MEM_PG_R),		\
+   MEM_READ_HALF(mem, addr))
 #define READ_WORD(SRC, FAULT)						\
-  ((FAULT) = md_fault_none, addr = (SRC), MEM_READ_WORD(mem, addr))
+  (addr = (SRC), (FAULT) = MEM_CHECK(mem, addr, MEM_PG_R),		\
+   MEM_READ_WORD(mem, addr))
 #ifdef HOST_HAS_QWORD
 #define READ_QWORD(SRC, FAULT)						\
-  ((FAULT) = md_fault_none, addr = (SRC), MEM_READ_QWORD(mem, addr))
+  (addr = (SRC), (FAULT) = MEM_CHECK(mem, addr, MEM_PG_R),		\
+   MEM_READ_QWORD(mem, addr))
 #endif /* HOST_HAS_QWORD */
 
+/* a faulting write leaves memory untouched */
 #define WRITE_BYTE(SRC, DST, FAULT)					\
-  ((FAULT) = md_fault_none, addr = (DST), MEM_WRITE_BYTE(mem, addr, (SRC)))
+  (addr = (DST), (FAULT) = MEM_CHECK(mem, addr, MEM_PG_W),		\
+   (FAULT) == md_fault_none						\
+   ? (void)MEM_WRITE_BYTE(mem, addr, (SRC)) : (void)0)
 #define WRITE_HALF(SRC, DST, FAULT)					\
-  ((FAULT) = md_fault_none, addr = (DST), MEM_WRITE_HALF(mem, addr, (SRC)))
+  (addr = (DST), (FAULT) = MEM_CHECK(mem, addr, MEM_PG_W),		\
+   (FAULT) == md_fault_none						\
+   ? (void)MEM_WRITE_HALF(mem, addr, (SRC)) : (void)0)
 #define WRITE_WORD(SRC, DST, FAULT)					\
-  ((FAULT) = md_fault_none, addr = (DST), MEM_WRITE_WORD(mem, addr, (SRC)))
+  (addr = (DST), (FAULT) = MEM_CHECK(mem, addr, MEM_PG_W),		\
+   (FAULT) == md_fault_none						\
+   ? (void)MEM_WRITE_WORD(mem, addr, (SRC)) : (void)0)
 #ifdef HOST_HAS_QWORD
 #define WRITE_QWORD(SRC, DST, FAULT)					\
-  ((FAULT) = md_fault_none, addr = (DST), MEM_WRITE_QWORD(mem, addr, (SRC)))
+  (addr = (DST), (FAULT) = MEM_CHECK(mem, addr, MEM_PG_W),		\
+   (FAULT) == md_fault_none						\
+   ? (void)MEM_WRITE_QWORD(mem, addr, (SRC)) : (void)0)
 #endif /* HOST_HAS_QWORD */
 
 /* system call handler macro */
@@ -288,6 +305,8 @@ sim_main(void)
 #endif /* TARGET_ALPHA */
 
       /* get the next instruction to execute */
+      if (MEM_CHECK(mem, regs.regs_PC, MEM_PG_X) != md_fault_none)
+	fatal("fault (%d) detected @ 0x%08p", md_fault_access, regs.regs_PC);
       MD_FETCH_INST(inst, mem, regs.regs_PC);
 
       /* keep an instruction count */
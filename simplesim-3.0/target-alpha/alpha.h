@@ -203,6 +203,10 @@ extern md_inst_t MD_NOP_INST;
 /* maximum size of argc+argv+envp environment */
 #define MD_MAX_ENVIRON		16384
 
+/* maximum size of the stack, the stack segment spans this much below
+   MD_STACK_BASE */
+#define MD_MAX_STACK		(16*1024*1024)
+
 
 /*
  * machine.def specific definitions
@@ -562,7 +566,7 @@ word_t md_xor_regs(struct regs_t *regs);
 #define MD_VALID_ADDR(ADDR)						\
   (((ADDR) >= ld_text_base && (ADDR) < (ld_text_base + ld_text_size))	\
    || ((ADDR) >= ld_data_base && (ADDR) < ld_brk_point)			\
-   || ((ADDR) >= (ld_stack_base - 16*1024*1024) && (ADDR) < ld_stack_base))
+   || ((ADDR) >= (ld_stack_base - MD_MAX_STACK) && (ADDR) < ld_stack_base))
 
 /*
  * configure branch predictors
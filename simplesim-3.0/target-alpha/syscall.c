@@ -1415,6 +1415,10 @@ sys_syscall(struct regs_t *regs,	/* registers to access */
 	  myfprintf(stderr, "SYS_sbrk: delta: 0x%012p (%ld)\n", delta, delta);
 
 	ld_brk_point = addr;
+
+	/* the heap ends at the new breakpoint */
+	mem_protect(mem, ld_data_base, ld_brk_point - ld_data_base,
+		    MEM_PG_R|MEM_PG_W);
 	regs->regs_R[MD_REG_V0] = ld_brk_point;
 	regs->regs_R[MD_REG_A3] = 0;
 
@@ -1451,6 +1455,10 @@ sys_syscall(struct regs_t *regs,	/* registers to access */
 	  myfprintf(stderr, "SYS_obreak: addr: 0x%012p\n", addr);
 
 	ld_brk_point = addr;
+
+	/* the heap ends at the new breakpoint */
+	mem_protect(mem, ld_data_base, ld_brk_point - ld_data_base,
+		    MEM_PG_R|MEM_PG_W);
 	regs->regs_R[MD_REG_V0] = ld_brk_point;
 	regs->regs_R[MD_REG_A3] = 0;
 
@@ -146,6 +146,18 @@ ld_reg_stats(struct stat_sdb_t *sdb)	/* stats data base */
 }
 
 
+/* set the page permissions of the program segments, the heap grows with
+   brk() up from the data segment; a no-op unless -mem:protect is given */
+static void
+ld_protect(struct mem_t *mem)		/* memory space to protect */
+{
+  mem_protect(mem, ld_text_base, ld_text_size, MEM_PG_R|MEM_PG_X);
+  mem_protect(mem, ld_data_base, ld_brk_point - ld_data_base,
+	      MEM_PG_R|MEM_PG_W);
+  mem_protect(mem, ld_stack_base - MD_MAX_STACK, MD_MAX_STACK,
+	      MEM_PG_R|MEM_PG_W);
+}
+
 /* load program text and initialized data into simulated virtual memory
    space and initialize program segment range variables */
 void
@@ -209,6 +221,8 @@ ld_load_prog(char *fname,		/* program to load */
       ld_environ_base = regs->regs_R[MD_REG_SP];
       ld_prog_entry = regs->regs_PC;
 
+      ld_protect(mem);
+
       /* fini... */
       return;
     }
@@ -663,4 +677,7 @@ ld_load_prog(char *fname,		/* program to load */
 	  fatal("could not write instruction memory");
       }
   }
+
+  /* the text is read-only from here on */
+  ld_protect(mem);
 }
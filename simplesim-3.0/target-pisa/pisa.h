@@ -216,6 +216,10 @@ extern md_inst_t MD_NOP_INST;
 /* maximum size of argc+argv+envp environment */
 #define MD_MAX_ENVIRON		16384
 
+/* maximum size of the stack, the stack segment spans this much below
+   MD_STACK_BASE */
+#define MD_MAX_STACK		(16*1024*1024)
+
 
 /*
  * machine.def specific definitions
@@ -937,6 +937,10 @@ sys_syscall(struct regs_t *regs,	/* registers to access */
 	    regs->regs_R[2] = 0;
 	    regs->regs_R[7] = 0;
 	    ld_brk_point = addr;
+
+	    /* the heap ends at the new breakpoint */
+	    mem_protect(mem, ld_data_base, ld_brk_point - ld_data_base,
+			MEM_PG_R|MEM_PG_W);
 	  }
 	else
 	  {
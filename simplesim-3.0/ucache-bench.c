@@ -0,0 +1,303 @@
+/*
+ * ucache-bench.c - micro-benchmark for the Project2 cache
+ *
+ * Replays one synthetic sim-pipe style reference stream (sequential
+ * instruction fetches out of a small loop body interleaved with a strided
+ * load/store walk over an array much larger than the cache) through the
+ * original malloc'ed linked-list cache and through the array-backed cache
+ * in ucache.c, checks that both produce the same hit/miss/replacement and
+ * write-back counts, and reports the best host time per access for each
+ * over a number of repetitions.
+ *
+ * usage: ucache-bench [-n accesses] [-a array_bytes] [-s stride_bytes]
+ *                     [-r repetitions]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "host.h"
+#include "misc.h"
+#include "machine.h"
+#include "memory.h"
+#include "ucache.h"
+
+/*
+ * reference version: one malloc'ed node per line, FIFO queue per set
+ */
+
+typedef struct list_line {
+    unsigned int data[4];
+    unsigned int tag:24;
+    unsigned int dirty:1;
+    unsigned int valid:1;
+    unsigned int ref_count;
+    struct list_line *next;
+} list_line_t;
+
+typedef struct list_set {
+    list_line_t *head;
+    list_line_t *tail;
+    int n;
+} list_set_t;
+
+typedef struct list_cache {
+    list_set_t sets[16];
+    struct mem_t *mem;
+    unsigned int access;
+    unsigned int hit;
+    unsigned int miss;
+    unsigned int replace;
+    unsigned int wb;
+} list_cache_t;
+
+static void
+list_write_back(list_cache_t *cache, list_line_t *line, int index)
+{
+  md_addr_t addr = (line->tag<<8) | (index<<4);
+  int i;
+  for(i = 0; i < 4; i++) {
+    MEM_WRITE_WORD(cache->mem, addr+(i*4), line->data[i]);
+  }
+  line->dirty = 0;
+}
+
+/* kept out of line so both versions pay for a call per access */
+static int __attribute__((noinline))
+list_access(list_cache_t *cache, md_addr_t addr, word_t *word, int is_write)
+{
+  unsigned int tag = ADDR_TAG(addr);
+  unsigned int index = ADDR_INDEX(addr);
+  unsigned int offset = ADDR_OFFSET(addr);
+  list_set_t *set = &cache->sets[index];
+  list_line_t *line, *hit_line = NULL;
+  md_addr_t align_addr = addr & (~0xF);
+  int i, miss = 1;
+
+  cache->access++;
+  for(line = set->head; line != NULL; line = line->next) {
+    if(line->valid && tag == line->tag) {
+      miss = 0;
+      line->ref_count++;
+      cache->hit++;
+      hit_line = line;
+    }
+  }
+  line = hit_line;
+  if(miss) {
+    cache->miss++;
+    line = malloc(sizeof(list_line_t));
+    for(i = 0; i < 4; i++) {
+      line->data[i] = MEM_READ_WORD(cache->mem, align_addr+(i*4));
+    }
+    line->ref_count = 0;
+    line->tag = tag;
+    line->dirty = 0;
+    line->valid = 1;
+    line->next = NULL;
+    if(set->n >= SET_NUM) {
+      list_line_t *head = set->head;
+      if(head->dirty) {
+        cache->wb++;
+        list_write_back(cache, head, index);
+      }
+      cache->replace++;
+      set->head = head->next;
+      set->n -= 1;
+      if(set->n == 0) {
+        set->tail = NULL;
+      }
+      free(head);
+    }
+    if(set->tail != NULL) {
+      set->tail->next = line;
+    }
+    set->tail = line;
+    if(set->head == NULL) {
+      set->head = line;
+    }
+    set->n += 1;
+  }
+  if(is_write) {
+    memcpy((void *)(&line->data)+offset, word, sizeof(word_t));
+    line->dirty = 1;
+  } else {
+    memcpy(word, (void *)(&line->data)+offset, sizeof(word_t));
+  }
+  return miss ? 10 : 1;
+}
+
+static void
+list_free(list_cache_t *cache)
+{
+  list_line_t *line, *next;
+  int i;
+  for(i = 0; i < 16; i++) {
+    for(line = cache->sets[i].head; line != NULL; line = next) {
+      next = line->next;
+      free(line);
+    }
+  }
+  free(cache);
+}
+
+/*
+ * reference stream
+ */
+
+struct ref_t {
+  md_addr_t addr;
+  int is_write;
+};
+
+static struct ref_t *
+make_trace(int n, int array_bytes, int stride)
+{
+  struct ref_t *trace = calloc(n, sizeof(struct ref_t));
+  md_addr_t text = 0x00400000, data = 0x10000000;
+  int i = 0, pc = 0, elem = 0;
+
+  if (!trace)
+    fatal("out of virtual memory");
+
+  while (i < n)
+    {
+      /* a 12 instruction loop body, both words of each instruction */
+      trace[i].addr = text + pc*8;
+      trace[i++].is_write = FALSE;
+      if (i < n)
+	{
+	  trace[i].addr = text + pc*8 + 4;
+	  trace[i++].is_write = FALSE;
+	}
+      pc = (pc + 1) % 12;
+
+      /* a load and a store to the same element every third instruction */
+      if (pc % 3 == 0 && i + 1 < n)
+	{
+	  trace[i].addr = data + elem;
+	  trace[i++].is_write = FALSE;
+	  trace[i].addr = data + elem;
+	  trace[i++].is_write = TRUE;
+	  elem = (elem + stride) % array_bytes;
+	}
+    }
+  return trace;
+}
+
+static double
+now_usec(void)
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return (double)tv.tv_sec * 1e6 + (double)tv.tv_usec;
+}
+
+/* replay TRACE through the list version, returns elapsed usecs */
+static double
+run_list(struct ref_t *trace, int n, struct mem_t *mem, list_cache_t **lcache)
+{
+  double start;
+  word_t word;
+  int i;
+
+  *lcache = calloc(1, sizeof(list_cache_t));
+  (*lcache)->mem = mem;
+  start = now_usec();
+  for (i = 0; i < n; i++)
+    {
+      word = i;
+      list_access(*lcache, trace[i].addr, &word, trace[i].is_write);
+    }
+  return now_usec() - start;
+}
+
+/* replay TRACE through the array version, returns elapsed usecs */
+static double
+run_array(struct ref_t *trace, int n, struct mem_t *mem, cache_t **acache)
+{
+  double start;
+  word_t word;
+  int i;
+
+  *acache = calloc(1, sizeof(cache_t));
+  ucache_init(*acache, mem, 16, 16, 4, REPL_FIFO, 1, 10, NULL);
+  start = now_usec();
+  for (i = 0; i < n; i++)
+    {
+      word = i;
+      if (trace[i].is_write)
+	ucache_write(*acache, trace[i].addr, &word, 0, 0);
+      else
+	ucache_read(*acache, trace[i].addr, &word, 0, 0);
+    }
+  return now_usec() - start;
+}
+
+int
+main(int argc, char **argv)
+{
+  int i, n = 20000000, array_bytes = 64*1024, stride = 4, reps = 5;
+  struct ref_t *trace;
+  list_cache_t *lcache = NULL;
+  cache_t *acache = NULL;
+  struct mem_t *lmem, *amem;
+  double t, t_list = 0.0, t_array = 0.0;
+
+  for (i = 1; i < argc - 1; i++)
+    {
+      if (!strcmp(argv[i], "-n"))
+	n = atoi(argv[++i]);
+      else if (!strcmp(argv[i], "-a"))
+	array_bytes = atoi(argv[++i]);
+      else if (!strcmp(argv[i], "-s"))
+	stride = atoi(argv[++i]);
+      else if (!strcmp(argv[i], "-r"))
+	reps = atoi(argv[++i]);
+    }
+  if (n <= 0 || array_bytes < 4 || stride <= 0 || (stride & 3) != 0
+      || reps <= 0)
+    fatal("usage: ucache-bench [-n accesses] [-a array_bytes] "
+	  "[-s stride_bytes] [-r repetitions]");
+
+  trace = make_trace(n, array_bytes, stride);
+  lmem = mem_create("list");
+  amem = mem_create("array");
+
+  /* alternate the two versions so host noise hits both alike */
+  for (i = 0; i < reps; i++)
+    {
+      if (lcache)
+	list_free(lcache);
+      t = run_list(trace, n, lmem, &lcache);
+      if (i == 0 || t < t_list)
+	t_list = t;
+
+      if (acache)
+	free(acache);
+      t = run_array(trace, n, amem, &acache);
+      if (i == 0 || t < t_array)
+	t_array = t;
+    }
+
+  fprintf(stdout,
+	  "ucache-bench: %d accesses, %d byte array, %d byte stride, "
+	  "best of %d\n", n, array_bytes, stride, reps);
+  fprintf(stdout, "%-8s %12s %12s %12s %12s %10s\n",
+	  "cache", "hits", "misses", "repls", "wbs", "ns/access");
+  fprintf(stdout, "%-8s %12u %12u %12u %12u %10.2f\n", "list",
+	  lcache->hit, lcache->miss, lcache->replace, lcache->wb,
+	  t_list * 1000.0 / n);
+  fprintf(stdout, "%-8s %12u %12u %12u %12u %10.2f\n", "array",
+	  acache->hit, acache->miss, acache->replace, acache->wb,
+	  t_array * 1000.0 / n);
+  fprintf(stdout, "speedup: %.2fx\n", t_list / t_array);
+
+  if (lcache->hit != acache->hit || lcache->miss != acache->miss
+      || lcache->replace != acache->replace || lcache->wb != acache->wb)
+    fatal("list and array caches disagree");
+
+  return 0;
+}
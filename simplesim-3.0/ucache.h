@@ -5,58 +5,228 @@
 #ifndef UCACHE_H
 #define UCACHE_H
 
+#include "host.h"
+#include "machine.h"
+#include "memory.h"
+
+/* default geometry: 16 sets, four-way, 16-byte lines; building with
+   -DUCACHE_FIXED compiles this geometry in as constants */
 #define SET_NUM 4
+#define LINE_WORDS 4
+#define CACHE_SETS 16
 #define ADDR_TAG(ADDR) (((unsigned int)ADDR)>>8)
 #define ADDR_INDEX(ADDR) ((((unsigned int)ADDR)&0xF0)>>4)
 #define ADDR_OFFSET(ADDR) (((unsigned int)ADDR)&0xF)
 
+/* valid flag kept in the packed tag word, tags are at most 30 bits wide
+   (4-byte blocks in a single set of a 32-bit address space) so the flag
+   never overlaps one; a set compares its packed tags four ways at a time */
+#define TAG_VALID 0x80000000
+
+/* replacement policy, the live ways of a set always sit in an index queue */
+typedef enum {
+    REPL_FIFO = 0,              /* evict the oldest filled way */
+    REPL_LRU,                   /* evict the least recently touched way */
+    REPL_RANDOM,                /* evict a random way */
+    REPL_PLRU                   /* evict the way the tree bits point at */
+} repl_policy_t;
+
+/* prefetch engine, see ucache_prefetch() */
+typedef enum {
+    PF_NONE = 0,
+    PF_NEXTLINE,                /* next blocks on a miss or first use of a prefetch */
+    PF_STRIDE,                  /* per-PC stride table */
+    PF_STREAM                   /* sequential stream buffers next to the cache */
+} pf_kind_t;
+
+/* reference prediction table entry of the stride prefetcher */
+typedef struct cache_pf_stride {
+    md_addr_t pc;
+    md_addr_t last_addr;
+    int stride;
+    int conf;                       /* 0..3, prefetches from 2 on */
+} cache_pf_stride_t;
+
+/* stream buffer, a FIFO of blocks being fetched after a miss */
+typedef struct cache_pf_stream {
+    int valid;
+    md_addr_t next;                 /* next block to fetch */
+    tick_t last_use;                /* for LRU reallocation */
+    int head;
+    int n;
+    md_addr_t *baddr;               /* pf_degree entries */
+    tick_t *ready;
+} cache_pf_stream_t;
+
+/* a block queued for the next level, see ucache_write_policy() */
+typedef struct cache_wbuf_entry {
+    md_addr_t baddr;                /* block address being written */
+    tick_t ready;                   /* cycle the next level has taken it */
+} cache_wbuf_entry_t;
+
 typedef struct cache_line {
-    unsigned int data[4];
-    unsigned int tag:24;
+#ifdef UCACHE_FIXED
+    unsigned int data[LINE_WORDS];
+#else
+    unsigned int *data;             /* bsize bytes in cache->data */
+#endif
+    unsigned int tag;
     unsigned int dirty:1;
     unsigned int valid:1;
+    unsigned int prefetched:1;      /* filled by a prefetch, not used yet */
     unsigned int ref_count;
-    struct cache_line *next;
+    tick_t ready;                   /* cycle a prefetched fill completes */
 } cache_line_t;
 
+/* the fixed build keeps each set in one block, the configurable build
+   points the same fields into per-cache arrays sized at ucache_init() */
 typedef struct cache_set {
-    cache_line_t *head;
-    cache_line_t *tail;
+#ifdef UCACHE_FIXED
+    unsigned int tags[SET_NUM];     /* packed tag|TAG_VALID per way, probed on lookup */
+    unsigned char order[SET_NUM];   /* way indices, next victim first */
+    unsigned char plru[SET_NUM];    /* tree-PLRU node bits, node 1 is the root */
+    int n;                          /* number of ways in use */
+    cache_line_t lines[SET_NUM];    /* preallocated ways, never freed */
+#else
+    unsigned int *tags;
+    unsigned char *order;
+    unsigned char *plru;
     int n;
+    cache_line_t *lines;
+#endif
 } cache_set_t;
 
 typedef struct cache {
-    cache_set_t sets[16];
+#ifdef UCACHE_FIXED
+    cache_set_t sets[CACHE_SETS];
+#else
+    cache_set_t *sets;
+#endif
+    struct mem_t *mem;
+    repl_policy_t policy;
+
+    /* geometry, and fields derived from it for fast address decoding */
+    int nsets;
+    int assoc;
+    int bsize;
+    md_addr_t blk_mask;
+    int set_shift;
+    md_addr_t set_mask;             /* use *after* shift */
+    int tag_shift;
+    int way_bits;                   /* log2(assoc), depth of the PLRU tree */
+
+    int hit_lat;
+    int miss_lat;                   /* used when there is no next level */
+
+    /* next level, called with the block address on a miss (Read) and on a
+       dirty replacement (Write), returns its latency; NULL charges a flat
+       miss_lat, cf. blk_access_fn in cache.h */
+    unsigned int (*blk_access_fn)(enum mem_cmd cmd, md_addr_t baddr,
+                                  int bsize, tick_t now);
+
+    /* write policy, and a FIFO write buffer draining blocks to the next
+       level in the background; wbuf_size 0 writes synchronously */
+    int write_through;              /* stores also go to the next level */
+    int write_alloc;                /* store misses fill a line */
+    int wbuf_size;
+    int wbuf_head;
+    int wbuf_n;
+    cache_wbuf_entry_t *wbuf;
+
+    /* prefetch engine */
+    pf_kind_t pf_kind;
+    int pf_degree;                  /* blocks ahead, or stream buffer depth */
+    int pf_table_size;
+    cache_pf_stride_t *pf_table;
+    int pf_nstreams;
+    cache_pf_stream_t *pf_streams;
+
+    /* last line hit, checked before the set is searched */
+    md_addr_t last_tagset;          /* block address of last line accessed */
+    cache_line_t *last_line;        /* cache line last accessed */
+
     unsigned int enable;
     unsigned int access;
     unsigned int hit;
     unsigned int miss;
     unsigned int replace;
     unsigned int wb;
+    unsigned int write_thru;        /* stores written through */
+    unsigned int write_around;      /* store misses not allocated */
+    unsigned int wbuf_merge;        /* writes coalesced in the write buffer */
+    counter_t wbuf_full;            /* cycles stalled on a full write buffer */
+    unsigned int pf_issued;         /* blocks prefetched */
+    unsigned int pf_useful;         /* prefetched blocks a demand access used */
+    unsigned int pf_late;           /* ... that were still on their way */
+    unsigned int pf_useless;        /* prefetched lines replaced unused */
 } cache_t;
 
-typedef void(*cache_word_func)(cache_line_t *, word_t *, int);
+/* address decoding, constant folded in the fixed build */
+#ifdef UCACHE_FIXED
+#define UCACHE_ASSOC(C) SET_NUM
+#define UCACHE_NSETS(C) CACHE_SETS
+#define UCACHE_BSIZE(C) (LINE_WORDS*sizeof(word_t))
+#define UCACHE_WAY_BITS(C) 2
+#define UCACHE_TAG(C, ADDR) ADDR_TAG(ADDR)
+#define UCACHE_INDEX(C, ADDR) ADDR_INDEX(ADDR)
+#define UCACHE_OFFSET(C, ADDR) ADDR_OFFSET(ADDR)
+#define UCACHE_MK_ADDR(C, TAG, INDEX) (((TAG)<<8) | ((INDEX)<<4))
+#define UCACHE_TAGSET(C, ADDR) (((unsigned int)(ADDR)) & ~0xF)
+#else
+#define UCACHE_ASSOC(C) ((C)->assoc)
+#define UCACHE_NSETS(C) ((C)->nsets)
+#define UCACHE_BSIZE(C) ((C)->bsize)
+#define UCACHE_WAY_BITS(C) ((C)->way_bits)
+#define UCACHE_TAG(C, ADDR) (((unsigned int)(ADDR)) >> (C)->tag_shift)
+#define UCACHE_INDEX(C, ADDR) ((((unsigned int)(ADDR)) >> (C)->set_shift) & (C)->set_mask)
+#define UCACHE_OFFSET(C, ADDR) (((unsigned int)(ADDR)) & (C)->blk_mask)
+#define UCACHE_MK_ADDR(C, TAG, INDEX) (((TAG) << (C)->tag_shift) | ((INDEX) << (C)->set_shift))
+#define UCACHE_TAGSET(C, ADDR) (((unsigned int)(ADDR)) & ~(C)->blk_mask)
+#endif
+
+typedef void(*ucache_word_func)(cache_line_t *, word_t *, int);
+
+void ucache_init(cache_t *, struct mem_t *, int, int, int, repl_policy_t, int, int,
+                 unsigned int (*)(enum mem_cmd, md_addr_t, int, tick_t));
+
+void ucache_write_policy(cache_t *, int, int, int);
+
+void ucache_prefetch(cache_t *, pf_kind_t, int, int, int);
+
+pf_kind_t ucache_str2pf(char *);
+
+char *ucache_pf2str(pf_kind_t);
+
+repl_policy_t ucache_str2policy(char *);
+
+char *ucache_policy2str(repl_policy_t);
+
+void ucache_print_config(cache_t *, char *, FILE *);
+
+void en_cache_set(cache_t *, cache_set_t *, int);
+
+int de_cache_set(cache_t *, cache_set_t *, int);
 
-void en_cache_set(cache_set_t *, cache_line_t *);
+void touch_cache_set(cache_t *, cache_set_t *, int);
 
-void de_cache_set(cache_set_t *);
+int ucache_victim(cache_t *, cache_set_t *);
 
-int cache_access(cache_t *, md_addr_t, word_t *, cache_word_func);
+int ucache_access(cache_t *, md_addr_t, word_t *, ucache_word_func, md_addr_t, tick_t);
 
-int cache_read(cache_t *, md_addr_t, word_t *);
+int ucache_read(cache_t *, md_addr_t, word_t *, md_addr_t, tick_t);
 
-int cache_write(cache_t *, md_addr_t, word_t *);
+int ucache_write(cache_t *, md_addr_t, word_t *, md_addr_t, tick_t);
 
-void cache_word_read(cache_line_t *, word_t *, int);
+void ucache_word_read(cache_line_t *, word_t *, int);
 
-void cache_word_write(cache_line_t *, word_t *, int);
+void ucache_word_write(cache_line_t *, word_t *, int);
 
-cache_line_t *malloc_cache_line(md_addr_t);
+void fill_cache_line(cache_t *, cache_line_t *, md_addr_t);
 
-void cache_write_back(cache_line_t *, int);
+unsigned int ucache_write_back(cache_t *, cache_line_t *, int, tick_t);
 
-void cache_flush(cache_t *);
+void ucache_flush(cache_t *, tick_t);
 
-void add_into_cache_set(cache_set_t *, cache_line_t *, int);
+cache_line_t *add_into_cache_set(cache_t *, cache_set_t *, int, md_addr_t, tick_t, unsigned int *);
 
 #endif //UCACHE_H